@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <string.h>
+#include "batch.h"
+#include "encode.h"
+#include "cover_cache.h"
+#include "mem_budget.h"
+#include "types.h"
+
+/* Function Definitions */
+
+/* Run one job line through the normal encode path
+ * Tokens are handed to read_and_validate_encode_args()
+ * as if they came from the command line.
+ */
+static Status run_job(char *line, CoverCache *cache, MemBudget *budget, const StegoOptions *opts)
+{
+    char *args[6] = {"batch", "-e", NULL, NULL, NULL, NULL};
+    EncodeInfo encInfo;
+    Status ret;
+    size_t reserved, full, low;
+    int low_memory;
+    int n = 2;
+
+    for(char *tok = strtok(line, " \t\r\n"); tok != NULL && n < 5; tok = strtok(NULL, " \t\r\n"))
+    {
+        args[n++] = tok;
+    }
+
+    if(n < 4)
+    {
+        printf("Error: Insufficient arguments for encoding\n");
+        return e_failure;
+    }
+
+    memset(&encInfo, 0, sizeof(encInfo));
+    encInfo.cover_cache = cache;
+    encInfo.opts = *opts;
+
+    if(read_and_validate_encode_args(args, &encInfo) == e_failure)
+    {
+        printf("Error: Invalid arguments for encoding\n");
+        return e_failure;
+    }
+
+    //a job too big for the budget falls back to the low memory engines
+    mem_budget_estimate_encode(&encInfo, &full, &low);
+    reserved = mem_budget_reserve(budget, full, low, &low_memory);
+    if(low_memory)
+        encInfo.opts.low_memory = 1;
+
+    ret = do_encoding(&encInfo);
+    if(close_files(&encInfo) == e_failure)
+    {
+        ret = e_failure;
+    }
+    mem_budget_release(budget, reserved);
+
+    if(ret == e_success && encInfo.opts.self_check)
+    {
+        stego_check_report(&encInfo.check, stdout);
+    }
+
+    return ret;
+}
+
+/* Run every job of the job file, cache_budget is in bytes */
+Status do_batch_encoding(const char *job_fname, size_t cache_budget, const StegoOptions *opts)
+{
+    CoverCache cache;
+    MemBudget budget;
+    FILE *fptr_jobs;
+    char line[MAX_JOB_LINE];
+    int jobs = 0, failed = 0;
+
+    if(strcmp(job_fname, "-") == 0)
+    {
+        fptr_jobs = stdin;
+    }
+    else
+    {
+        fptr_jobs = fopen(job_fname, "r");
+        if(fptr_jobs == NULL)
+        {
+            perror("fopen");
+            fprintf(stderr, "ERROR: Unable to open file %s\n", job_fname);
+            return e_failure;
+        }
+    }
+
+    cover_cache_init(&cache, cache_budget);
+    mem_budget_init(&budget, opts->mem_budget);
+
+    while(fgets(line, sizeof(line), fptr_jobs) != NULL)
+    {
+        //skip blank lines and comments
+        if(line[strspn(line, " \t\r\n")] == '\0' || line[0] == '#')
+        {
+            continue;
+        }
+
+        jobs++;
+        if(run_job(line, &cache, &budget, opts) == e_success)
+        {
+            printf("Job %d: File Encoding completed successfully\n", jobs);
+        }
+        else
+        {
+            printf("Job %d: Encoding failed!\n", jobs);
+            failed++;
+        }
+    }
+
+    printf("Batch done: %d jobs, %d failed\n", jobs, failed);
+    cover_cache_print_stats(&cache, stdout);
+    mem_budget_print_stats(&budget, stdout);
+    cover_cache_destroy(&cache);
+    mem_budget_destroy(&budget);
+
+    if(fptr_jobs != stdin)
+    {
+        fclose(fptr_jobs);
+    }
+
+    return failed ? e_failure : e_success;
+}
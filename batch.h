@@ -0,0 +1,26 @@
+#ifndef BATCH_H
+#define BATCH_H
+#include <stdio.h>
+#include <stddef.h>
+#include "types.h" // Contains user defined types
+#include "options.h"
+
+/*
+ * Batch mode runs many encodes in one process.
+ * Each line of the job file is
+ *     <cover.bmp|png> <secret file> [stego.bmp|png]
+ * Covers are shared through a cover cache so the
+ * same cover is opened and parsed only once.
+ * Options given on the command line apply to every job.
+ * Job file "-" reads jobs from stdin, which lets a
+ * long running producer keep feeding the same process.
+ */
+
+#define MAX_JOB_LINE 4096
+
+/* Batch function prototypes */
+
+/* Run every job of the job file, cache_budget is in bytes */
+Status do_batch_encoding(const char *job_fname, size_t cache_budget, const StegoOptions *opts);
+
+#endif
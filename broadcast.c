@@ -0,0 +1,370 @@
+#define _GNU_SOURCE     // open_memstream, fmemopen
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "broadcast.h"
+#include "encode.h"
+#include "common.h"
+#include "types.h"
+#include "tune.h"
+
+/* Directory + file name */
+#define BROADCAST_PATH_SIZE (PATH_MAX + NAME_MAX + 2)
+
+/* Shared state of a broadcast run */
+typedef struct _Broadcast
+{
+    const char *secret_fname;
+    char out_dir[PATH_MAX];
+    StegoOptions opts;
+
+    /* Pre-expanded payload, one 0/1 byte per pixel byte */
+    unsigned char *plane;
+    size_t plane_len;
+
+    /* Covers, handed out in order */
+    char **covers;
+    int ncovers;
+    int next;
+    pthread_mutex_t lock;
+
+    /* Stats */
+    int failed;
+
+} Broadcast;
+
+/* Function Definitions */
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* Collect the .bmp / .png covers of cover_dir, sorted */
+static Status load_covers(Broadcast *bc, const char *cover_dir)
+{
+    DIR *dir = opendir(cover_dir);
+    struct dirent *ent;
+    int size = 0;
+
+    if(dir == NULL)
+    {
+        perror("opendir");
+        fprintf(stderr, "ERROR: Unable to open directory %s\n", cover_dir);
+        return e_failure;
+    }
+
+    while((ent = readdir(dir)) != NULL)
+    {
+        char path[BROADCAST_PATH_SIZE];
+        size_t len = strlen(ent->d_name);
+
+        if(ent->d_name[0] == '.' || len <= 4 ||
+           (strcmp(ent->d_name + len - 4, ".bmp") != 0 && strcmp(ent->d_name + len - 4, ".png") != 0))
+            continue;
+
+        if(bc->ncovers == size)
+        {
+            char **grown = realloc(bc->covers, (size ? size * 2 : 64) * sizeof(char *));
+
+            if(grown == NULL)
+                break;
+            bc->covers = grown;
+            size = size ? size * 2 : 64;
+        }
+
+        snprintf(path, sizeof(path), "%s/%s", cover_dir, ent->d_name);
+        bc->covers[bc->ncovers] = strdup(path);
+        if(bc->covers[bc->ncovers] != NULL)
+            bc->ncovers++;
+    }
+    closedir(dir);
+
+    if(bc->ncovers == 0)
+    {
+        printf("Error: No .bmp or .png covers in %s\n", cover_dir);
+        return e_failure;
+    }
+
+    qsort(bc->covers, bc->ncovers, sizeof(char *), compare_names);
+    return e_success;
+}
+
+/* Expand the payload once into the bit plane
+ * The regular field encoders write to a memory stream while
+ * reading an all-zero cover, so the LSB they set is the
+ * whole pixel byte. Every header layout the options select
+ * comes out exactly as do_encoding() would write it.
+ */
+static Status build_plane(Broadcast *bc)
+{
+    EncodeInfo *encInfo = calloc(1, sizeof(*encInfo));
+    unsigned char *zeros = NULL;
+    char *out = NULL;
+    size_t out_len = 0, bound;
+    Status ret = e_failure;
+
+    if(encInfo == NULL)
+        return e_failure;
+
+    encInfo->opts = bc->opts;
+    encInfo->secret_fname = (char *)bc->secret_fname;
+    encInfo->fptr_secret = fopen(bc->secret_fname, "r");
+    if(encInfo->fptr_secret == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR: Unable to open file %s\n", bc->secret_fname);
+        free(encInfo);
+        return e_failure;
+    }
+
+    encInfo->size_secret_file = get_file_size(encInfo->fptr_secret);
+    strcpy(encInfo->extn_secret_file, ".txt");
+    set_stego_flags(encInfo);
+
+    //payload plus every header field there is, 8 pixel bytes a byte
+    bound = BMP_HEADER_SIZE + 8 * (get_payload_size(encInfo) + 128);
+    zeros = calloc(1, bound);
+    if(zeros != NULL)
+    {
+        encInfo->fptr_src_image = fmemopen(zeros, bound, "r");
+        encInfo->fptr_stego_image = open_memstream(&out, &out_len);
+    }
+
+    if(encInfo->fptr_src_image != NULL && encInfo->fptr_stego_image != NULL &&
+       copy_bmp_header(encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_success &&
+       encode_magic_string(encInfo->stego_flags ? MAGIC_STRING_EXT : MAGIC_STRING, encInfo) == e_success &&
+       (encInfo->stego_flags == 0 || encode_stego_header(encInfo) == e_success) &&
+       encode_secret_payload(encInfo) == e_success)
+    {
+        ret = e_success;
+    }
+
+    close_files(encInfo);
+    if(ret == e_success && out_len > BMP_HEADER_SIZE)
+    {
+        bc->plane_len = out_len - BMP_HEADER_SIZE;
+        bc->plane = malloc(bc->plane_len);
+        if(bc->plane != NULL)
+            memcpy(bc->plane, out + BMP_HEADER_SIZE, bc->plane_len);
+        else
+            ret = e_failure;
+    }
+    else
+    {
+        ret = e_failure;
+    }
+
+    free(out);
+    free(zeros);
+    free(encInfo);
+    return ret;
+}
+
+/* AND/OR blend of one chunk, vectorised by the compiler */
+static void blend_plane(unsigned char *restrict pixels, const unsigned char *restrict plane, size_t len)
+{
+    for(size_t i = 0; i < len; i++)
+    {
+        pixels[i] = (pixels[i] & 0xFE) | plane[i];
+    }
+}
+
+/* Header, blended plane, rest of the image */
+static Status blend_cover(Broadcast *bc, EncodeInfo *encInfo)
+{
+    static __thread unsigned char buf[BROADCAST_CHUNK];
+
+    if(copy_bmp_header(encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_failure)
+    {
+        return e_failure;
+    }
+
+    for(size_t done = 0; done < bc->plane_len;)
+    {
+        size_t want = bc->plane_len - done < sizeof(buf) ? bc->plane_len - done : sizeof(buf);
+
+        if(fread(buf, 1, want, encInfo->fptr_src_image) != want)
+        {
+            return e_failure;
+        }
+        blend_plane(buf, bc->plane + done, want);
+        if(fwrite(buf, 1, want, encInfo->fptr_stego_image) != want)
+        {
+            return e_failure;
+        }
+        done += want;
+    }
+
+    return copy_remaining_img_data(encInfo->fptr_src_image, encInfo->fptr_stego_image);
+}
+
+/* Write one stego image through the normal open / close path */
+static Status broadcast_one(Broadcast *bc, EncodeInfo *encInfo, const char *cover)
+{
+    char out[BROADCAST_PATH_SIZE];
+    char *args[6] = {"broadcast", "-e", (char *)cover, (char *)bc->secret_fname, out, NULL};
+    const char *name = strrchr(cover, '/');
+    Status ret = e_failure;
+
+    snprintf(out, sizeof(out), "%s/%s", bc->out_dir, name != NULL ? name + 1 : cover);
+
+    memset(encInfo, 0, sizeof(*encInfo));
+    encInfo->opts = bc->opts;
+
+    if(read_and_validate_encode_args(args, encInfo) == e_failure)
+    {
+        printf("Error: Invalid arguments for encoding %s\n", cover);
+        return e_failure;
+    }
+
+    set_stego_flags(encInfo);
+    if(open_files(encInfo) == e_success)
+    {
+        //PNG capacity comes from the reader, BMP from the file size
+        if(encInfo->image_capacity == 0)
+        {
+            encInfo->image_capacity = get_file_size(encInfo->fptr_src_image) - BMP_HEADER_SIZE;
+        }
+
+        if(encInfo->image_capacity <= bc->plane_len + BMP_HEADER_SIZE)
+        {
+            printf("Error: %s is too small for the secret\n", cover);
+        }
+        else
+        {
+            ret = blend_cover(bc, encInfo);
+        }
+    }
+
+    if(close_files(encInfo) == e_failure)
+    {
+        ret = e_failure;
+    }
+    if(ret == e_failure)
+    {
+        printf("Error: Broadcast to %s failed\n", cover);
+        unlink(out);
+    }
+    else if(encInfo->opts.self_check)
+    {
+        stego_check_report(&encInfo->check, stdout);
+    }
+
+    return ret;
+}
+
+static void *broadcast_worker(void *arg)
+{
+    Broadcast *bc = arg;
+    //EncodeInfo is large, keep it off the worker stack
+    EncodeInfo *encInfo = malloc(sizeof(*encInfo));
+
+    while(encInfo != NULL)
+    {
+        const char *cover = NULL;
+        Status ret;
+
+        pthread_mutex_lock(&bc->lock);
+        if(bc->next < bc->ncovers)
+            cover = bc->covers[bc->next++];
+        pthread_mutex_unlock(&bc->lock);
+
+        if(cover == NULL)
+            break;
+
+        ret = broadcast_one(bc, encInfo, cover);
+
+        pthread_mutex_lock(&bc->lock);
+        if(ret == e_failure)
+            bc->failed++;
+        pthread_mutex_unlock(&bc->lock);
+    }
+
+    free(encInfo);
+    return NULL;
+}
+
+/* Embed secret_fname into every cover of cover_dir */
+Status do_broadcast_encoding(const char *secret_fname, const char *cover_dir, const char *out_dir,
+                             int workers, const StegoOptions *opts)
+{
+    Broadcast *bc = calloc(1, sizeof(*bc));
+    pthread_t threads[BROADCAST_MAX_WORKERS];
+    char covers[PATH_MAX];
+    struct timespec start, end;
+    int nthreads = 0;
+    Status ret = e_failure;
+
+    if(bc == NULL)
+        return e_failure;
+
+    bc->secret_fname = secret_fname;
+    bc->opts = *opts;
+    bc->opts.resume = 0;
+    pthread_mutex_init(&bc->lock, NULL);
+
+    if(opts->spread_key != NULL)
+    {
+        //spread positions depend on each cover's size
+        printf("Error: --spread cannot be used with broadcast\n");
+    }
+    else if(opts->segmented)
+    {
+        //the plane is sized for the plain size + data layout
+        printf("Error: --segmented cannot be used with broadcast\n");
+    }
+    else if(realpath(cover_dir, covers) == NULL || realpath(out_dir, bc->out_dir) == NULL)
+    {
+        perror("realpath");
+    }
+    else if(strcmp(covers, bc->out_dir) == 0)
+    {
+        printf("Error: Cover and output directories must differ\n");
+    }
+    else if(load_covers(bc, covers) == e_success && build_plane(bc) == e_success)
+    {
+        if(workers <= 0)
+            workers = tune_threads();
+        if(workers > BROADCAST_MAX_WORKERS)
+            workers = BROADCAST_MAX_WORKERS;
+        if(workers > bc->ncovers)
+            workers = bc->ncovers;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        while(nthreads < workers && pthread_create(&threads[nthreads], NULL, broadcast_worker, bc) == 0)
+        {
+            nthreads++;
+        }
+        for(int i = 0; i < nthreads; i++)
+        {
+            pthread_join(threads[i], NULL);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        if(nthreads > 0)
+        {
+            double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+            printf("Broadcast done: %d covers, %d failed, %zu byte plane, %d workers, %.2f s\n",
+                   bc->ncovers, bc->failed, bc->plane_len, nthreads, secs);
+            ret = bc->failed == 0 ? e_success : e_failure;
+        }
+    }
+
+    for(int i = 0; i < bc->ncovers; i++)
+    {
+        free(bc->covers[i]);
+    }
+    free(bc->covers);
+    free(bc->plane);
+    pthread_mutex_destroy(&bc->lock);
+    free(bc);
+
+    return ret;
+}
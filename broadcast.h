@@ -0,0 +1,32 @@
+#ifndef BROADCAST_H
+#define BROADCAST_H
+#include <stdio.h>
+#include <stddef.h>
+#include "types.h" // Contains user defined types
+#include "options.h"
+
+/*
+ * Broadcast mode embeds one secret into every cover of a
+ * directory (watermarking a distribution).
+ * The whole payload (magic, header fields, extension, size
+ * and data, encrypted / coded as the options ask) is run
+ * once through the normal encoder against an all-zero
+ * cover. What comes out is the bit plane itself, one 0/1
+ * byte per pixel byte, so each cover only needs
+ *     stego = (cover & 0xFE) | plane
+ * over the plane and a plain copy of the rest, done on a
+ * pool of worker threads. Stego images are written under
+ * the same name in the output directory.
+ */
+
+#define BROADCAST_CHUNK 65536       // pixel bytes blended at a time
+#define BROADCAST_MAX_WORKERS 64
+
+/* Broadcast function prototypes */
+
+/* Embed secret_fname into every cover of cover_dir, workers = 0 picks
+ * the tuned thread count */
+Status do_broadcast_encoding(const char *secret_fname, const char *cover_dir, const char *out_dir,
+                             int workers, const StegoOptions *opts);
+
+#endif
@@ -0,0 +1,164 @@
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include "chacha.h"
+#include "types.h"
+
+/* Function Definitions */
+
+/* One lane per block, 8 blocks in flight */
+typedef uint32_t vec8 __attribute__((vector_size(CHACHA_LANES * 4)));
+
+#define ROTL(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTER_ROUND(a, b, c, d)         \
+    do                                    \
+    {                                     \
+        a += b; d ^= a; d = ROTL(d, 16);  \
+        c += d; b ^= c; b = ROTL(b, 12);  \
+        a += b; d ^= a; d = ROTL(d, 8);   \
+        c += d; b ^= c; b = ROTL(b, 7);   \
+    } while(0)
+
+/* Read a little endian word */
+static uint32_t load32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* Make CHACHA_LANES keystream blocks starting at the state counter */
+static void chacha20_blocks(const uint32_t *in, unsigned char *out)
+{
+    vec8 x[16], orig[16];
+    vec8 lane = {0, 1, 2, 3, 4, 5, 6, 7};
+
+    for(int i = 0; i < 16; i++)
+    {
+        x[i] = (vec8){0} + in[i];   //broadcast word to every lane
+    }
+    x[12] += lane;                  //each lane gets its own block counter
+
+    memcpy(orig, x, sizeof(x));
+
+    for(int round = 0; round < 10; round++)
+    {
+        //column round
+        QUARTER_ROUND(x[0], x[4], x[8], x[12]);
+        QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+        QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+        QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+
+        //diagonal round
+        QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+        QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+        QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+        QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+    }
+
+    //add the input and store every lane as one little endian block
+    for(int i = 0; i < 16; i++)
+    {
+        x[i] += orig[i];
+
+        for(int b = 0; b < CHACHA_LANES; b++)
+        {
+            unsigned char *p = out + b * CHACHA_BLOCK_SIZE + i * 4;
+            p[0] = x[i][b];
+            p[1] = x[i][b] >> 8;
+            p[2] = x[i][b] >> 16;
+            p[3] = x[i][b] >> 24;
+        }
+    }
+}
+
+/* Set up key, nonce and starting block counter */
+void chacha20_init(ChaCha20 *ctx, const unsigned char *key, const unsigned char *nonce, uint32_t counter)
+{
+    //"expand 32-byte k"
+    ctx->state[0] = 0x61707865;
+    ctx->state[1] = 0x3320646e;
+    ctx->state[2] = 0x79622d32;
+    ctx->state[3] = 0x6b206574;
+
+    for(int i = 0; i < 8; i++)
+    {
+        ctx->state[4 + i] = load32(key + 4 * i);
+    }
+
+    ctx->state[12] = counter;
+    ctx->state[13] = load32(nonce);
+    ctx->state[14] = load32(nonce + 4);
+    ctx->state[15] = load32(nonce + 8);
+
+    ctx->used = CHACHA_BATCH_SIZE;  //nothing generated yet
+}
+
+/* XOR len bytes with the next keystream bytes (encrypt == decrypt) */
+void chacha20_xor(ChaCha20 *ctx, unsigned char *data, size_t len)
+{
+    for(size_t i = 0; i < len; i++)
+    {
+        if(ctx->used == CHACHA_BATCH_SIZE)
+        {
+            chacha20_blocks(ctx->state, ctx->stream);
+            ctx->state[12] += CHACHA_LANES;
+            ctx->used = 0;
+        }
+        data[i] ^= ctx->stream[ctx->used++];
+    }
+}
+
+/* Position the keystream offset bytes past block counter
+ * Batches start at any counter, so the block holding offset
+ * is made directly and the bytes before it are dropped.
+ */
+void chacha20_seek(ChaCha20 *ctx, uint32_t counter, uint64_t offset)
+{
+    ctx->state[12] = counter + (uint32_t)(offset / CHACHA_BLOCK_SIZE);
+    chacha20_blocks(ctx->state, ctx->stream);
+    ctx->state[12] += CHACHA_LANES;
+    ctx->used = offset % CHACHA_BLOCK_SIZE;
+}
+
+/* Derive a key from --key, 64 hex digits are taken as the raw key
+ * Anything else is a passphrase, absorbed 32 bytes at a time
+ * into the key of a ChaCha20 block (a plain hash, not a slow KDF).
+ */
+void chacha20_key_from_string(const char *pass, unsigned char *key)
+{
+    static const unsigned char kdf_nonce[CHACHA_NONCE_SIZE] = "stego-kdf-v1";
+    size_t len = strlen(pass);
+    size_t i;
+
+    for(i = 0; i < len && isxdigit((unsigned char)pass[i]); i++)
+        ;
+
+    if(len == CHACHA_KEY_SIZE * 2 && i == len)
+    {
+        for(i = 0; i < CHACHA_KEY_SIZE; i++)
+        {
+            char hex[3] = {pass[2 * i], pass[2 * i + 1], '\0'};
+            key[i] = (unsigned char)strtoul(hex, NULL, 16);
+        }
+        return;
+    }
+
+    memset(key, 0, CHACHA_KEY_SIZE);
+
+    //the last chunk is zero padded and the length goes in the counter
+    for(i = 0; i == 0 || i < len; i += CHACHA_KEY_SIZE)
+    {
+        ChaCha20 ctx;
+        unsigned char block[CHACHA_BATCH_SIZE];
+        size_t n = len - i < CHACHA_KEY_SIZE ? len - i : CHACHA_KEY_SIZE;
+
+        for(size_t k = 0; k < n; k++)
+        {
+            key[k] ^= (unsigned char)pass[i + k];
+        }
+
+        chacha20_init(&ctx, key, kdf_nonce, (uint32_t)(len + i));
+        chacha20_blocks(ctx.state, block);
+        memcpy(key, block, CHACHA_KEY_SIZE);
+    }
+}
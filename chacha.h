@@ -0,0 +1,42 @@
+#ifndef CHACHA_H
+#define CHACHA_H
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * ChaCha20 stream cipher (RFC 7539) for the optional
+ * --key mode. Keystream is made 8 blocks at a time with
+ * GCC vector extensions, which compile to SSE2 by default
+ * and AVX2 when built with -mavx2.
+ */
+
+#define CHACHA_KEY_SIZE 32
+#define CHACHA_NONCE_SIZE 12
+#define CHACHA_BLOCK_SIZE 64
+#define CHACHA_LANES 8
+#define CHACHA_BATCH_SIZE (CHACHA_BLOCK_SIZE * CHACHA_LANES)
+
+typedef struct _ChaCha20
+{
+    uint32_t state[16];                         // constants, key, counter, nonce
+    unsigned char stream[CHACHA_BATCH_SIZE];    // keystream of the current batch
+    uint used;                                  // stream bytes already consumed
+
+} ChaCha20;
+
+/* ChaCha function prototypes */
+
+/* Derive a key from --key, 64 hex digits are taken as the raw key */
+void chacha20_key_from_string(const char *pass, unsigned char *key);
+
+/* Set up key, nonce and starting block counter */
+void chacha20_init(ChaCha20 *ctx, const unsigned char *key, const unsigned char *nonce, uint32_t counter);
+
+/* XOR len bytes with the next keystream bytes (encrypt == decrypt) */
+void chacha20_xor(ChaCha20 *ctx, unsigned char *data, size_t len);
+
+/* Continue the keystream of counter at byte offset (--resume) */
+void chacha20_seek(ChaCha20 *ctx, uint32_t counter, uint64_t offset);
+
+#endif
@@ -1,7 +1,24 @@
-#ifndef COMMON_H
-#define COMMON_H
-
-/* Magic string to identify whether stegged or not */
-#define MAGIC_STRING "#*"
-
+#ifndef COMMON_H
+#define COMMON_H
+
+/* Magic string to identify whether stegged or not */
+#define MAGIC_STRING "#*"
+
+/* Size of the BMP header in front of the pixel data */
+#define BMP_HEADER_SIZE 54
+
+/* Magic string for stego images using options,
+   a 32-bit flags word follows it */
+#define MAGIC_STRING_EXT "#+"
+
+/* Flags stored after MAGIC_STRING_EXT */
+#define STEGO_FLAG_SPREAD (1 << 0)   // payload spread with a key
+#define STEGO_FLAG_CIPHER (1 << 1)   // data ChaCha20 encrypted, nonce follows flags
+#define STEGO_FLAG_ECC (1 << 2)      // payload Reed-Solomon coded, parameters follow
+#define STEGO_FLAG_SEGMENTED (1 << 3) // data in checksummed segments instead of size + data
+#define STEGO_FLAGS_KNOWN (STEGO_FLAG_SPREAD | STEGO_FLAG_CIPHER | STEGO_FLAG_ECC | STEGO_FLAG_SEGMENTED)
+
+/* Copies kept of each ECC header int, majority voted on decode */
+#define ECC_HEADER_COPIES 3
+
 #endif
\ No newline at end of file
@@ -0,0 +1,296 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cover_cache.h"
+#include "png.h"
+#include "types.h"
+
+/* Function Definitions */
+
+/* Initialize an empty cache with given byte budget */
+Status cover_cache_init(CoverCache *cache, size_t budget)
+{
+    memset(cache, 0, sizeof(*cache));
+    cache->budget = budget;
+
+    if(pthread_mutex_init(&cache->lock, NULL) != 0)
+    {
+        return e_failure;
+    }
+
+    return e_success;
+}
+
+/* Unlink an entry from the LRU list */
+static void lru_unlink(CoverCache *cache, CoverEntry *entry)
+{
+    if(entry->prev)
+        entry->prev->next = entry->next;
+    else
+        cache->head = entry->next;
+
+    if(entry->next)
+        entry->next->prev = entry->prev;
+    else
+        cache->tail = entry->prev;
+
+    entry->prev = entry->next = NULL;
+}
+
+/* Link an entry as the most recently used one */
+static void lru_push_front(CoverCache *cache, CoverEntry *entry)
+{
+    entry->prev = NULL;
+    entry->next = cache->head;
+
+    if(cache->head)
+        cache->head->prev = entry;
+    else
+        cache->tail = entry;
+
+    cache->head = entry;
+}
+
+/* Unmap and free one entry */
+static void free_entry(CoverEntry *entry)
+{
+    munmap(entry->data, entry->size);
+    free(entry->path);
+    free(entry);
+}
+
+/* Drop an entry from the cache, it must not be pinned */
+static void evict_entry(CoverCache *cache, CoverEntry *entry)
+{
+    lru_unlink(cache, entry);
+    cache->used -= entry->size;
+    cache->evictions++;
+    free_entry(entry);
+}
+
+/* Evict least recently used entries until we are within budget */
+static void enforce_budget(CoverCache *cache)
+{
+    CoverEntry *entry = cache->tail;
+
+    while(cache->used > cache->budget && entry != NULL)
+    {
+        CoverEntry *prev = entry->prev;
+
+        if(entry->refs == 0)
+        {
+            evict_entry(cache, entry);
+        }
+        entry = prev;
+    }
+}
+
+/* Map a cover file and parse its header
+ * Width is stored at offset 18 and height right
+ * after it, same as get_image_size_for_bmp()
+ */
+static CoverEntry *load_entry(const char *path, const struct stat *st)
+{
+    CoverEntry *entry;
+    int fd;
+
+    if(st->st_size < BMP_HEADER_SIZE)
+    {
+        fprintf(stderr, "ERROR: %s is too small to be a BMP image\n", path);
+        return NULL;
+    }
+
+    fd = open(path, O_RDONLY);
+    if(fd < 0)
+    {
+        perror("open");
+        fprintf(stderr, "ERROR: Unable to open file %s\n", path);
+        return NULL;
+    }
+
+    entry = calloc(1, sizeof(*entry));
+    if(entry == NULL)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    entry->data = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if(entry->data == MAP_FAILED)
+    {
+        perror("mmap");
+        free(entry);
+        return NULL;
+    }
+
+    entry->path = strdup(path);
+    entry->dev = st->st_dev;
+    entry->ino = st->st_ino;
+    entry->mtime = st->st_mtim;
+    entry->size = st->st_size;
+
+    memcpy(entry->header, entry->data, BMP_HEADER_SIZE);
+
+    if(get_image_format(path) == e_png)
+    {
+        PngInfo info;
+
+        if(png_parse_ihdr(entry->data, entry->size, &info) == e_failure)
+        {
+            free_entry(entry);
+            return NULL;
+        }
+        entry->width = info.width;
+        entry->height = info.height;
+        entry->image_capacity = info.rowbytes * info.height;
+    }
+    else
+    {
+        memcpy(&entry->width, entry->header + 18, sizeof(int));
+        memcpy(&entry->height, entry->header + 22, sizeof(int));
+        entry->image_capacity = entry->width * entry->height * 3;
+    }
+
+    return entry;
+}
+
+/* cover_cache_get() with the cache lock held
+ * An entry only hits when path, inode, mtime and size
+ * all match, a changed file replaces the stale entry.
+ */
+static CoverEntry *cache_get_locked(CoverCache *cache, const char *path)
+{
+    struct stat st;
+    CoverEntry *entry;
+
+    if(stat(path, &st) != 0)
+    {
+        perror("stat");
+        fprintf(stderr, "ERROR: Unable to open file %s\n", path);
+        return NULL;
+    }
+
+    for(entry = cache->head; entry != NULL; entry = entry->next)
+    {
+        if(strcmp(entry->path, path) == 0)
+        {
+            break;
+        }
+    }
+
+    if(entry != NULL)
+    {
+        if(entry->dev == st.st_dev && entry->ino == st.st_ino &&
+           entry->size == st.st_size &&
+           entry->mtime.tv_sec == st.st_mtim.tv_sec &&
+           entry->mtime.tv_nsec == st.st_mtim.tv_nsec)
+        {
+            cache->hits++;
+            entry->refs++;
+            lru_unlink(cache, entry);
+            lru_push_front(cache, entry);
+            return entry;
+        }
+
+        //cover changed on disk, drop the stale copy
+        if(entry->refs == 0)
+        {
+            evict_entry(cache, entry);
+        }
+        else
+        {
+            lru_unlink(cache, entry);
+            cache->used -= entry->size;
+            entry->path[0] = '\0';    //unreachable, freed on last put
+        }
+    }
+
+    cache->misses++;
+
+    entry = load_entry(path, &st);
+    if(entry == NULL)
+    {
+        return NULL;
+    }
+
+    entry->refs = 1;
+    lru_push_front(cache, entry);
+    cache->used += entry->size;
+    enforce_budget(cache);
+
+    return entry;
+}
+
+/* Get (and pin) the entry for a cover, mapping it on a miss */
+CoverEntry *cover_cache_get(CoverCache *cache, const char *path)
+{
+    CoverEntry *entry;
+
+    pthread_mutex_lock(&cache->lock);
+    entry = cache_get_locked(cache, path);
+    pthread_mutex_unlock(&cache->lock);
+
+    return entry;
+}
+
+/* Unpin an entry got from cover_cache_get() */
+void cover_cache_put(CoverCache *cache, CoverEntry *entry)
+{
+    if(entry == NULL)
+        return;
+
+    pthread_mutex_lock(&cache->lock);
+    entry->refs--;
+
+    if(entry->refs == 0)
+    {
+        if(entry->path[0] == '\0')
+        {
+            //stale entry already unlinked from the cache
+            free_entry(entry);
+        }
+        else
+        {
+            enforce_budget(cache);
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/* Open a read-only FILE stream over the cached cover bytes
+ * Encoding code keeps using fread/fseek as with a real file.
+ */
+FILE *cover_cache_open(CoverEntry *entry)
+{
+    return fmemopen(entry->data, entry->size, "r");
+}
+
+/* Print hit / miss counters */
+void cover_cache_print_stats(const CoverCache *cache, FILE *fptr)
+{
+    fprintf(fptr, "Cover cache: hits=%lu misses=%lu evictions=%lu used=%zu/%zu bytes\n",
+            cache->hits, cache->misses, cache->evictions, cache->used, cache->budget);
+}
+
+/* Unmap and free every entry */
+void cover_cache_destroy(CoverCache *cache)
+{
+    CoverEntry *entry = cache->head;
+
+    while(entry != NULL)
+    {
+        CoverEntry *next = entry->next;
+        free_entry(entry);
+        entry = next;
+    }
+
+    cache->head = cache->tail = NULL;
+    cache->used = 0;
+    pthread_mutex_destroy(&cache->lock);
+}
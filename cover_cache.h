@@ -0,0 +1,86 @@
+#ifndef COVER_CACHE_H
+#define COVER_CACHE_H
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+#include <pthread.h>
+#include "types.h" // Contains user defined types
+#include "common.h"
+
+/*
+ * Cache of cover images for batch mode.
+ * Every entry keeps the parsed BMP header, the computed
+ * capacity and a read-only mapping of the whole cover,
+ * so encoding the same cover again does no cover I/O.
+ * Entries are keyed by path + inode + mtime + size and
+ * evicted in LRU order once the byte budget is exceeded.
+ * get / put are safe to call from several threads.
+ */
+
+#define DEFAULT_COVER_CACHE_BUDGET (256UL * 1024 * 1024)
+
+typedef struct _CoverEntry
+{
+    /* Key */
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    off_t size;
+
+    /* Precomputed metadata (header is raw file bytes) */
+    unsigned char header[BMP_HEADER_SIZE];
+    uint width;
+    uint height;
+    uint image_capacity;
+
+    /* Read-only mapping of the cover file */
+    unsigned char *data;
+
+    /* Number of users, pinned entries are never evicted */
+    int refs;
+
+    /* LRU list, head is most recently used */
+    struct _CoverEntry *prev;
+    struct _CoverEntry *next;
+
+} CoverEntry;
+
+typedef struct _CoverCache
+{
+    size_t budget;      // max bytes kept mapped
+    size_t used;        // bytes currently mapped
+    CoverEntry *head;
+    CoverEntry *tail;
+
+    pthread_mutex_t lock;   // guards the list, refs and stats
+
+    /* Stats */
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+
+} CoverCache;
+
+/* Cover cache function prototypes */
+
+/* Initialize an empty cache with given byte budget */
+Status cover_cache_init(CoverCache *cache, size_t budget);
+
+/* Get (and pin) the entry for a cover, mapping it on a miss */
+CoverEntry *cover_cache_get(CoverCache *cache, const char *path);
+
+/* Unpin an entry got from cover_cache_get() */
+void cover_cache_put(CoverCache *cache, CoverEntry *entry);
+
+/* Open a read-only FILE stream over the cached cover bytes */
+FILE *cover_cache_open(CoverEntry *entry);
+
+/* Print hit / miss counters */
+void cover_cache_print_stats(const CoverCache *cache, FILE *fptr);
+
+/* Unmap and free every entry */
+void cover_cache_destroy(CoverCache *cache);
+
+#endif
@@ -0,0 +1,478 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cover_index.h"
+#include "common.h"
+#include "png.h"
+#include "types.h"
+
+/* Record being built, path kept separately until written */
+typedef struct _IndexEntry
+{
+    IndexRecord rec;
+    char *path;
+
+} IndexEntry;
+
+/* Old record found by path */
+typedef struct _IndexLookup
+{
+    const char *path;
+    const IndexRecord *rec;
+
+} IndexLookup;
+
+/* Function Definitions */
+
+/* Secret bytes a cover of image_bytes pixel bytes can take
+ * Same sum as check_capacity(): magic, extension size,
+ * extension and file size in front of the data, plus the
+ * header offset, must stay strictly below the image size.
+ */
+static uint64_t capacity_for(uint64_t image_bytes)
+{
+    uint64_t overhead = strlen(MAGIC_STRING) + 4 + 4 + sizeof(long);
+
+    if(image_bytes < BMP_HEADER_SIZE + 1 + overhead * 8)
+        return 0;
+    return (image_bytes - BMP_HEADER_SIZE - 1) / 8 - overhead;
+}
+
+/* Does the pixel data start with one of our magic strings */
+static int has_magic(const unsigned char *pixels)
+{
+    char magic[2] = {0, 0};
+
+    for(int k = 0; k < 2; k++)
+    {
+        for(int i = 0; i < 8; i++)
+        {
+            magic[k] |= (pixels[k * 8 + i] & 1) << (7 - i);
+        }
+    }
+
+    return magic[0] == MAGIC_STRING[0] && (magic[1] == MAGIC_STRING[1] || magic[1] == MAGIC_STRING_EXT[1]);
+}
+
+/* Fill rec from the header (and first 16 pixel bytes) of a cover */
+static Status read_cover_header(const char *path, IndexRecord *rec)
+{
+    unsigned char buf[BMP_HEADER_SIZE + 16];
+    FILE *fptr = fopen(path, "r");
+    Status ret = e_failure;
+
+    if(fptr == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR: Unable to open file %s\n", path);
+        return e_failure;
+    }
+
+    if(get_image_format(path) == e_png)
+    {
+        PngInfo info;
+
+        if(fread(buf, 1, 33, fptr) == 33 && png_parse_ihdr(buf, 33, &info) == e_success)
+        {
+            rec->width = info.width;
+            rec->height = info.height;
+            rec->bits_per_pixel = info.channels * 8;
+            rec->capacity = capacity_for((uint64_t)info.rowbytes * info.height);
+
+            //the first row has to be inflated to see the LSBs
+            rewind(fptr);
+            fptr = png_open_reader(fptr, &info);
+            if(fptr != NULL && fread(buf, 1, sizeof(buf), fptr) == sizeof(buf))
+            {
+                rec->flags = has_magic(buf + BMP_HEADER_SIZE) ? INDEX_STEGO : 0;
+                ret = e_success;
+            }
+        }
+    }
+    else if(fread(buf, 1, sizeof(buf), fptr) == sizeof(buf) && buf[0] == 'B' && buf[1] == 'M')
+    {
+        //width at 18, height at 22, bits per pixel at 28
+        rec->width = buf[18] | (buf[19] << 8) | (buf[20] << 16) | ((uint32_t)buf[21] << 24);
+        rec->height = buf[22] | (buf[23] << 8) | (buf[24] << 16) | ((uint32_t)buf[25] << 24);
+        rec->bits_per_pixel = buf[28] | (buf[29] << 8);
+        rec->capacity = capacity_for((uint64_t)rec->width * rec->height * 3);
+        rec->flags = has_magic(buf + BMP_HEADER_SIZE) ? INDEX_STEGO : 0;
+        ret = e_success;
+    }
+
+    if(ret == e_failure)
+    {
+        fprintf(stderr, "ERROR: Unable to read image header of %s\n", path);
+    }
+    if(fptr != NULL)
+    {
+        fclose(fptr);
+    }
+    return ret;
+}
+
+/* Map an index file read-only or read-write, NULL if missing or bad */
+static void *map_index(const char *index_fname, int writable, int *fd_out, size_t *len_out)
+{
+    struct stat st;
+    const IndexHeader *hdr;
+    void *map;
+    int fd = open(index_fname, writable ? O_RDWR : O_RDONLY);
+
+    if(fd < 0)
+    {
+        return NULL;
+    }
+
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(IndexHeader))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    map = mmap(NULL, st.st_size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    if(map == MAP_FAILED)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    hdr = map;
+    if(hdr->magic != INDEX_MAGIC || hdr->version != INDEX_VERSION ||
+       sizeof(IndexHeader) + (size_t)hdr->count * sizeof(IndexRecord) + hdr->strings != (size_t)st.st_size)
+    {
+        printf("Error: %s is not a cover index\n", index_fname);
+        munmap(map, st.st_size);
+        close(fd);
+        return NULL;
+    }
+
+    *fd_out = fd;
+    *len_out = st.st_size;
+    return map;
+}
+
+static int compare_lookup(const void *a, const void *b)
+{
+    return strcmp(((const IndexLookup *)a)->path, ((const IndexLookup *)b)->path);
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    const IndexEntry *x = a, *y = b;
+
+    if(x->rec.capacity != y->rec.capacity)
+        return x->rec.capacity < y->rec.capacity ? -1 : 1;
+    return strcmp(x->path, y->path);
+}
+
+/* Take the lock shared by updates and queries, -1 on failure */
+static int lock_index(const char *index_fname)
+{
+    char lock[PATH_MAX + sizeof(INDEX_DEFAULT_NAME) + sizeof(INDEX_LOCK_SUFFIX)];
+    int fd;
+
+    //a file of its own, the index itself is replaced by rename()
+    snprintf(lock, sizeof(lock), "%s%s", index_fname, INDEX_LOCK_SUFFIX);
+    fd = open(lock, O_RDWR | O_CREAT, 0644);
+    if(fd < 0)
+    {
+        perror("open");
+        fprintf(stderr, "ERROR: Unable to open file %s\n", lock);
+        return -1;
+    }
+
+    if(flock(fd, LOCK_EX) != 0)
+    {
+        perror("flock");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void unlock_index(int fd)
+{
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+/* Write entries sorted by capacity, through a temp file and rename
+ * The temp name is unique, so a left over or concurrent temp
+ * file is never written into.
+ */
+static Status write_index(const char *index_fname, IndexEntry *entries, uint32_t count)
+{
+    char tmp[PATH_MAX + sizeof(INDEX_DEFAULT_NAME) + sizeof(INDEX_TMP_SUFFIX)];
+    IndexHeader hdr = {INDEX_MAGIC, INDEX_VERSION, count, 0};
+    FILE *fptr = NULL;
+    int fd;
+    Status ret = e_success;
+
+    qsort(entries, count, sizeof(IndexEntry), compare_entries);
+
+    for(uint32_t i = 0; i < count; i++)
+    {
+        entries[i].rec.path = hdr.strings;
+        entries[i].rec.path_len = strlen(entries[i].path);
+        hdr.strings += entries[i].rec.path_len + 1;
+    }
+
+    snprintf(tmp, sizeof(tmp), "%s%s", index_fname, INDEX_TMP_SUFFIX);
+    fd = mkstemp(tmp);
+    if(fd >= 0 && (fchmod(fd, 0644) != 0 || (fptr = fdopen(fd, "w")) == NULL))
+    {
+        close(fd);
+        unlink(tmp);
+        fd = -1;
+    }
+    if(fd < 0)
+    {
+        perror("mkstemp");
+        fprintf(stderr, "ERROR: Unable to create a temp file for %s\n", index_fname);
+        return e_failure;
+    }
+
+    fwrite(&hdr, sizeof(hdr), 1, fptr);
+    for(uint32_t i = 0; i < count; i++)
+    {
+        fwrite(&entries[i].rec, sizeof(IndexRecord), 1, fptr);
+    }
+    for(uint32_t i = 0; i < count; i++)
+    {
+        fwrite(entries[i].path, 1, entries[i].rec.path_len + 1, fptr);
+    }
+
+    if(ferror(fptr) || fclose(fptr) != 0 || rename(tmp, index_fname) != 0)
+    {
+        perror("write");
+        unlink(tmp);
+        ret = e_failure;
+    }
+
+    return ret;
+}
+
+/* Index file to use, a directory means its INDEX_DEFAULT_NAME */
+static const char *index_path(const char *name, char *buf, size_t len)
+{
+    struct stat st;
+
+    if(stat(name, &st) == 0 && S_ISDIR(st.st_mode))
+    {
+        snprintf(buf, len, "%s/%s", name, INDEX_DEFAULT_NAME);
+        return buf;
+    }
+    return name;
+}
+
+/* Build or refresh the index of cover_dir
+ * The old index is mapped and looked up by path, a cover
+ * keeps its record (and claimed flag) while its mtime and
+ * size are unchanged. Missing covers are dropped.
+ * The index lock is held from mapping the old index until
+ * the new one is in place, queries wait for it.
+ */
+Status cover_index_update(const char *cover_dir, const char *index_fname)
+{
+    char dir_path[PATH_MAX];
+    char default_path[PATH_MAX + sizeof(INDEX_DEFAULT_NAME) + 1];
+    DIR *dir;
+    struct dirent *ent;
+    const IndexHeader *old = NULL;
+    IndexLookup *lookup = NULL;
+    IndexEntry *entries = NULL;
+    uint32_t count = 0, room = 0, kept = 0, scanned = 0, found = 0, old_count = 0;
+    size_t old_len = 0;
+    int old_fd = -1, lock_fd;
+    Status ret;
+
+    if(realpath(cover_dir, dir_path) == NULL || (dir = opendir(dir_path)) == NULL)
+    {
+        perror("opendir");
+        fprintf(stderr, "ERROR: Unable to open directory %s\n", cover_dir);
+        return e_failure;
+    }
+
+    index_fname = index_path(index_fname != NULL ? index_fname : cover_dir, default_path, sizeof(default_path));
+    lock_fd = lock_index(index_fname);
+    if(lock_fd < 0)
+    {
+        closedir(dir);
+        return e_failure;
+    }
+
+    old = map_index(index_fname, 0, &old_fd, &old_len);
+    if(old != NULL)
+    {
+        const IndexRecord *recs = (const IndexRecord *)(old + 1);
+        const char *strings = (const char *)(recs + old->count);
+
+        old_count = old->count;
+        lookup = malloc(sizeof(IndexLookup) * (old_count + 1));
+        for(uint32_t i = 0; lookup != NULL && i < old_count; i++)
+        {
+            lookup[i].path = strings + recs[i].path;
+            lookup[i].rec = &recs[i];
+        }
+        if(lookup != NULL)
+            qsort(lookup, old_count, sizeof(IndexLookup), compare_lookup);
+    }
+
+    while((ent = readdir(dir)) != NULL)
+    {
+        char path[PATH_MAX + NAME_MAX + 2];
+        size_t len = strlen(ent->d_name);
+        IndexLookup key, *hit = NULL;
+        struct stat st;
+        IndexEntry *e;
+
+        if(ent->d_name[0] == '.' || len < 5 ||
+           (strcmp(ent->d_name + len - 4, ".bmp") != 0 && strcmp(ent->d_name + len - 4, ".png") != 0))
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s", dir_path, ent->d_name);
+        if(stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+            continue;
+
+        if(count == room)
+        {
+            IndexEntry *grown = realloc(entries, sizeof(IndexEntry) * (room ? room * 2 : 64));
+            if(grown == NULL)
+                break;
+            entries = grown;
+            room = room ? room * 2 : 64;
+        }
+        e = &entries[count];
+        memset(e, 0, sizeof(*e));
+
+        key.path = path;
+        if(lookup != NULL)
+            hit = bsearch(&key, lookup, old_count, sizeof(IndexLookup), compare_lookup);
+        if(hit != NULL)
+            found++;
+
+        if(hit != NULL && hit->rec->mtime_sec == st.st_mtim.tv_sec &&
+           hit->rec->mtime_nsec == (uint32_t)st.st_mtim.tv_nsec && hit->rec->size == (uint64_t)st.st_size)
+        {
+            e->rec = *hit->rec;
+            kept++;
+        }
+        else if(read_cover_header(path, &e->rec) == e_success)
+        {
+            e->rec.mtime_sec = st.st_mtim.tv_sec;
+            e->rec.mtime_nsec = st.st_mtim.tv_nsec;
+            e->rec.size = st.st_size;
+            scanned++;
+        }
+        else
+        {
+            continue;
+        }
+
+        e->path = strdup(path);
+        if(e->path != NULL)
+            count++;
+    }
+    closedir(dir);
+
+    ret = write_index(index_fname, entries, count);
+    if(ret == e_success)
+    {
+        printf("Index: %u covers, %u read, %u unchanged, %u dropped\n",
+               count, scanned, kept, old_count - found);
+    }
+
+    for(uint32_t i = 0; i < count; i++)
+    {
+        free(entries[i].path);
+    }
+    free(entries);
+    free(lookup);
+    if(old != NULL)
+    {
+        munmap((void *)old, old_len);
+        close(old_fd);
+    }
+    unlock_index(lock_fd);
+
+    return ret;
+}
+
+/* Claim and print the smallest unused cover holding bytes
+ * Lower bound binary search on capacity, then the first
+ * record neither stegged nor claimed is marked claimed in
+ * the shared mapping. The index lock keeps concurrent queries
+ * from handing out the same cover, and keeps updates from
+ * replacing the index under the claim.
+ */
+Status cover_index_query(const char *index_fname, long bytes)
+{
+    char default_path[PATH_MAX + sizeof(INDEX_DEFAULT_NAME) + 1];
+    IndexHeader *hdr;
+    IndexRecord *recs;
+    const char *strings;
+    uint32_t lo = 0, hi;
+    size_t len;
+    int fd, lock_fd;
+    Status ret = e_failure;
+
+    index_fname = index_path(index_fname, default_path, sizeof(default_path));
+    lock_fd = lock_index(index_fname);
+    if(lock_fd < 0)
+    {
+        return e_failure;
+    }
+
+    //mapped under the lock, so it is the index an update left in place
+    hdr = map_index(index_fname, 1, &fd, &len);
+    if(hdr == NULL)
+    {
+        printf("Error: Unable to open cover index %s\n", index_fname);
+        unlock_index(lock_fd);
+        return e_failure;
+    }
+
+    recs = (IndexRecord *)(hdr + 1);
+    strings = (const char *)(recs + hdr->count);
+    hi = hdr->count;
+
+    while(lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+
+        if(recs[mid].capacity < (uint64_t)bytes)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    for(; lo < hdr->count; lo++)
+    {
+        if(!(recs[lo].flags & (INDEX_STEGO | INDEX_CLAIMED)))
+        {
+            recs[lo].flags |= INDEX_CLAIMED;
+            msync(hdr, len, MS_SYNC);
+            printf("%s\n", strings + recs[lo].path);
+            ret = e_success;
+            break;
+        }
+    }
+
+    if(ret == e_failure)
+    {
+        printf("Error: No unused cover holds %ld bytes\n", bytes);
+    }
+
+    munmap(hdr, len);
+    close(fd);
+    unlock_index(lock_fd);
+    return ret;
+}
@@ -0,0 +1,69 @@
+#ifndef COVER_INDEX_H
+#define COVER_INDEX_H
+#include <stdio.h>
+#include <stdint.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Persistent capacity index of a cover library.
+ * -i scans a cover directory with header-only reads and
+ * keeps one fixed size record per cover, sorted by
+ * capacity, in a binary index file. Covers whose mtime and
+ * size did not change keep their record, so updates only
+ * read new or changed files.
+ * -q finds the smallest unused cover with room for N secret
+ * bytes by binary search over the mapped index and claims
+ * it, so the next query hands out another cover.
+ * Updates and queries hold an flock() on <index>.lock, so a
+ * claim made during a rebuild is seen by it and not lost
+ * when the rebuilt index is renamed over the old one.
+ *
+ * File layout (host byte order):
+ *     IndexHeader, count IndexRecord, path strings
+ */
+
+#define INDEX_MAGIC 0x58444953      // "SIDX"
+#define INDEX_VERSION 1
+#define INDEX_DEFAULT_NAME ".cover_index"
+#define INDEX_LOCK_SUFFIX ".lock"
+#define INDEX_TMP_SUFFIX ".tmp.XXXXXX"
+
+/* Record flags */
+#define INDEX_STEGO (1 << 0)        // cover already carries a magic string
+#define INDEX_CLAIMED (1 << 1)      // handed out by a query
+
+typedef struct _IndexHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;         // records
+    uint32_t strings;       // bytes of path strings
+
+} IndexHeader;
+
+typedef struct _IndexRecord
+{
+    uint64_t capacity;      // max secret bytes, plain encoding
+    int64_t mtime_sec;
+    uint32_t mtime_nsec;
+    uint32_t width;
+    uint32_t height;
+    uint16_t bits_per_pixel;
+    uint16_t flags;
+    uint64_t size;          // file size
+    uint32_t path;          // offset into the path strings
+    uint32_t path_len;
+
+} IndexRecord;
+
+/* Cover index function prototypes */
+
+/* Build or refresh the index of cover_dir, index_fname NULL
+ * means INDEX_DEFAULT_NAME inside cover_dir */
+Status cover_index_update(const char *cover_dir, const char *index_fname);
+
+/* Claim and print the smallest unused cover holding bytes,
+ * index_fname may also be the cover directory */
+Status cover_index_query(const char *index_fname, long bytes);
+
+#endif
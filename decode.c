@@ -1,337 +1,896 @@
-#include <stdio.h>
-#include "decode.h"
-#include "types.h"
-#include <string.h>
-#include "common.h"
-
-/* Function Definitions */
-    char str[50];
-
-/* Read and validate decode args from argv */
-/*This function reads the commandline inputs given by the user while decoding.
-It checks:
-Whether the stego image (.bmp) is valid.
-Whether the output file name is provided if not it sets it to “output” by default.
-If everything is valid, decoding can continue.
-Otherwise, it returns e_failure to stop execution.*/
-Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo)
-{
-    // Check for stego image file
-    if(argv[2][0] != '.')
-    {
-        if(strstr(argv[2], ".bmp") != NULL)
-        {
-            decInfo -> dest_image_fname = argv [2];
-        }
-        else
-        {
-            return e_failure;
-        }
-    }
-    else
-    {
-        return e_failure;
-    }
-
-    //check for output file 
-    if(argv[3] == NULL)
-    {
-        decInfo -> output_fname = "output";
-    }
-    else
-    {
-        decInfo -> output_fname = argv[3];
-    }
-
-    return e_success;//all arguments are valid
-}
-
-/* Get File pointers for i/p and o/p files */
-/*This function opens the encoded image (stego image) that
- contains your hidden secret file.
-It tries to open the file in read mode "r".
-If it opens successfully, decoding can continue.
-If not, it prints an error and returns failure, 
-stopping the process before anything breaks.*/
-Status open_files_for_decoding(DecodeInfo *decInfo)
-{
-    decInfo -> fptr_dest_image = fopen(decInfo -> dest_image_fname, "r");
-
-    // Do Error handling
-    if (decInfo -> fptr_dest_image == NULL)
-    {
-    	perror("fopen");
-    	fprintf(stderr, "ERROR: Unable to open file %s\n", decInfo -> dest_image_fname);
-
-    	return e_failure;
-    }
-
-    return e_success;
-}
-
-/* Skip bmp image header */
-/*Every BMP image starts with a 54-byte header that stores only
- information about the image (like width, height, etc.).
-Your secret data starts after this header, in the actual 
-pixel data area.This function simply skips those 
-first 54 bytes, so decoding starts from the correct spot*/
-Status skip_bmp_header(FILE *fptr_dest_image)
-{
-    if(fseek(fptr_dest_image, 54, SEEK_SET) != 0)
-    {
-        printf("Error: Failed to skip BMP header\n");
-        return e_failure;
-    }
-    return e_success;// Successfully skipped BMP header
-}
-
-/* Decode byte from LSB*/
-/*This function reads 8 bytes from the image
-takes the last bit (LSB) from each one
-and combines them to rebuild the original secret byte
-Basically, it does what encode_byte_to_lsb() did during encoding*/
-Status decode_byte_from_lsb(char *data, char *image_buffer)  
-{
-    char decoded_byte = 0;
-    char bit_data;
-
-    for(int i = 7; i >= 0; i--)
-    {
-        bit_data = image_buffer[7 - i] & 1;  // Get the LSB
-        decoded_byte = decoded_byte | (bit_data << i);
-    }
-
-    *data = decoded_byte;   
-    return e_success; 
-}
-
-/* Decode int from LSB*/
-/*Extracts a 32-bit integer (4 bytes) of hidden data
- from 32 bytes of image data using the Least 
- Significant Bit (LSB) method.*/
-Status decode_int_from_lsb(int *size, char *image_buffer)  
-{
-    int decoded_size = 0;
-    char bit_data;
-
-    for(int i = 31; i >= 0; i--)
-    {
-        bit_data = image_buffer[31 - i] & 1;    // Get the LSB
-        decoded_size = decoded_size | (bit_data << i);
-    }
-
-    *size = decoded_size;  
-    return e_success; 
-}
-
-/* Store Magic String */
-/*This function checks if the image is encoded or not
-It reads back the hidden characters magic string that the encoder stored first
-and compares them with the original magic string (#*)
-If everything matches decoding continues
-If it doesn’t match it stops meaning the image has no valid hidden data.*/
-Status decode_magic_string(const char *magic_string, DecodeInfo *decInfo)
-{
-    char arr[8];
-    char decoded_char;
-
-    //Run the loop strlen(magic_string) times
-    for(int i = 0; i < strlen(magic_string); i++)
-    {
-        //Read the 8byte of data from src file
-        fread(arr, 1, 8, decInfo -> fptr_dest_image);
-
-        /* Decode a byte from LSB of image data */
-        if((decode_byte_from_lsb(&decoded_char, arr)) == e_success)  
-        {
-            //Verify the decoded character matches magic string
-            if(decoded_char == magic_string[i])
-            {
-                continue;
-            }
-            else
-            {
-                return e_failure;
-            }
-        }
-        else
-        {
-            return e_failure;
-        }
-    }
-    return e_success;
-}
-
-/* Decode secret file extension size */
-/*Decodes the size number of characters of the secret
- file extension (ex "shreedhar.txt" = 4) from the stego image.*/
-Status decode_secret_file_extn_size(int *size, DecodeInfo *decInfo)  
-{
-    char arr[32];
-
-    fread(arr, 1, 32, decInfo->fptr_dest_image);
-
-    if((decode_int_from_lsb(size, arr)) == e_success)  
-    {
-        return e_success;
-    } 
-    return e_failure;//`Error in decoding file extension size 
-}
-
-/* Decode secret file extension */
-/*This function reads and rebuilds the hidden file extension (like .txt or .c)
-and then adds it to the output file name so that the 
-recovered file gets saved with the correct format.
-For example:
-Hidden extension = .txt
-Output file base = output
- Final output = output.txt*/
-Status decode_secret_file_extn(char *file_extn, DecodeInfo *decInfo)
-{
-    char arr[8];
-    char decoded_char;
-
-    for(int i = 0; i < MAX_FILE_SUFFIX_DECODE; i++)
-    {
-        fread(arr, 1, 8, decInfo->fptr_dest_image);
-
-        if((decode_byte_from_lsb(&decoded_char, arr)) == e_success) 
-        {
-            file_extn[i] = decoded_char;//store decoded character in file_extn
-            
-            if(decoded_char == '\0')//null character
-                break;
-        }
-        else
-        {
-            return e_failure;//Error in decoding file extension
-        }
-    }
-    
-    int i=0;
-    while(decInfo -> output_fname[i])//loop until null character
-    {
-        if(decInfo -> output_fname[i] != '.')//until we reach the null character 
-        {
-            str[i] = decInfo -> output_fname[i];//copy output file name to str
-        }
-        else
-        {
-            break;
-        }
-        i++;
-    }
-
-    str[i] = '\0';//null terminate the string 
-
-    strcat(str, file_extn);//concatenate the file extension 
-    printf("--%s\n",str);//
-    decInfo -> output_fname = str;//update output file name with extension
-    printf("--%s\n",decInfo -> output_fname);
-    return e_success;//`Successfully decoded file extension 
-}
-
-/* Decode secret file size */
-/*This function extracts the hidden file size that the encoder stored inside the image
-It tells how big the secret file is for example, 200 bytes
-so that the decoder knows exactly how many bytes of secret data to extract next.*/
-Status decode_secret_file_size(long *file_size, DecodeInfo *decInfo)
-{
-    char arr[32];
-    int size;
-
-    fread(arr, 1, 32, decInfo->fptr_dest_image);
-
-    if((decode_int_from_lsb(&size, arr)) == e_success) 
-    {
-        *file_size = (long)size;
-        return e_success;// Successfully decoded file size 
-    }
-    return e_failure;//`Error in decoding file size 
-}
-
-/* Decode secret file data*/
-Status decode_secret_file_data(DecodeInfo *decInfo)
-{
-    char arr[8];
-    char decoded_char;
-
-    // Open output file for writing
-    /*This function extracts the hidden file data from the image,
-    one byte at a time, and writes it to your output file*/
-    decInfo->fptr_output = fopen(decInfo->output_fname, "w");
-    if(decInfo->fptr_output == NULL)
-    {
-        return e_failure;//Error in opening output file
-    }
-
-    for(int i = 0; i < decInfo->size_output_file; i++)
-    {
-        fread(arr, 1, 8, decInfo->fptr_dest_image);
-
-        if((decode_byte_from_lsb(&decoded_char, arr)) == e_success)  
-        {
-            fwrite(&decoded_char, 1, 1, decInfo->fptr_output);
-        }
-        else
-        {
-            fclose(decInfo->fptr_output);
-            return e_failure;//Error in decoding
-        }
-    }
-    
-    fclose(decInfo->fptr_output);
-    return e_success; //All bytes decoded successfully
-}
-
-/* Perform the complete decoding process */
-Status do_decoding(DecodeInfo *decInfo)
-{
-    int extn_size;  
-
-    /* Get File pointers for i/p files */
-    if((open_files_for_decoding(decInfo)) == e_success)
-    {
-        printf("Data image file opened successfully...\n");
-
-        /* Skip bmp image header */
-        if((skip_bmp_header(decInfo -> fptr_dest_image)) == e_success)
-        {
-            //printf("BMP header skipped\n");
-
-            /* Decode Magic String */
-            if((decode_magic_string(MAGIC_STRING, decInfo)) == e_success)
-            {
-                printf("Magic string recieved...\n");
-
-                /* Decode secret file extension size */
-                if((decode_secret_file_extn_size(&extn_size, decInfo)) == e_success)  
-                {
-                    printf("size of file extension decoded: %d\n", extn_size);
-
-                    /* Decode secret file extension */
-                    if((decode_secret_file_extn(decInfo->extn_output_file, decInfo)) == e_success)
-                    {
-                        //printf("Secret file extension decoded: %s\n", decInfo->extn_output_file);
-
-                        /* Decode secret file size */
-                        if((decode_secret_file_size(&decInfo->size_output_file, decInfo)) == e_success)
-                        {
-                            printf("File size decoded: %ld\n", decInfo->size_output_file);
-                                
-                            /* Decode secret file data */
-                            if((decode_secret_file_data(decInfo)) == e_success)
-                            {
-                                printf("Secret file data decoded successfully...\n");
-
-                                return e_success;//All steps successful
-                            }
-                        }
-                    }
-                }
-            }
-        }
-    }
-
-    return e_failure;//If any of the steps fail
-}
\ No newline at end of file
+#include <stdio.h>
+#include "decode.h"
+#include "types.h"
+#include <string.h>
+#include "common.h"
+#include "spread.h"
+#include "chacha.h"
+#include "png.h"
+#include "ecc.h"
+#include "y4m.h"
+#include "stream_decode.h"
+#include "tune.h"
+#include "segment.h"
+#include <unistd.h>
+#include <stdlib.h>
+
+/* Function Definitions */
+
+/* Read and validate decode args from argv */
+/*This function reads the commandline inputs given by the user while decoding.
+It checks:
+Whether the stego image (.bmp) is valid.
+Whether the output file name is provided if not it sets it to “output” by default.
+If everything is valid, decoding can continue.
+Otherwise, it returns e_failure to stop execution.*/
+Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo)
+{
+    // Check for stego image file
+    if(argv[2][0] != '.')
+    {
+        if(strstr(argv[2], ".bmp") != NULL || strstr(argv[2], ".png") != NULL || strstr(argv[2], ".y4m") != NULL ||
+           strcmp(argv[2], "-") == 0)   //- decodes BMP data from stdin as it arrives
+        {
+            decInfo -> dest_image_fname = argv [2];
+            decInfo -> image_format = get_image_format(argv[2]);
+        }
+        else
+        {
+            return e_failure;
+        }
+    }
+    else
+    {
+        return e_failure;
+    }
+
+    //check for output file 
+    if(argv[3] == NULL)
+    {
+        decInfo -> output_fname = "output";
+    }
+    else
+    {
+        decInfo -> output_fname = argv[3];
+    }
+
+    return e_success;//all arguments are valid
+}
+
+/* Get File pointers for i/p and o/p files */
+/*This function opens the encoded image (stego image) that
+ contains your hidden secret file.
+It tries to open the file in read mode "r".
+If it opens successfully, decoding can continue.
+If not, it prints an error and returns failure, 
+stopping the process before anything breaks.*/
+Status open_files_for_decoding(DecodeInfo *decInfo)
+{
+    decInfo -> fptr_dest_image = fopen(decInfo -> dest_image_fname, "r");
+
+    // Do Error handling
+    if (decInfo -> fptr_dest_image == NULL)
+    {
+    	perror("fopen");
+    	fprintf(stderr, "ERROR: Unable to open file %s\n", decInfo -> dest_image_fname);
+
+    	return e_failure;
+    }
+
+    // PNG stego image, read through an inflating stream
+    if (decInfo -> image_format == e_png)
+    {
+        PngInfo png_info;
+
+        decInfo -> fptr_dest_image = png_open_reader(decInfo -> fptr_dest_image, &png_info);
+        if (decInfo -> fptr_dest_image == NULL)
+        {
+            fprintf(stderr, "ERROR: Unable to read PNG image %s\n", decInfo -> dest_image_fname);
+            return e_failure;
+        }
+        decInfo -> image_bytes = (long)png_info.rowbytes * png_info.height;
+    }
+    else
+    {
+        fseek(decInfo -> fptr_dest_image, 0, SEEK_END);
+        decInfo -> image_bytes = ftell(decInfo -> fptr_dest_image) - BMP_HEADER_SIZE;
+        rewind(decInfo -> fptr_dest_image);
+    }
+
+    return e_success;
+}
+
+/* Open the output file, unless the caller set up a stream */
+/*In-memory decoding (stego_async.hpp) hands in its own
+  fptr_output before decoding starts*/
+FILE *open_decode_output(DecodeInfo *decInfo)
+{
+    if(decInfo->fptr_output != NULL)
+    {
+        return decInfo->fptr_output;
+    }
+    return fopen(decInfo->output_fname, "w");
+}
+
+/* Skip bmp image header */
+/*Every BMP image starts with a 54-byte header that stores only
+ information about the image (like width, height, etc.).
+Your secret data starts after this header, in the actual 
+pixel data area.This function simply skips those 
+first 54 bytes, so decoding starts from the correct spot*/
+Status skip_bmp_header(FILE *fptr_dest_image)
+{
+    if(fseek(fptr_dest_image, 54, SEEK_SET) != 0)
+    {
+        printf("Error: Failed to skip BMP header\n");
+        return e_failure;
+    }
+    return e_success;// Successfully skipped BMP header
+}
+
+/* Decode byte from LSB*/
+/*This function reads 8 bytes from the image
+takes the last bit (LSB) from each one
+and combines them to rebuild the original secret byte
+Basically, it does what encode_byte_to_lsb() did during encoding*/
+Status decode_byte_from_lsb(char *data, char *image_buffer)  
+{
+    char decoded_byte = 0;
+    char bit_data;
+
+    for(int i = 7; i >= 0; i--)
+    {
+        bit_data = image_buffer[7 - i] & 1;  // Get the LSB
+        decoded_byte = decoded_byte | (bit_data << i);
+    }
+
+    *data = decoded_byte;   
+    return e_success; 
+}
+
+/* Decode int from LSB*/
+/*Extracts a 32-bit integer (4 bytes) of hidden data
+ from 32 bytes of image data using the Least 
+ Significant Bit (LSB) method.*/
+Status decode_int_from_lsb(int *size, char *image_buffer)  
+{
+    int decoded_size = 0;
+    char bit_data;
+
+    for(int i = 31; i >= 0; i--)
+    {
+        bit_data = image_buffer[31 - i] & 1;    // Get the LSB
+        decoded_size = decoded_size | (bit_data << i);
+    }
+
+    *size = decoded_size;  
+    return e_success; 
+}
+
+/* Store Magic String */
+/*This function checks if the image is encoded or not
+It reads back the hidden characters magic string that the encoder stored first
+and compares them with the original magic string (#*)
+If everything matches decoding continues
+If it doesn’t match it stops meaning the image has no valid hidden data.*/
+Status decode_magic_string(const char *magic_string, DecodeInfo *decInfo)
+{
+    char arr[8];
+    char decoded_char;
+
+    //Run the loop strlen(magic_string) times
+    for(int i = 0; i < strlen(magic_string); i++)
+    {
+        //Read the 8byte of data from src file
+        fread(arr, 1, 8, decInfo -> fptr_dest_image);
+
+        /* Decode a byte from LSB of image data */
+        if((decode_byte_from_lsb(&decoded_char, arr)) == e_success)  
+        {
+            //Verify the decoded character matches magic string
+            if(decoded_char == magic_string[i])
+            {
+                continue;
+            }
+            else
+            {
+                return e_failure;
+            }
+        }
+        else
+        {
+            return e_failure;
+        }
+    }
+    return e_success;
+}
+
+/* Decode secret file extension size */
+/*Decodes the size number of characters of the secret
+ file extension (ex "shreedhar.txt" = 4) from the stego image.*/
+Status decode_secret_file_extn_size(int *size, DecodeInfo *decInfo)  
+{
+    char arr[32];
+
+    fread(arr, 1, 32, decInfo->fptr_dest_image);
+
+    if((decode_int_from_lsb(size, arr)) == e_success)  
+    {
+        return e_success;
+    } 
+    return e_failure;//`Error in decoding file extension size 
+}
+
+/* Decode secret file extension */
+/*This function reads and rebuilds the hidden file extension (like .txt or .c)
+and then adds it to the output file name so that the 
+recovered file gets saved with the correct format.
+For example:
+Hidden extension = .txt
+Output file base = output
+ Final output = output.txt*/
+Status decode_secret_file_extn(char *file_extn, DecodeInfo *decInfo)
+{
+    char arr[8];
+    char decoded_char;
+
+    for(int i = 0; i < MAX_FILE_SUFFIX_DECODE; i++)
+    {
+        fread(arr, 1, 8, decInfo->fptr_dest_image);
+
+        if((decode_byte_from_lsb(&decoded_char, arr)) == e_success) 
+        {
+            file_extn[i] = decoded_char;//store decoded character in file_extn
+            
+            if(decoded_char == '\0')//null character
+                break;
+        }
+        else
+        {
+            return e_failure;//Error in decoding file extension
+        }
+    }
+
+    return set_output_fname(file_extn, decInfo);
+}
+
+/* Add the decoded extension to the output name */
+/*Any extension the user gave is dropped, e.g.
+  output.bmp + .txt = output.txt. Fails if the name does
+  not fit output_name.*/
+Status set_output_fname(const char *file_extn, DecodeInfo *decInfo)
+{
+    int stem = strcspn(decInfo -> output_fname, ".");//name up to the first '.'
+    int len = snprintf(decInfo -> output_name, sizeof(decInfo -> output_name), "%.*s%s",
+                       stem, decInfo -> output_fname, file_extn);
+
+    if(len < 0 || (size_t)len >= sizeof(decInfo -> output_name))
+    {
+        printf("Error: Output name %.*s%s is too long\n", stem, decInfo -> output_fname, file_extn);
+        return e_failure;
+    }
+
+    decInfo -> output_fname = decInfo -> output_name;//update output file name with extension
+    return e_success;
+}
+
+/* Decode secret file size */
+/*This function extracts the hidden file size that the encoder stored inside the image
+It tells how big the secret file is for example, 200 bytes
+so that the decoder knows exactly how many bytes of secret data to extract next.*/
+Status decode_secret_file_size(long *file_size, DecodeInfo *decInfo)
+{
+    char arr[32];
+    int size;
+
+    fread(arr, 1, 32, decInfo->fptr_dest_image);
+
+    if((decode_int_from_lsb(&size, arr)) == e_success) 
+    {
+        *file_size = (long)size;
+        return e_success;// Successfully decoded file size 
+    }
+    return e_failure;//`Error in decoding file size 
+}
+
+/* Decode secret file data*/
+Status decode_secret_file_data(DecodeInfo *decInfo)
+{
+    char arr[8];
+    char decoded_char;
+    Journal *journal = NULL;
+    long start = 0;
+
+    // Open output file for writing
+    /*This function extracts the hidden file data from the image,
+    one byte at a time, and writes it to your output file*/
+    if(decInfo->opts.resume)
+    {
+        journal = open_journaled_output(decInfo, &start);
+        if(journal == NULL)
+        {
+            return e_failure;
+        }
+    }
+    else
+    {
+        decInfo->fptr_output = open_decode_output(decInfo);
+    }
+    if(decInfo->fptr_output == NULL)
+    {
+        return e_failure;//Error in opening output file
+    }
+
+    for(long i = start; i < decInfo->size_output_file; i++)
+    {
+        fread(arr, 1, 8, decInfo->fptr_dest_image);
+
+        if((decode_byte_from_lsb(&decoded_char, arr)) == e_success)  
+        {
+            //Decrypt on the way out (--key)
+            if(decInfo->stego_flags & STEGO_FLAG_CIPHER)
+            {
+                chacha20_xor(&decInfo->cipher, (unsigned char *)&decoded_char, 1);
+            }
+            fwrite(&decoded_char, 1, 1, decInfo->fptr_output);
+        }
+        else
+        {
+            fclose(decInfo->fptr_output);
+            if(journal != NULL)
+                journal_close(journal);
+            return e_failure;//Error in decoding
+        }
+    }
+    
+    if(journal != NULL)
+    {
+        //the part file only becomes the output once it is complete
+        journal->complete = fclose(decInfo->fptr_output) == 0;
+        return journal->complete && journal_close(journal) == e_success ? e_success : e_failure;
+    }
+    fclose(decInfo->fptr_output);
+    return e_success; //All bytes decoded successfully
+}
+
+/* Open the output through a --resume journal */
+/*Output byte i comes from the 8 image bytes at the data
+  start + 8 * i, so a checkpoint at any output offset can be
+  picked up by skipping those image bytes and that much
+  keystream. *start is set to the first byte still to do*/
+Journal *open_journaled_output(DecodeInfo *decInfo, long *start)
+{
+    Journal *journal = malloc(sizeof(Journal));
+    JournalRecord identity;
+
+    *start = 0;
+    if(journal == NULL ||
+       journal_identity(&identity, decInfo->dest_image_fname, NULL, decInfo->stego_flags) == e_failure ||
+       journal_open(journal, decInfo->output_fname, &identity) == e_failure)
+    {
+        free(journal);
+        return NULL;
+    }
+
+    decInfo->fptr_output = journal_open_stream(journal);
+    if(decInfo->fptr_output == NULL)
+    {
+        journal_close(journal);
+        return NULL;
+    }
+    journal_set_origin(journal, 0, 1);
+
+    if(journal->resuming && (long)journal->rec.offset <= decInfo->size_output_file)
+    {
+        *start = journal->rec.offset;
+        if(journal_resume(journal, decInfo->fptr_output) == e_failure ||
+           skip_image_bytes(decInfo->fptr_dest_image, *start * 8) == e_failure)
+        {
+            printf("Error: Unable to resume at byte %ld\n", *start);
+            fclose(decInfo->fptr_output);
+            journal_close(journal);
+            return NULL;
+        }
+        if(decInfo->stego_flags & STEGO_FLAG_CIPHER)
+        {
+            chacha20_seek(&decInfo->cipher, 1, *start);
+        }
+    }
+
+    return journal;
+}
+
+/* Move forward over n image bytes */
+/*Streams that cannot seek (the spread reader) are read through*/
+Status skip_image_bytes(FILE *fptr, long n)
+{
+    size_t block = tune_block_size();
+    char *buf;
+    Status ret = e_success;
+
+    if(fseek(fptr, n, SEEK_CUR) == 0)
+    {
+        return e_success;
+    }
+
+    if((buf = malloc(block)) == NULL)
+    {
+        return e_failure;
+    }
+    while(n > 0)
+    {
+        size_t want = n < (long)block ? (size_t)n : block;
+
+        if(fread(buf, 1, want, fptr) != want)
+        {
+            ret = e_failure;
+            break;
+        }
+        n -= want;
+    }
+    free(buf);
+    return ret;
+}
+
+/* Decode header flags (extended format only) */
+/*Reads back the 32-bit flags word stored after MAGIC_STRING_EXT*/
+Status decode_stego_flags(uint *flags, DecodeInfo *decInfo)
+{
+    char arr[32];
+    int value;
+
+    fread(arr, 1, 32, decInfo->fptr_dest_image);
+
+    if((decode_int_from_lsb(&value, arr)) == e_success)
+    {
+        *flags = (uint)value;
+        return e_success;
+    }
+    return e_failure;
+}
+
+/* Decode flags word and the fields the flags ask for */
+/*Mirrors encode_stego_header(), unknown flags are refused
+  since their fields cannot be skipped*/
+Status decode_stego_header(DecodeInfo *decInfo)
+{
+    if((decode_stego_flags(&decInfo->stego_flags, decInfo)) == e_failure)
+    {
+        return e_failure;
+    }
+
+    if(decInfo->stego_flags & ~STEGO_FLAGS_KNOWN)
+    {
+        printf("Error: Unsupported stego flags 0x%x\n", decInfo->stego_flags);
+        return e_failure;
+    }
+
+    if(decInfo->stego_flags & STEGO_FLAG_CIPHER)
+    {
+        if((decode_cipher_header(decInfo)) == e_failure)
+        {
+            return e_failure;
+        }
+    }
+
+    if(decInfo->stego_flags & STEGO_FLAG_ECC)
+    {
+        return decode_ecc_header(decInfo);
+    }
+
+    return e_success;
+}
+
+/* Decode nonce, check the key and set up the cipher */
+/*Reads the nonce and key check written by encode_cipher_header()
+  and compares the check with our own first keystream word*/
+Status decode_cipher_header(DecodeInfo *decInfo)
+{
+    unsigned char key[CHACHA_KEY_SIZE];
+    unsigned char nonce[CHACHA_NONCE_SIZE];
+    unsigned char check[4], expect[4] = {0};
+    char arr[32];
+    int word;
+
+    if(decInfo->opts.key == NULL)
+    {
+        printf("Error: Data is encrypted, use --key KEY\n");
+        return e_failure;
+    }
+
+    for(int i = 0; i < CHACHA_NONCE_SIZE + 4; i += 4)
+    {
+        unsigned char *p = i < CHACHA_NONCE_SIZE ? nonce + i : check;
+
+        fread(arr, 1, 32, decInfo->fptr_dest_image);
+        decode_int_from_lsb(&word, arr);
+
+        p[0] = word;
+        p[1] = word >> 8;
+        p[2] = word >> 16;
+        p[3] = word >> 24;
+    }
+
+    chacha20_key_from_string(decInfo->opts.key, key);
+    chacha20_init(&decInfo->cipher, key, nonce, 0);
+    chacha20_xor(&decInfo->cipher, expect, sizeof(expect));
+
+    if(memcmp(check, expect, sizeof(check)) != 0)
+    {
+        printf("Error: Wrong key\n");
+        memset(key, 0, sizeof(key));
+        return e_failure;
+    }
+
+    chacha20_init(&decInfo->cipher, key, nonce, 1);
+    memset(key, 0, sizeof(key));
+
+    return e_success;
+}
+
+/* Decode ECC parameters */
+/*Reads the ECC_HEADER_COPIES copies of parity count and
+  payload length and keeps the bitwise majority of each*/
+Status decode_ecc_header(DecodeInfo *decInfo)
+{
+    int value[ECC_HEADER_COPIES];
+    int fields[2];
+    char arr[32];
+
+    for(int f = 0; f < 2; f++)
+    {
+        for(int i = 0; i < ECC_HEADER_COPIES; i++)
+        {
+            fread(arr, 1, 32, decInfo->fptr_dest_image);
+            decode_int_from_lsb(&value[i], arr);
+        }
+        fields[f] = (value[0] & value[1]) | (value[0] & value[2]) | (value[1] & value[2]);
+    }
+
+    decInfo->ecc_parity = fields[0];
+    decInfo->ecc_length = fields[1];
+
+    if(decInfo->ecc_parity < ECC_MIN_PARITY || decInfo->ecc_parity > ECC_MAX_PARITY ||
+       decInfo->ecc_length < (long)(sizeof(int) + MAX_FILE_SUFFIX_DECODE + sizeof(int)))
+    {
+        printf("Error: Bad ECC header\n");
+        return e_failure;
+    }
+
+    return e_success;
+}
+
+/* Decode and correct a Reed-Solomon coded payload */
+/*Mirrors encode_ecc_payload(), the coded block is read in
+  full, corrected by ecc_decode() and then split back into
+  extension size, extension, file size and data*/
+Status decode_ecc_payload(DecodeInfo *decInfo)
+{
+    long coded_len = ecc_encoded_size(decInfo->ecc_length, decInfo->ecc_parity);
+    long limit = decInfo->payload_capacity ? decInfo->payload_capacity : decInfo->image_bytes / 8;
+    unsigned char *coded;
+    unsigned char *p;
+    char extn[MAX_FILE_SUFFIX_DECODE + 1] = {0};
+    char arr[8 * 512];
+    long fixed;
+    Status ret = e_failure;
+
+    if(coded_len > limit)
+    {
+        printf("Error: ECC block does not fit the image\n");
+        return e_failure;
+    }
+
+    coded = malloc(coded_len);
+    if(coded == NULL)
+    {
+        printf("Error: Out of memory for ECC payload\n");
+        return e_failure;
+    }
+
+    //read back the coded block, 512 bytes per image read
+    for(long i = 0; i < coded_len; i += 512)
+    {
+        long n = coded_len - i < 512 ? coded_len - i : 512;
+
+        if(fread(arr, 1, n * 8, decInfo->fptr_dest_image) != (size_t)(n * 8))
+        {
+            free(coded);
+            return e_failure;
+        }
+        for(long j = 0; j < n; j++)
+        {
+            decode_byte_from_lsb((char *)&coded[i + j], arr + j * 8);
+        }
+    }
+
+    fixed = ecc_decode(coded, decInfo->ecc_length, decInfo->ecc_parity);
+    if(fixed < 0)
+    {
+        printf("Error: Too many errors to correct\n");
+        free(coded);
+        return e_failure;
+    }
+    printf("ECC corrected %ld bytes\n", fixed);
+
+    p = coded;
+    decInfo->size_output_file = ((long)p[8] << 24) | (p[9] << 16) | (p[10] << 8) | p[11];
+    memcpy(decInfo->extn_output_file, p + 4, MAX_FILE_SUFFIX_DECODE);
+    memcpy(extn, p + 4, MAX_FILE_SUFFIX_DECODE);
+    printf("File size decoded: %ld\n", decInfo->size_output_file);
+
+    if(decInfo->size_output_file != decInfo->ecc_length - 12)
+    {
+        printf("Error: Decoded size does not match the ECC header\n");
+    }
+    else if(set_output_fname(extn, decInfo) == e_success)
+    {
+        if(decInfo->stego_flags & STEGO_FLAG_CIPHER)
+        {
+            chacha20_xor(&decInfo->cipher, p + 12, decInfo->size_output_file);
+        }
+
+        decInfo->fptr_output = open_decode_output(decInfo);
+        if(decInfo->fptr_output != NULL)
+        {
+            if(fwrite(p + 12, 1, decInfo->size_output_file, decInfo->fptr_output) == (size_t)decInfo->size_output_file)
+            {
+                printf("Secret file data decoded successfully...\n");
+                ret = e_success;
+            }
+            fclose(decInfo->fptr_output);
+        }
+    }
+
+    free(coded);
+    return ret;
+}
+
+/* Decode extension, size and data of the secret file */
+/*Everything after the magic string (and flags) is read
+  through here, whatever stream decInfo points at*/
+Status decode_secret_payload(DecodeInfo *decInfo)
+{
+    int extn_size;  
+
+    if(decInfo->stego_flags & STEGO_FLAG_ECC)
+    {
+        return decode_ecc_payload(decInfo);
+    }
+
+    /* Decode secret file extension size */
+    if((decode_secret_file_extn_size(&extn_size, decInfo)) == e_success)  
+    {
+        printf("size of file extension decoded: %d\n", extn_size);
+
+        /* Decode secret file extension */
+        if((decode_secret_file_extn(decInfo->extn_output_file, decInfo)) == e_success)
+        {
+            //printf("Secret file extension decoded: %s\n", decInfo->extn_output_file);
+
+            //fixed size segments instead of the size field, see segment.h
+            if(decInfo->stego_flags & STEGO_FLAG_SEGMENTED)
+            {
+                if((decode_segmented_data(decInfo)) == e_success)
+                {
+                    printf("Secret file data decoded successfully...\n");
+                    return e_success;
+                }
+                return e_failure;
+            }
+
+            /* Decode secret file size */
+            if((decode_secret_file_size(&decInfo->size_output_file, decInfo)) == e_success)
+            {
+                printf("File size decoded: %ld\n", decInfo->size_output_file);
+
+                //a wrong key decodes a garbage size
+                if(decInfo->payload_capacity != 0 &&
+                   (decInfo->size_output_file < 0 || decInfo->size_output_file > decInfo->payload_capacity))
+                {
+                    printf("Error: Decoded size does not fit the image, wrong key?\n");
+                    return e_failure;
+                }
+                    
+                /* Decode secret file data */
+                if((decode_secret_file_data(decInfo)) == e_success)
+                {
+                    printf("Secret file data decoded successfully...\n");
+                    return e_success;
+                }
+            }
+        }
+    }
+    return e_failure;
+}
+
+/* Decode a payload spread over the image with the spread key */
+/*Mirrors encode_spread_payload(), the stego image is read
+  through a spread reader so the normal field decoders
+  see the payload bytes back in order.*/
+Status decode_spread_payload(DecodeInfo *decInfo)
+{
+    SpreadMap map;
+    FILE *fptr_stego = decInfo->fptr_dest_image;
+    long region_start = ftell(fptr_stego);
+    long region_bytes;
+    Status ret;
+
+    if(decInfo->opts.spread_key == NULL)
+    {
+        printf("Error: Image is spread, use --spread KEY\n");
+        return e_failure;
+    }
+
+    //spreading seeks around the image, PNG streams only go forward
+    if(decInfo->image_format == e_png)
+    {
+        printf("Error: --spread needs a BMP image\n");
+        return e_failure;
+    }
+
+    fseek(fptr_stego, 0, SEEK_END);
+    region_bytes = ftell(fptr_stego) - region_start;
+
+    if(spread_map_init(&map, spread_key_from_string(decInfo->opts.spread_key), region_start, region_bytes) == e_failure)
+    {
+        return e_failure;
+    }
+
+    decInfo->payload_capacity = spread_capacity(&map) / 8;
+    decInfo->fptr_dest_image = spread_open_reader(fptr_stego, &map);
+    if(decInfo->fptr_dest_image == NULL)
+    {
+        decInfo->fptr_dest_image = fptr_stego;
+        return e_failure;
+    }
+
+    ret = decode_secret_payload(decInfo);
+
+    fclose(decInfo->fptr_dest_image);
+    decInfo->fptr_dest_image = fptr_stego;
+
+    return ret;
+}
+
+/* Output side of the stream decoder */
+/*Opens the output once the extension is known, then
+  writes the secret bytes as they are decoded*/
+static Status write_stream_output(void *ctx, const StegoDecoder *dec, const unsigned char *data, size_t len)
+{
+    DecodeInfo *decInfo = ctx;
+
+    if(data == NULL)
+    {
+        printf("File size decoded: %ld\n", dec->size);
+        if(set_output_fname(dec->extn, decInfo) == e_failure)
+            return e_failure;
+        decInfo->fptr_output = open_decode_output(decInfo);
+        if(decInfo->fptr_output == NULL)
+        {
+            perror("fopen");
+            return e_failure;
+        }
+        return e_success;
+    }
+
+    return fwrite(data, 1, len, decInfo->fptr_output) == len ? e_success : e_failure;
+}
+
+/* Decode stego data read from fd as it arrives */
+/*Chunks go straight into a StegoDecoder, so decoding ends
+  with the last payload byte, not after the whole file*/
+Status do_stream_decoding(DecodeInfo *decInfo, int fd)
+{
+    StegoDecoder *dec = malloc(sizeof(*dec));
+    size_t block = tune_block_size();
+    unsigned char *buf = malloc(block);
+    ssize_t n = 1;
+    Status ret = e_success;
+
+    if(dec == NULL || buf == NULL)
+    {
+        free(dec);
+        free(buf);
+        return e_failure;
+    }
+
+    stego_decoder_init(dec, decInfo->opts.key, write_stream_output, decInfo);
+    while(ret == e_success && dec->state != e_sd_done && (n = read(fd, buf, block)) > 0)
+    {
+        ret = stego_decoder_feed(dec, buf, n);
+    }
+    if(n < 0)
+    {
+        perror("read");
+    }
+
+    if(stego_decoder_finish(dec) == e_failure)
+    {
+        ret = e_failure;
+    }
+    if(decInfo->fptr_output != NULL && fclose(decInfo->fptr_output) != 0)
+    {
+        ret = e_failure;
+    }
+    decInfo->fptr_output = NULL;
+
+    free(buf);
+    free(dec);
+    return ret;
+}
+
+/* Decode from the already open stego image stream */
+/*decInfo->fptr_dest_image is positioned anywhere, the output is
+  opened by name unless the caller already set fptr_output
+  (in-memory decoding)*/
+Status decode_streams(DecodeInfo *decInfo)
+{
+    //video slices carry their own header, see y4m.h
+    if(decInfo -> image_format == e_y4m)
+    {
+        return y4m_decode(decInfo);
+    }
+
+    /* Skip bmp image header */
+    if((skip_bmp_header(decInfo -> fptr_dest_image)) == e_success)
+    {
+        //printf("BMP header skipped\n");
+
+        /* Decode Magic String */
+        decInfo->stego_flags = 0;
+        if((decode_magic_string(MAGIC_STRING, decInfo)) == e_success)
+        {
+            printf("Magic string recieved...\n");
+
+            /* Decode extension, size and data */
+            if((decode_secret_payload(decInfo)) == e_success)
+            {
+                return e_success;//All steps successful
+            }
+        }
+        /* Not the plain magic, try the extended one with flags */
+        else if((skip_bmp_header(decInfo -> fptr_dest_image)) == e_success &&
+                (decode_magic_string(MAGIC_STRING_EXT, decInfo)) == e_success)
+        {
+            printf("Magic string recieved...\n");
+
+            if((decode_stego_header(decInfo)) == e_success)
+            {
+                if(decInfo->stego_flags & STEGO_FLAG_SPREAD)
+                {
+                    if((decode_spread_payload(decInfo)) == e_success)
+                    {
+                        return e_success;
+                    }
+                }
+                else if((decode_secret_payload(decInfo)) == e_success)
+                {
+                    return e_success;
+                }
+            }
+        }
+    }
+
+    return e_failure;//If any of the steps fail
+}
+
+/* Perform the complete decoding process */
+Status do_decoding(DecodeInfo *decInfo)
+{
+    /* Stego data from stdin, decoded while it arrives */
+    if(strcmp(decInfo -> dest_image_fname, "-") == 0)
+    {
+        return do_stream_decoding(decInfo, STDIN_FILENO);
+    }
+
+    /* Get File pointers for i/p files */
+    if((open_files_for_decoding(decInfo)) == e_success)
+    {
+        printf("Data image file opened successfully...\n");
+
+        return decode_streams(decInfo);
+    }
+
+    return e_failure;//If any of the steps fail
+}
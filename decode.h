@@ -1,59 +1,112 @@
-#ifndef DECODE_H
-#define DECODE_H
-#include<stdio.h>
-#include "types.h" // Contains user defined types
-
-#define MAX_SECRET_BUF_SIZE 1
-#define MAX_IMAGE_BUF_SIZE (MAX_SECRET_BUF_SIZE * 8)
-#define MAX_FILE_SUFFIX_DECODE 4
-
-typedef struct _DecodeInfo
-{
-    /* Destination Image info */ 
-    char *dest_image_fname;
-    FILE *fptr_dest_image;
-
-    /* output File Info */       
-    char *output_fname;  
-    FILE *fptr_output;
-    char extn_output_file[MAX_FILE_SUFFIX_DECODE]; 
-    long size_output_file;
-
-} DecodeInfo;
-
-/* Decoding function prototype */
-
-/* Read and validate Decode args from argv */
-Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo);
-
-/* Perform the decoding */
-Status do_decoding(DecodeInfo *decInfo);
-
-/* Get File pointers for i/p and o/p files */
-Status open_files_for_decoding(DecodeInfo *decInfo);
-
-/* Skip bmp image header */
-Status skip_bmp_header(FILE *fptr_dest_image);
-
-/* Store Magic String */
-Status decode_magic_string(const char *magic_string, DecodeInfo *decInfo);
-
-/* Decode extenstion size */
-Status decode_secret_file_extn_size(int *size, DecodeInfo *decInfo); 
-
-/* Decode secret file extenstion */
-Status decode_secret_file_extn(char *file_extn, DecodeInfo *decInfo);
-
-/* Decode secret file size */
-Status decode_secret_file_size(long *file_size, DecodeInfo *decInfo);
-
-/* Decode secret file data*/
-Status decode_secret_file_data(DecodeInfo *decInfo);
-
-/* Decode int from LSB*/
-Status decode_int_from_lsb(int *size, char *image_buffer); //collecting 32 bytes of data
-
-/* Decode byte from LSB*/
-Status decode_byte_from_lsb(char *data, char *image_buffer); // collecting 8 bytes of data  
-
+#ifndef DECODE_H
+#define DECODE_H
+#include<stdio.h>
+#include "types.h" // Contains user defined types
+#include "options.h"
+#include "chacha.h"
+#include "journal.h"
+
+#define MAX_SECRET_BUF_SIZE 1
+#define MAX_IMAGE_BUF_SIZE (MAX_SECRET_BUF_SIZE * 8)
+#define MAX_FILE_SUFFIX_DECODE 4
+
+typedef struct _DecodeInfo
+{
+    /* Destination Image info */ 
+    char *dest_image_fname;
+    FILE *fptr_dest_image;
+    ImageFormat image_format;
+
+    /* output File Info */       
+    char *output_fname;  
+    FILE *fptr_output;
+    char extn_output_file[MAX_FILE_SUFFIX_DECODE]; 
+    long size_output_file;
+    char output_name[50];   // output_fname with the decoded extension
+
+    /* Optional switches and the header flags found */
+    StegoOptions opts;
+    uint stego_flags;
+    ChaCha20 cipher;    // keystream for --key
+    long payload_capacity;  // max payload bytes, 0 if unchecked
+    long image_bytes;       // pixel bytes after the header
+    int ecc_parity;         // from the ECC header fields
+    long ecc_length;        // uncoded payload bytes
+
+} DecodeInfo;
+
+/* Decoding function prototype */
+
+/* Read and validate Decode args from argv */
+Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo);
+
+/* Perform the decoding */
+Status do_decoding(DecodeInfo *decInfo);
+
+/* Decode from the already open stego image stream */
+Status decode_streams(DecodeInfo *decInfo);
+
+/* Open the output file, unless the caller set up a stream */
+FILE *open_decode_output(DecodeInfo *decInfo);
+
+/* Decode stego data read from fd as it arrives */
+Status do_stream_decoding(DecodeInfo *decInfo, int fd);
+
+/* Get File pointers for i/p and o/p files */
+Status open_files_for_decoding(DecodeInfo *decInfo);
+
+/* Skip bmp image header */
+Status skip_bmp_header(FILE *fptr_dest_image);
+
+/* Store Magic String */
+Status decode_magic_string(const char *magic_string, DecodeInfo *decInfo);
+
+/* Decode header flags (extended format only) */
+Status decode_stego_flags(uint *flags, DecodeInfo *decInfo);
+
+/* Decode flags word and the fields the flags ask for */
+Status decode_stego_header(DecodeInfo *decInfo);
+
+/* Decode nonce, check the key and set up the cipher */
+Status decode_cipher_header(DecodeInfo *decInfo);
+
+/* Decode ECC parameters */
+Status decode_ecc_header(DecodeInfo *decInfo);
+
+/* Decode extension, size and data of the secret file */
+Status decode_secret_payload(DecodeInfo *decInfo);
+
+/* Decode and correct a Reed-Solomon coded payload */
+Status decode_ecc_payload(DecodeInfo *decInfo);
+
+/* Decode a payload spread over the image with the spread key */
+Status decode_spread_payload(DecodeInfo *decInfo);
+
+/* Decode extenstion size */
+Status decode_secret_file_extn_size(int *size, DecodeInfo *decInfo); 
+
+/* Decode secret file extenstion */
+Status decode_secret_file_extn(char *file_extn, DecodeInfo *decInfo);
+
+/* Add the decoded extension to the output name */
+Status set_output_fname(const char *file_extn, DecodeInfo *decInfo);
+
+/* Decode secret file size */
+Status decode_secret_file_size(long *file_size, DecodeInfo *decInfo);
+
+/* Decode secret file data*/
+Status decode_secret_file_data(DecodeInfo *decInfo);
+
+/* Open the output through a --resume journal, *start is the first byte to do */
+Journal *open_journaled_output(DecodeInfo *decInfo, long *start);
+
+/* Move forward over n image bytes */
+Status skip_image_bytes(FILE *fptr, long n);
+
+/* Decode int from LSB*/
+Status decode_int_from_lsb(int *size, char *image_buffer); //collecting 32 bytes of data
+
+/* Decode byte from LSB*/
+Status decode_byte_from_lsb(char *data, char *image_buffer); // collecting 8 bytes of data  
+
 #endif
\ No newline at end of file
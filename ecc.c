@@ -0,0 +1,509 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "ecc.h"
+#include "types.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ECC_X86 1
+#endif
+
+/* Function Definitions */
+
+/* GF(2^8) with polynomial 0x11d and generator 2 */
+static unsigned char gf_exp[512];
+static unsigned char gf_log[256];
+
+/* Split tables, c * x = mul_lo[c][x & 15] ^ mul_hi[c][x >> 4] */
+static unsigned char mul_lo[256][16];
+static unsigned char mul_hi[256][16];
+
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+static unsigned char gf_mul(unsigned char a, unsigned char b)
+{
+    if(a == 0 || b == 0)
+        return 0;
+    return gf_exp[gf_log[a] + gf_log[b]];
+}
+
+static unsigned char gf_div(unsigned char a, unsigned char b)
+{
+    if(a == 0)
+        return 0;
+    return gf_exp[gf_log[a] + 255 - gf_log[b]];
+}
+
+static unsigned char gf_inv(unsigned char a)
+{
+    return gf_exp[255 - gf_log[a]];
+}
+
+/* alpha^power, power may be any int */
+static unsigned char gf_alpha(long power)
+{
+    return gf_exp[((power % 255) + 255) % 255];
+}
+
+/* dst ^= c * src, one byte at a time */
+static void region_mul_xor_scalar(unsigned char *dst, const unsigned char *src, unsigned char c, size_t n)
+{
+    for(size_t i = 0; i < n; i++)
+    {
+        dst[i] ^= mul_lo[c][src[i] & 15] ^ mul_hi[c][src[i] >> 4];
+    }
+}
+
+#ifdef ECC_X86
+/* dst ^= c * src, 16 bytes per PSHUFB pair */
+__attribute__((target("ssse3")))
+static void region_mul_xor_ssse3(unsigned char *dst, const unsigned char *src, unsigned char c, size_t n)
+{
+    __m128i lo = _mm_loadu_si128((const __m128i *)mul_lo[c]);
+    __m128i hi = _mm_loadu_si128((const __m128i *)mul_hi[c]);
+    __m128i mask = _mm_set1_epi8(0x0f);
+    size_t i = 0;
+
+    for(; i + 16 <= n; i += 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i l = _mm_shuffle_epi8(lo, _mm_and_si128(x, mask));
+        __m128i h = _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi64(x, 4), mask));
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(d, _mm_xor_si128(l, h)));
+    }
+
+    region_mul_xor_scalar(dst + i, src + i, c, n - i);
+}
+
+/* dst ^= c * src, 32 bytes per VPSHUFB pair */
+__attribute__((target("avx2")))
+static void region_mul_xor_avx2(unsigned char *dst, const unsigned char *src, unsigned char c, size_t n)
+{
+    __m256i lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)mul_lo[c]));
+    __m256i hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)mul_hi[c]));
+    __m256i mask = _mm256_set1_epi8(0x0f);
+    size_t i = 0;
+
+    for(; i + 32 <= n; i += 32)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i l = _mm256_shuffle_epi8(lo, _mm256_and_si256(x, mask));
+        __m256i h = _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi64(x, 4), mask));
+        __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(d, _mm256_xor_si256(l, h)));
+    }
+
+    region_mul_xor_scalar(dst + i, src + i, c, n - i);
+}
+#endif
+
+static EccRegionKernel region_mul_xor = region_mul_xor_scalar;
+
+/* Kernels this CPU runs, narrowest first */
+static struct
+{
+    const char *name;
+    EccRegionKernel fn;
+} ecc_kernels[3];
+static int ecc_kernel_count;
+
+/* Build log / exp and split tables, pick the widest kernel */
+static void init_tables(void)
+{
+    uint x = 1;
+
+    for(int i = 0; i < 255; i++)
+    {
+        gf_exp[i] = x;
+        gf_log[x] = i;
+        x <<= 1;
+        if(x & 0x100)
+            x ^= 0x11d;
+    }
+    for(int i = 255; i < 512; i++)
+    {
+        gf_exp[i] = gf_exp[i - 255];
+    }
+
+    for(int c = 0; c < 256; c++)
+    {
+        for(int v = 0; v < 16; v++)
+        {
+            mul_lo[c][v] = gf_mul(c, v);
+            mul_hi[c][v] = gf_mul(c, v << 4);
+        }
+    }
+
+    ecc_kernels[ecc_kernel_count].name = "scalar";
+    ecc_kernels[ecc_kernel_count++].fn = region_mul_xor_scalar;
+#ifdef ECC_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("ssse3"))
+    {
+        ecc_kernels[ecc_kernel_count].name = "ssse3";
+        ecc_kernels[ecc_kernel_count++].fn = region_mul_xor_ssse3;
+    }
+    if(__builtin_cpu_supports("avx2"))
+    {
+        ecc_kernels[ecc_kernel_count].name = "avx2";
+        ecc_kernels[ecc_kernel_count++].fn = region_mul_xor_avx2;
+    }
+#endif
+    region_mul_xor = ecc_kernels[ecc_kernel_count - 1].fn;
+}
+
+/* Region kernel index this CPU runs, NULL past the last one */
+EccRegionKernel ecc_get_kernel(int index, const char **name)
+{
+    pthread_once(&tables_once, init_tables);
+
+    if(index < 0 || index >= ecc_kernel_count)
+        return NULL;
+    if(name != NULL)
+        *name = ecc_kernels[index].name;
+    return ecc_kernels[index].fn;
+}
+
+/* Use the named region kernel from now on (before any threads start) */
+Status ecc_set_kernel(const char *name)
+{
+    pthread_once(&tables_once, init_tables);
+
+    for(int i = 0; i < ecc_kernel_count; i++)
+    {
+        if(strcmp(ecc_kernels[i].name, name) == 0)
+        {
+            region_mul_xor = ecc_kernels[i].fn;
+            return e_success;
+        }
+    }
+    return e_failure;
+}
+
+/* Bytes of coded block for len payload bytes */
+long ecc_encoded_size(long len, int nsym)
+{
+    long data = ECC_N - nsym;
+    long k = (len + data - 1) / data;
+
+    return k * ECC_N;
+}
+
+/* Generator polynomial, highest degree first, nsym + 1 terms */
+static void generator_poly(int nsym, unsigned char *gen)
+{
+    gen[0] = 1;
+    for(int i = 0; i < nsym; i++)
+    {
+        //gen *= (x + alpha^i)
+        unsigned char a = gf_alpha(i);
+        gen[i + 1] = 0;
+        for(int j = i + 1; j > 0; j--)
+        {
+            gen[j] ^= gf_mul(gen[j - 1], a);
+        }
+    }
+}
+
+/* Encode len payload bytes into out (ecc_encoded_size() bytes)
+ * Systematic LFSR division run on all k codewords at once,
+ * each step is a region multiply over one row of k bytes.
+ */
+Status ecc_encode(const unsigned char *data, long len, int nsym, unsigned char *out)
+{
+    long rows_data = ECC_N - nsym;
+    long k = (len + rows_data - 1) / rows_data;
+    unsigned char gen[ECC_MAX_PARITY + 1];
+    unsigned char *par[ECC_MAX_PARITY];
+    unsigned char *scratch, *fb;
+
+    pthread_once(&tables_once, init_tables);
+
+    scratch = calloc(nsym + 1, k);
+    if(scratch == NULL)
+    {
+        return e_failure;
+    }
+
+    generator_poly(nsym, gen);
+
+    //data rows are the payload itself, zero padded
+    memcpy(out, data, len);
+    memset(out + len, 0, rows_data * k - len);
+
+    //ECC_COLUMN_BLOCK codewords at a time so the registers stay in cache
+    for(long c0 = 0; c0 < k; c0 += ECC_COLUMN_BLOCK)
+    {
+        long w = k - c0 < ECC_COLUMN_BLOCK ? k - c0 : ECC_COLUMN_BLOCK;
+
+        for(int t = 0; t < nsym; t++)
+        {
+            par[t] = scratch + t * k + c0;
+        }
+        fb = scratch + nsym * k + c0;
+
+        for(long j = 0; j < rows_data; j++)
+        {
+            const unsigned char *row = out + j * k + c0;
+            unsigned char *first = par[0];
+
+            for(long c = 0; c < w; c++)
+            {
+                fb[c] = row[c] ^ first[c];
+            }
+
+            //shift the registers by rotating row pointers
+            for(int t = 0; t < nsym - 1; t++)
+            {
+                par[t] = par[t + 1];
+                region_mul_xor(par[t], fb, gen[t + 1], w);
+            }
+            par[nsym - 1] = first;
+            memset(first, 0, w);
+            region_mul_xor(first, fb, gen[nsym], w);
+        }
+
+        for(int t = 0; t < nsym; t++)
+        {
+            memcpy(out + (rows_data + t) * k + c0, par[t], w);
+        }
+    }
+
+    free(scratch);
+    return e_success;
+}
+
+/* Evaluate polynomial (highest degree first) at x */
+static unsigned char poly_eval(const unsigned char *p, int n, unsigned char x)
+{
+    unsigned char y = p[0];
+
+    for(int i = 1; i < n; i++)
+    {
+        y = gf_mul(y, x) ^ p[i];
+    }
+    return y;
+}
+
+/* out = p * q, returns length */
+static int poly_mul(const unsigned char *p, int pn, const unsigned char *q, int qn, unsigned char *out)
+{
+    memset(out, 0, pn + qn - 1);
+    for(int j = 0; j < qn; j++)
+    {
+        for(int i = 0; i < pn; i++)
+        {
+            out[i + j] ^= gf_mul(p[i], q[j]);
+        }
+    }
+    return pn + qn - 1;
+}
+
+/* Correct one codeword given its syndromes (synd[0] is a zero pad)
+ * Berlekamp-Massey, Chien search and Forney, returns errors fixed
+ * or -1 when there are too many.
+ */
+static int correct_codeword(unsigned char *msg, const unsigned char *synd, int nsym)
+{
+    unsigned char err_loc[ECC_MAX_PARITY + 2], old_loc[ECC_MAX_PARITY + 2], tmp[ECC_MAX_PARITY + 2];
+    unsigned char rev[ECC_MAX_PARITY + 2], e_loc[ECC_MAX_PARITY + 2], prod[2 * ECC_MAX_PARITY + 4];
+    unsigned char X[ECC_MAX_PARITY];
+    unsigned char *eval;
+    int err_pos[ECC_MAX_PARITY];
+    int err_len = 1, old_len = 1, errs, found = 0, e_len = 1;
+
+    err_loc[0] = old_loc[0] = 1;
+
+    //Berlekamp-Massey, polynomials highest degree first
+    for(int i = 0; i < nsym; i++)
+    {
+        unsigned char delta = synd[i + 1];
+
+        for(int j = 1; j < err_len; j++)
+        {
+            delta ^= gf_mul(err_loc[err_len - 1 - j], synd[i + 1 - j]);
+        }
+
+        old_loc[old_len++] = 0;
+
+        if(delta != 0)
+        {
+            if(old_len > err_len)
+            {
+                unsigned char inv = gf_inv(delta);
+                int n = old_len;
+
+                for(int j = 0; j < n; j++)
+                    tmp[j] = gf_mul(old_loc[j], delta);
+                for(int j = 0; j < err_len; j++)
+                    old_loc[j] = gf_mul(err_loc[j], inv);
+                old_len = err_len;
+                memcpy(err_loc, tmp, n);
+                err_len = n;
+            }
+
+            //err_loc += old_loc * delta, aligned on the lowest degree
+            for(int j = 0; j < old_len; j++)
+            {
+                err_loc[err_len - old_len + j] ^= gf_mul(old_loc[j], delta);
+            }
+        }
+    }
+
+    while(err_len > 1 && err_loc[0] == 0)
+    {
+        memmove(err_loc, err_loc + 1, --err_len);
+    }
+
+    errs = err_len - 1;
+    if(errs * 2 > nsym)
+    {
+        return -1;
+    }
+
+    //Chien search on the reversed locator
+    for(int i = 0; i < err_len; i++)
+    {
+        rev[i] = err_loc[err_len - 1 - i];
+    }
+    for(int i = 0; i < ECC_N && found <= errs; i++)
+    {
+        if(poly_eval(rev, err_len, gf_alpha(i)) == 0)
+        {
+            if(found == errs)
+                return -1;
+            err_pos[found++] = ECC_N - 1 - i;
+        }
+    }
+    if(found != errs)
+    {
+        return -1;
+    }
+
+    //errata locator and evaluator for Forney
+    e_loc[0] = 1;
+    for(int m = 0; m < errs; m++)
+    {
+        unsigned char term[2];
+
+        X[m] = gf_alpha(ECC_N - 1 - err_pos[m]);
+        term[0] = X[m];
+        term[1] = 1;
+        e_len = poly_mul(e_loc, e_len, term, 2, tmp);
+        memcpy(e_loc, tmp, e_len);
+    }
+
+    //evaluator = (reversed syndromes * errata locator) mod x^e_len
+    for(int i = 0; i <= nsym; i++)
+    {
+        rev[i] = synd[nsym - i];
+    }
+    eval = prod + poly_mul(rev, nsym + 1, e_loc, e_len, prod) - e_len;
+
+    for(int m = 0; m < errs; m++)
+    {
+        unsigned char xi_inv = gf_inv(X[m]);
+        unsigned char prime = 1;
+        unsigned char y;
+
+        for(int j = 0; j < errs; j++)
+        {
+            if(j != m)
+                prime = gf_mul(prime, 1 ^ gf_mul(xi_inv, X[j]));
+        }
+        if(prime == 0)
+        {
+            return -1;
+        }
+
+        y = gf_mul(X[m], poly_eval(eval, e_len, xi_inv));
+        msg[err_pos[m]] ^= gf_div(y, prime);
+    }
+
+    return errs;
+}
+
+/* Correct a coded block in place, returns symbols fixed or -1
+ * Syndromes of all codewords are made together with region
+ * multiplies, only codewords with a non zero syndrome are
+ * pulled out and corrected one by one.
+ */
+long ecc_decode(unsigned char *buf, long len, int nsym)
+{
+    long rows_data = ECC_N - nsym;
+    long k = (len + rows_data - 1) / rows_data;
+    unsigned char *synd_rows;
+    long fixed = 0;
+
+    pthread_once(&tables_once, init_tables);
+
+    synd_rows = calloc(nsym, k);
+    if(synd_rows == NULL)
+    {
+        return -1;
+    }
+
+    //S_i = sum of r_j * alpha^(i * (254 - j)), a column block at a time
+    for(long c0 = 0; c0 < k; c0 += ECC_COLUMN_BLOCK)
+    {
+        long w = k - c0 < ECC_COLUMN_BLOCK ? k - c0 : ECC_COLUMN_BLOCK;
+
+        for(long j = 0; j < ECC_N; j++)
+        {
+            for(int i = 0; i < nsym; i++)
+            {
+                region_mul_xor(synd_rows + i * k + c0, buf + j * k + c0, gf_alpha((long)i * (ECC_N - 1 - j)), w);
+            }
+        }
+    }
+
+    for(long c = 0; c < k && fixed >= 0; c++)
+    {
+        unsigned char synd[ECC_MAX_PARITY + 1];
+        unsigned char msg[ECC_N];
+        int dirty = 0;
+        int errs;
+
+        synd[0] = 0;
+        for(int i = 0; i < nsym; i++)
+        {
+            synd[i + 1] = synd_rows[i * k + c];
+            dirty |= synd[i + 1];
+        }
+        if(!dirty)
+        {
+            continue;
+        }
+
+        for(int j = 0; j < ECC_N; j++)
+        {
+            msg[j] = buf[j * k + c];
+        }
+
+        errs = correct_codeword(msg, synd, nsym);
+
+        //double check, a wrong fix would leave non zero syndromes
+        for(int i = 0; errs >= 0 && i < nsym; i++)
+        {
+            if(poly_eval(msg, ECC_N, gf_alpha(i)) != 0)
+                errs = -1;
+        }
+
+        if(errs < 0)
+        {
+            fixed = -1;
+            break;
+        }
+
+        for(int j = 0; j < ECC_N; j++)
+        {
+            buf[j * k + c] = msg[j];
+        }
+        fixed += errs;
+    }
+
+    free(synd_rows);
+    return fixed;
+}
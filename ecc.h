@@ -0,0 +1,45 @@
+#ifndef ECC_H
+#define ECC_H
+#include <stddef.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Reed-Solomon error correction over GF(2^8) for --ecc.
+ * The payload is cut across k codewords of RS(255, 255 - nsym):
+ * payload byte p belongs to codeword p % k, so consecutive bytes
+ * go to different codewords and a damaged run of the image hits
+ * each codeword only once. The coded block is the payload padded
+ * to k * (255 - nsym) bytes followed by nsym rows of k parity bytes.
+ * Codewords are encoded and checked side by side with PSHUFB
+ * split-table multiplies (SSSE3 / AVX2, picked at run time, or
+ * by --autotune).
+ */
+
+#define ECC_N 255
+#define ECC_MIN_PARITY 2
+#define ECC_MAX_PARITY 64
+#define ECC_COLUMN_BLOCK 2048   // codewords worked on together
+
+/* dst ^= c * src over n bytes */
+typedef void (*EccRegionKernel)(unsigned char *dst, const unsigned char *src, unsigned char c, size_t n);
+
+/* ECC function prototypes */
+
+/* Bytes of coded block for len payload bytes */
+long ecc_encoded_size(long len, int nsym);
+
+/* Encode len payload bytes into out (ecc_encoded_size() bytes) */
+Status ecc_encode(const unsigned char *data, long len, int nsym, unsigned char *out);
+
+/* Correct a coded block in place, returns symbols fixed or -1 if
+ * some codeword has more than nsym / 2 errors. The payload is
+ * then the first len bytes of buf. */
+long ecc_decode(unsigned char *buf, long len, int nsym);
+
+/* Region kernel index this CPU runs, NULL past the last one */
+EccRegionKernel ecc_get_kernel(int index, const char **name);
+
+/* Use the named region kernel from now on (before any threads start) */
+Status ecc_set_kernel(const char *name);
+
+#endif
@@ -1,455 +1,1187 @@
-#include <stdio.h>
-#include "encode.h"
-#include "types.h"
-#include<string.h>
-#include "common.h"
-
-/* Function Definitions */
-
-/* Get image size
- * Input: Image file ptr
- * Output: width * height * bytes per pixel (3 in our case)
- * Description: In BMP Image, width is stored in offset 18,
- * and height after that. size is 4 bytes
- */
-uint get_image_size_for_bmp(FILE *fptr_image)
-{
-    uint width, height;
-    // Seek to 18th byte
-    fseek(fptr_image, 18, SEEK_SET);
-
-    // Read the width (an int)
-    fread(&width, sizeof(int), 1, fptr_image);
-    printf("width = %u\n", width);
-
-    // Read the height (an int)
-    fread(&height, sizeof(int), 1, fptr_image);
-    printf("height = %u\n", height);
-
-    // Return image capacity
-    return width * height * 3;
-}
-
-/* 
- * Get File pointers for i/p and o/p files
- * Inputs: Src Image file, Secret file and
- * Stego Image file
- * Output: FILE pointer for above files
- * Return Value: e_success or e_failure, on file errors
- */
-Status open_files(EncodeInfo *encInfo)
-{
-    // Src Image file
-    encInfo->fptr_src_image = fopen(encInfo->src_image_fname, "r");
-    
-    // Do Error handling
-    if (encInfo->fptr_src_image == NULL)
-    {
-    	perror("fopen");
-    	fprintf(stderr, "ERROR: Unable to open file %s\n", encInfo->src_image_fname);
-
-    	return e_failure;
-    }
-
-    // Secret file
-    encInfo->fptr_secret = fopen(encInfo->secret_fname, "r");
-    
-    // Do Error handling
-    if (encInfo->fptr_secret == NULL)
-    {
-    	perror("fopen");
-    	fprintf(stderr, "ERROR: Unable to open file %s\n", encInfo->secret_fname);
-
-    	return e_failure;
-    }
-
-    // Stego Image file
-    encInfo->fptr_stego_image = fopen(encInfo->stego_image_fname, "w");
-   
-    // Do Error handling
-    if (encInfo->fptr_stego_image == NULL)
-    {
-    	perror("fopen");
-    	fprintf(stderr, "ERROR: Unable to open file %s\n", encInfo->stego_image_fname);
-
-    	return e_failure;
-    }
-
-    // No failure return e_success
-    return e_success;
-}
-
-/* Read and validate Encode args from argv */
-/*This function reads and validates all command-line 
-arguments required for encoding
-It checks if the input image, secret file, and 
-output stego image are correctly provided and valid*/
-Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
-{
-    //check for source file 
-    if(argv[2][0] != '.')   //check if any one char is there before .bmp
-    {
-        if(strstr(argv[2], ".bmp"))  
-        {
-            encInfo -> src_image_fname = argv[2]; //store file name into source file
-        }
-        else
-        {
-            return e_failure;
-        }
-    }
-    else
-    {
-        return e_failure;
-    }
-
-    //check for secrete file
-
-    if(argv[3][0] != '.')
-    {
-        if(strstr(argv[3], ".txt") || strstr(argv[3], ".c") || strstr(argv[3], ".sh") || strstr(argv[3], ".h"))  
-        {
-            encInfo -> secret_fname = argv[3]; //store file name into source file
-        }
-        else
-        {
-            return e_failure;
-        }
-    }
-    else
-    {
-        return e_failure;
-    }
-
-    //check for last argument
-    if(argv[4] == NULL)
-    {
-        encInfo -> stego_image_fname = "default.bmp"; //cant store in argv[4] because it has NULL address so store in default file
-    }
-    else
-    {
-        if(argv[4][0] != '.')   //check if any one char is there before .bmp
-        {
-            if(strstr(argv[4], ".bmp"))  
-            {   
-                encInfo -> stego_image_fname = argv[4]; //store file name into source file
-            }
-            else
-            {
-                return e_failure;
-            }
-        }
-        else
-        {
-            return e_failure;
-        }
-    }
-
-    return e_success;//all arguments are valid
-}
-
-/* Copy bmp image header */
-/*Copies the first 54 bytes of BMP header from the 
-  source BMP image to the destination stego image.*/
-Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image)
-{
-    unsigned char header[54];
-
-    //rewind the src file
-    rewind(fptr_src_image);
-
-    // Reading header from source
-    fread(header, 1, 54, fptr_src_image);
-    // Write header to destination
-    fwrite(header, 1, 54, fptr_dest_image);
-    
-    if(ftell(fptr_src_image) == ftell(fptr_dest_image)) 
-    {
-        return e_success;
-    }
-    else
-    {
-        return e_failure;
-    }
-}
-
-uint get_file_size(FILE *fptr) //alculates and returns the total size of a file in bytes.
-{
-    fseek(fptr, 0, SEEK_END);
-    uint size = ftell(fptr); 
-    return size;
-}
-
-/* check capacity */
-/*Checks whether the source BMP image has enough
-  capacity to hide the secret file and all
- required metadata.*/
-Status check_capacity(EncodeInfo *encInfo)
-{
-    uint size = get_image_size_for_bmp(encInfo->fptr_src_image);
-
-    if(size > ((strlen(MAGIC_STRING) + MAX_FILE_SUFFIX + sizeof(encInfo -> extn_secret_file) + sizeof(encInfo -> size_secret_file) + get_file_size(encInfo -> fptr_secret)) * 8) + 54)
-    {
-        return e_success;
-    }
-
-    return e_failure;
-}
-
-/* Encode a byte into LSB of image data array */
-/*Encodes (hides) one byte of secret data into 
-  8 bytes of image data using Least Significant Bit (LSB) method.*/
-Status encode_byte_to_lsb(char data, char *image_buffer)
-{
-    char bit_data;
-
-    for(int i = 7; i >= 0; i--)
-    {
-        bit_data = ((data >> i) & 1);  //Get the bit
-        image_buffer[7 - i] = image_buffer[7 - i] & (~1);  //clear the bit
-        image_buffer[7 - i] = image_buffer[7 - i] | bit_data; //set the bit
-    }
-
-    return e_success; //if all 8 bits are encoded successfully
-}
-
-/* Store Magic String */
-/*Encodes a predefined magic string(*#) into the image
- This magic string acts as an identifier or signature
- during decoding to confirm that the image actually
- contains hidden data.*/
-Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo)
-{
-    //Declare array of size 8
-    char arr[8];
-
-    //Run the loop strlen(magic_string) times
-    for(int i = 0; i < strlen(magic_string); i++)
-    {
-        //Read the 8byte of data from src file
-        fread(arr, 1, 8, encInfo -> fptr_src_image);
-
-        /* Encode a byte into LSB of image data array */
-        if((encode_byte_to_lsb(magic_string[i], arr)) == e_success)
-        {
-            //Write the 8 byte data to destination
-            fwrite(arr, 1, 8, encInfo -> fptr_stego_image);
-        }
-        else
-        {
-            return e_failure;
-        }
-    }
-    return e_success; 
-}
-
-/* Encode function, which does the real encoding */
-/*This function hides a 32-bit integer value into 32 image 
-bytes — one bit per image byte.It moves from the most
- significant bit (MSB) to the least significant bit (LSB)
-and stores each bit in the LSB of an image byte, 
-keeping the image visually unchanged.*/
-Status encode_int_to_lsb(int size, char *image_buffer) //collecting 32 bytes of data
-{
-    char bit_data;
-
-    for(int i = 31; i >= 0; i--)
-    {
-        bit_data = ((size >> i) & 1);  //Get the bit
-        image_buffer[31 - i] = image_buffer[31 - i] & (~1);  //clear the bit
-        image_buffer[31 - i] = image_buffer[31 - i] | bit_data; //set the bit
-    }
-
-    return e_success; 
-}
-
-/* Encode extenstion size */
-/*Encodes the size (length) of the secret file's 
-  extension (like"shreedhar.txt"->4) into the BMP image data.*/
-Status encode_secret_extn_file_size(int size, EncodeInfo *encInfo)
-{
-    //Declare the array with size 32
-    char arr[32];
-
-    //Read 32 byte of data from src file
-    fread(arr, 1, 32, encInfo -> fptr_src_image);
-
-    if((encode_int_to_lsb(strlen(encInfo -> extn_secret_file), arr)) == e_success)
-    {
-        //write  the 32 byte data into dest file
-        fwrite(arr, 1, 32, encInfo->fptr_stego_image);
-        return e_success;
-    } 
-
-    return e_failure;
-}
-
-/* Encode secret file extenstion */
-/*Encodes the secret file's extension (like "shreedhar.txt")
-  into the BMP image using the Least Significant Bit (LSB) method.*/
-Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo)
-{
-    //Declare array of size 8
-    char arr[8];
-
-    //Run the loop strlen(file_extn) times
-    for(int i = 0; i < strlen(file_extn); i++)
-    {
-        //Read the 8byte of data from src file
-        fread(arr, 1, 8, encInfo -> fptr_src_image);
-
-        /* Encode a byte into LSB of image data array */
-        if((encode_byte_to_lsb(file_extn[i], arr)) == e_success)
-        {
-            //Write the 8byted data to destination
-            fwrite(arr, 1, 8, encInfo -> fptr_stego_image);
-        } 
-        else
-        {
-            return e_failure;
-        }
-    }
-    return e_success;
-}
-
-/* Encode secret file size */
-/*This function hides the total size of your secret file in bytes inside the BMP image.
-Example:
-If your secret file secret.txt is 150 bytes long,
-this function stores 150 in binary form inside the LSBs of 32 image bytes.
-Later, when decoding, this exact number tells the program:*/
-Status encode_secret_file_size(long file_size, EncodeInfo *encInfo)
-{
-    //Declare the array with size 32
-    char arr[32];
-
-    //Read 32 byte of data from src file
-    fread(arr, 1, 32, encInfo->fptr_src_image);
-
-    if((encode_int_to_lsb(file_size, arr)) == e_success)
-    {
-        //write  the 32 byte data into dest file
-        fwrite(arr, 1, 32, encInfo->fptr_stego_image);
-        return e_success;
-    }
-    return e_failure;
-}
-
-/* Encode secret file data*/
-/*This function hides the real data of your secret file into the BMP image.
-It takes 1 character at a time from your secret file,
-and hides that character into 8 bytes of the image using LSB encoding.*/
-Status encode_secret_file_data(EncodeInfo *encInfo)
-{
-    char arr[8];
-    char ch;
-
-    //Rewind for fptr_secret
-    rewind(encInfo -> fptr_secret);
-
-    //Run the loop  encInfo -> size_secret_file times
-    for(int i = 0; i < encInfo -> size_secret_file; i++)
-    {
-        //Read 1 byte from secret file
-        fread(&ch, 1, 1, encInfo -> fptr_secret);
-        
-        //Read 8 bytes from source image
-        fread(arr, 1, 8, encInfo -> fptr_src_image);
-
-        /* Encode a byte into LSB of image data array */
-        if((encode_byte_to_lsb(ch, arr)) == e_success)
-        {
-            //Write the 8 bytes to stego image
-            fwrite(arr, 1, 8, encInfo -> fptr_stego_image);
-        }
-        else
-        {
-            return e_failure;
-        }
-    }
-    return e_success;  
-}
-
-/* Copy remaining image bytes from src to stego image after encoding */
-/*After encoding the secret message,
-there’s still unused image data left the rest of the BMP image pixels
-This function simply copies all the leftover bytes
-from the source image to the stego image*/
-Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest)
-{ 
-   char ch;
-
-   //read and write remaining data byte by byte
-   while(fread(&ch, 1, 1, fptr_src))
-   {
-        fwrite(&ch, 1, 1, fptr_dest);
-   }
-
-   return e_success;
-}
-
-/* Perform the complete encoding */
-Status do_encoding(EncodeInfo *encInfo)
-{
-    /* Get File pointers for i/p and o/p files */
-    if((open_files(encInfo)) == e_success)
-    {
-        printf("File Opened ready to encode...!\n");
-        
-        // Initialize file information
-        encInfo->size_secret_file = get_file_size(encInfo->fptr_secret);
-        strcpy(encInfo->extn_secret_file, ".txt"); // file extension
-        
-        printf("Size of secret file: %ld bytes\n", encInfo->size_secret_file);
-       // printf("extension type: %s\n", encInfo->extn_secret_file);
-        
-        if((check_capacity(encInfo)) == e_success)
-        {
-            //printf("Checking the capacity of file done...\n");
-            /* Copy bmp image header */
-            if((copy_bmp_header(encInfo -> fptr_src_image, encInfo -> fptr_stego_image)) == e_success)
-            {
-               // printf("Copied header successfully...\n");
-                /* Store Magic String */
-                if((encode_magic_string(MAGIC_STRING, encInfo)) == e_success)
-                {
-                    printf("Magic string uploaded...\n");
-                    /* Encode extenstion size */
-                    if((encode_secret_extn_file_size(MAX_FILE_SUFFIX, encInfo)) == e_success)
-                    {
-                        //printf("Encoded secret File extention Size Successfully...\n");
-                        /* Encode secret file extenstion */
-                        if((encode_secret_file_extn(encInfo -> extn_secret_file, encInfo)) == e_success)
-                        {
-                           // printf("Encoded secret File extention Successfully...\n");
-                            /* Encode secret file size */
-                            if((encode_secret_file_size(encInfo -> size_secret_file, encInfo)) == e_success)
-                            {
-                               // printf("secret File Size encoded Successfully...\n");
-                                /* Encode secret file data*/
-                                if((encode_secret_file_data(encInfo)) == e_success)
-                                {
-                                    //printf("File data encoded Successfully...\n");
-                                    if((copy_remaining_img_data(encInfo -> fptr_src_image, encInfo -> fptr_stego_image)) == e_success)
-                                    {
-                                        printf("Secret file data uploaded...!\n");                                       
-                                        return e_success; 
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        }
-        else
-        {
-            printf("Capacity check failed\n");
-        }
-    }
-    else
-    {
-        printf("Failed to open files\n");
-    }
-    return e_failure;
-}
\ No newline at end of file
+#include <stdio.h>
+#include "encode.h"
+#include "types.h"
+#include<string.h>
+#include "common.h"
+#include "spread.h"
+#include "chacha.h"
+#include "png.h"
+#include "ecc.h"
+#include "y4m.h"
+#include "tune.h"
+#include "out_writer.h"
+#include "segment.h"
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <sys/random.h>
+
+/* Function Definitions */
+
+/* Get image size
+ * Input: Image file ptr
+ * Output: width * height * bytes per pixel (3 in our case)
+ * Description: In BMP Image, width is stored in offset 18,
+ * and height after that. size is 4 bytes
+ */
+uint get_image_size_for_bmp(FILE *fptr_image)
+{
+    uint width, height;
+    // Seek to 18th byte
+    fseek(fptr_image, 18, SEEK_SET);
+
+    // Read the width (an int)
+    fread(&width, sizeof(int), 1, fptr_image);
+    printf("width = %u\n", width);
+
+    // Read the height (an int)
+    fread(&height, sizeof(int), 1, fptr_image);
+    printf("height = %u\n", height);
+
+    // Return image capacity
+    return width * height * 3;
+}
+
+/* 
+ * Get File pointers for i/p and o/p files
+ * Inputs: Src Image file, Secret file and
+ * Stego Image file
+ * Output: FILE pointer for above files
+ * Return Value: e_success or e_failure, on file errors
+ */
+Status open_files(EncodeInfo *encInfo)
+{
+    FILE *fptr_cover = NULL;    // second cover handle for the PNG writer
+    PngInfo png_info;
+
+    // Src Image file, served from memory when the cover is cached
+    if (encInfo->cover_cache != NULL)
+    {
+        encInfo->cover_entry = cover_cache_get(encInfo->cover_cache, encInfo->src_image_fname);
+        if (encInfo->cover_entry == NULL)
+        {
+            return e_failure;
+        }
+        encInfo->image_capacity = encInfo->cover_entry->image_capacity;
+        encInfo->fptr_src_image = cover_cache_open(encInfo->cover_entry);
+    }
+    else
+    {
+        encInfo->fptr_src_image = fopen(encInfo->src_image_fname, "r");
+    }
+    
+    // Do Error handling
+    if (encInfo->fptr_src_image == NULL)
+    {
+    	perror("fopen");
+    	fprintf(stderr, "ERROR: Unable to open file %s\n", encInfo->src_image_fname);
+
+    	return e_failure;
+    }
+
+    // PNG cover, read through an inflating stream
+    if (encInfo->image_format == e_png)
+    {
+        if (encInfo->cover_entry != NULL)
+            fptr_cover = cover_cache_open(encInfo->cover_entry);
+        else
+            fptr_cover = fopen(encInfo->src_image_fname, "r");
+
+        encInfo->fptr_src_image = png_open_reader(encInfo->fptr_src_image, &png_info);
+        if (encInfo->fptr_src_image == NULL || fptr_cover == NULL)
+        {
+            fprintf(stderr, "ERROR: Unable to read PNG image %s\n", encInfo->src_image_fname);
+            if (fptr_cover != NULL)
+                fclose(fptr_cover);
+            return e_failure;
+        }
+        encInfo->image_capacity = png_info.rowbytes * png_info.height;
+    }
+
+    // Secret file, "-" is stdin
+    if (strcmp(encInfo->secret_fname, "-") == 0)
+        encInfo->fptr_secret = stdin;
+    else
+        encInfo->fptr_secret = fopen(encInfo->secret_fname, "r");
+    
+    // Do Error handling
+    if (encInfo->fptr_secret == NULL)
+    {
+    	perror("fopen");
+    	fprintf(stderr, "ERROR: Unable to open file %s\n", encInfo->secret_fname);
+
+        if (fptr_cover != NULL)
+            fclose(fptr_cover);
+    	return e_failure;
+    }
+
+    // Stego Image file, built up in a journaled part file for --resume
+    if (encInfo->opts.resume)
+    {
+        JournalRecord identity;
+
+        encInfo->journal = malloc(sizeof(Journal));
+        if (encInfo->journal == NULL ||
+            journal_identity(&identity, encInfo->src_image_fname, encInfo->secret_fname, encInfo->stego_flags) == e_failure ||
+            journal_open(encInfo->journal, encInfo->stego_image_fname, &identity) == e_failure)
+        {
+            free(encInfo->journal);
+            encInfo->journal = NULL;
+            return e_failure;
+        }
+        encInfo->fptr_stego_image = journal_open_stream(encInfo->journal);
+    }
+    // Same size as the cover, preallocated and written in aligned blocks
+    else if (encInfo->image_format != e_png && encInfo->opts.spread_key == NULL && !encInfo->opts.low_memory)
+    {
+        struct stat st;
+        off_t size = 0;
+
+        if (encInfo->cover_entry != NULL)
+            size = encInfo->cover_entry->size;
+        else if (fstat(fileno(encInfo->fptr_src_image), &st) == 0)
+            size = st.st_size;
+
+        encInfo->fptr_stego_image = out_writer_open(encInfo->stego_image_fname, size, encInfo->opts.direct);
+    }
+    else
+    {
+        encInfo->fptr_stego_image = fopen(encInfo->stego_image_fname, "w");
+    }
+   
+    // Do Error handling
+    if (encInfo->fptr_stego_image == NULL)
+    {
+    	perror("fopen");
+    	fprintf(stderr, "ERROR: Unable to open file %s\n", encInfo->stego_image_fname);
+
+        if (fptr_cover != NULL)
+            fclose(fptr_cover);
+    	return e_failure;
+    }
+
+    // PNG output, rows are filtered and deflated on the way out
+    if (encInfo->image_format == e_png)
+    {
+        encInfo->fptr_stego_image = png_open_writer(encInfo->fptr_stego_image, fptr_cover, encInfo->opts.low_memory ? 1 : 0);
+        if (encInfo->fptr_stego_image == NULL)
+        {
+            fprintf(stderr, "ERROR: Unable to write PNG image %s\n", encInfo->stego_image_fname);
+            return e_failure;
+        }
+    }
+
+    // Self-check, pixel bytes are analysed on their way out
+    if (encInfo->opts.self_check)
+    {
+        FILE *fptr_tee = stego_check_open_tee(encInfo->fptr_stego_image, &encInfo->check,
+                                              encInfo->stego_image_fname, encInfo->image_format,
+                                              encInfo->image_format == e_png ? png_info.channels : 3);
+        if (fptr_tee == NULL)
+        {
+            fprintf(stderr, "ERROR: Unable to set up self-check\n");
+            return e_failure;
+        }
+        encInfo->fptr_stego_image = fptr_tee;
+    }
+
+    // No failure return e_success
+    return e_success;
+}
+
+/* Close the files opened by open_files() */
+/*Safe to call after a partial open_files(),
+  unopened files are simply skipped. Fails if the stego
+  image could not be completed (PNG output is finished here)*/
+Status close_files(EncodeInfo *encInfo)
+{
+    Status ret = e_success;
+
+    if (encInfo->fptr_src_image != NULL)
+    {
+        //--direct, batch runs should not leave the inputs in the page cache
+        if (encInfo->opts.direct && encInfo->cover_entry == NULL)
+            out_writer_drop_input(encInfo->fptr_src_image);
+        fclose(encInfo->fptr_src_image);
+        encInfo->fptr_src_image = NULL;
+    }
+
+    if (encInfo->fptr_secret != NULL)
+    {
+        if (encInfo->opts.direct)
+            out_writer_drop_input(encInfo->fptr_secret);
+        fclose(encInfo->fptr_secret);
+        encInfo->fptr_secret = NULL;
+    }
+
+    if (encInfo->fptr_stego_image != NULL)
+    {
+        if (fclose(encInfo->fptr_stego_image) != 0)
+        {
+            ret = e_failure;
+        }
+        encInfo->fptr_stego_image = NULL;
+    }
+
+    //rename into place when finished, or keep the checkpoint
+    if (encInfo->journal != NULL)
+    {
+        if (ret == e_failure)
+        {
+            encInfo->journal->complete = 0;
+        }
+        if (journal_close(encInfo->journal) == e_failure)
+        {
+            ret = e_failure;
+        }
+        encInfo->journal = NULL;
+    }
+
+    if (encInfo->cover_entry != NULL)
+    {
+        cover_cache_put(encInfo->cover_cache, encInfo->cover_entry);
+        encInfo->cover_entry = NULL;
+    }
+
+    return ret;
+}
+
+/* Read and validate Encode args from argv */
+/*This function reads and validates all command-line 
+arguments required for encoding
+It checks if the input image, secret file, and 
+output stego image are correctly provided and valid*/
+Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
+{
+    //check for source file 
+    if(argv[2][0] != '.')   //check if any one char is there before .bmp
+    {
+        if(strstr(argv[2], ".bmp") || strstr(argv[2], ".png") || strstr(argv[2], ".y4m"))  
+        {
+            encInfo -> src_image_fname = argv[2]; //store file name into source file
+            encInfo -> image_format = get_image_format(argv[2]);
+        }
+        else
+        {
+            return e_failure;
+        }
+    }
+    else
+    {
+        return e_failure;
+    }
+
+    //check for secrete file
+
+    if(argv[3][0] != '.')
+    {
+        if(strstr(argv[3], ".txt") || strstr(argv[3], ".c") || strstr(argv[3], ".sh") || strstr(argv[3], ".h"))  
+        {
+            encInfo -> secret_fname = argv[3]; //store file name into source file
+        }
+        else if(strcmp(argv[3], "-") == 0)
+        {
+            //secret from stdin, its length is only known at the end
+            encInfo -> secret_fname = argv[3];
+            encInfo -> opts.segmented = 1;
+        }
+        else
+        {
+            return e_failure;
+        }
+    }
+    else
+    {
+        return e_failure;
+    }
+
+    //check for last argument
+    if(argv[4] == NULL)
+    {
+        //cant store in argv[4] because it has NULL address so store in default file
+        encInfo -> stego_image_fname = encInfo -> image_format == e_png ? "default.png" :
+                                       encInfo -> image_format == e_y4m ? "default.y4m" : "default.bmp";
+    }
+    else
+    {
+        if(argv[4][0] != '.')   //check if any one char is there before .bmp
+        {
+            if(get_image_format(argv[4]) == encInfo -> image_format &&
+               (strstr(argv[4], ".bmp") || strstr(argv[4], ".png") || strstr(argv[4], ".y4m")))  //same format as the cover
+            {   
+                encInfo -> stego_image_fname = argv[4]; //store file name into source file
+            }
+            else
+            {
+                return e_failure;
+            }
+        }
+        else
+        {
+            return e_failure;
+        }
+    }
+
+    //spreading seeks around the image, PNG streams only go forward
+    if(encInfo -> image_format == e_png && encInfo -> opts.spread_key != NULL)
+    {
+        printf("Error: --spread needs a BMP cover\n");
+        return e_failure;
+    }
+
+    //video slices carry their own header, only --key applies to them
+    if(encInfo -> image_format == e_y4m && (encInfo -> opts.spread_key != NULL || encInfo -> opts.ecc_parity != 0 ||
+                                            encInfo -> opts.self_check || encInfo -> opts.resume ||
+                                            encInfo -> opts.segmented))
+    {
+        printf("Error: Y4M covers take --key only\n");
+        return e_failure;
+    }
+
+    //checkpoints pick up the plain linear layout at a byte offset
+    if(encInfo -> opts.resume && (encInfo -> image_format == e_png || encInfo -> opts.spread_key != NULL ||
+                                  encInfo -> opts.ecc_parity != 0))
+    {
+        printf("Error: --resume needs a BMP cover without --spread or --ecc\n");
+        return e_failure;
+    }
+
+    //segments are written in order as the secret arrives
+    if(encInfo -> opts.segmented && (encInfo -> opts.spread_key != NULL || encInfo -> opts.ecc_parity != 0 ||
+                                     encInfo -> opts.resume))
+    {
+        printf("Error: --segmented (or secret -) cannot be used with --spread, --ecc or --resume\n");
+        return e_failure;
+    }
+
+    return e_success;//all arguments are valid
+}
+
+/* Copy bmp image header */
+/*Copies the first 54 bytes of BMP header from the 
+  source BMP image to the destination stego image.*/
+Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image)
+{
+    unsigned char header[54];
+
+    //rewind the src file
+    rewind(fptr_src_image);
+
+    // Reading header from source
+    fread(header, 1, 54, fptr_src_image);
+    // Write header to destination
+    fwrite(header, 1, 54, fptr_dest_image);
+    
+    if(ftell(fptr_src_image) == ftell(fptr_dest_image)) 
+    {
+        return e_success;
+    }
+    else
+    {
+        return e_failure;
+    }
+}
+
+uint get_file_size(FILE *fptr) //alculates and returns the total size of a file in bytes.
+{
+    fseek(fptr, 0, SEEK_END);
+    uint size = ftell(fptr); 
+    return size;
+}
+
+/* check capacity */
+/*Checks whether the source BMP image has enough
+  capacity to hide the secret file and all
+ required metadata.*/
+Status check_capacity(EncodeInfo *encInfo)
+{
+    uint size = encInfo->image_capacity;
+
+    //capacity is precomputed for cached covers
+    if(size == 0)
+    {
+        size = get_image_size_for_bmp(encInfo->fptr_src_image);
+        encInfo->image_capacity = size;
+    }
+
+    long needed;
+
+    //segment headers instead of the size, a pipe is checked as it arrives
+    if(encInfo -> stego_flags & STEGO_FLAG_SEGMENTED)
+    {
+        needed = strlen(MAGIC_STRING_EXT) + sizeof(int) + sizeof(int) + MAX_FILE_SUFFIX +
+                 segmented_payload_size(encInfo -> size_secret_file < 0 ? 0 : encInfo -> size_secret_file);
+        if(encInfo -> stego_flags & STEGO_FLAG_CIPHER)
+        {
+            needed += CHACHA_NONCE_SIZE + 4;
+        }
+    }
+    else
+    {
+        needed = strlen(MAGIC_STRING) + MAX_FILE_SUFFIX + sizeof(encInfo -> extn_secret_file) + sizeof(encInfo -> size_secret_file) + get_file_size(encInfo -> fptr_secret);
+
+        //"#+" and the flags word, nonce and key check follow with --key
+        if(encInfo -> stego_flags)
+        {
+            needed += strlen(MAGIC_STRING_EXT) - strlen(MAGIC_STRING) + sizeof(int);
+        }
+        if(encInfo -> stego_flags & STEGO_FLAG_CIPHER)
+        {
+            needed += CHACHA_NONCE_SIZE + 4;
+        }
+    }
+
+    //coded payload plus flags and the voted ECC header ints
+    if(encInfo -> stego_flags & STEGO_FLAG_ECC)
+    {
+        needed = strlen(MAGIC_STRING_EXT) + sizeof(int) * (1 + 2 * ECC_HEADER_COPIES) + get_payload_size(encInfo);
+        if(encInfo -> stego_flags & STEGO_FLAG_CIPHER)
+        {
+            needed += CHACHA_NONCE_SIZE + 4;
+        }
+    }
+
+    if(size > (needed * 8) + 54)
+    {
+        return e_success;
+    }
+
+    return e_failure;
+}
+
+/* Get payload size */
+/*Bytes hidden after the header: extension size, extension,
+  file size and data, or the whole coded block with --ecc*/
+long get_payload_size(EncodeInfo *encInfo)
+{
+    long size = sizeof(int) + MAX_FILE_SUFFIX + sizeof(int) + encInfo->size_secret_file;
+
+    if(encInfo->stego_flags & STEGO_FLAG_ECC)
+    {
+        return ecc_encoded_size(size, encInfo->opts.ecc_parity);
+    }
+    return size;
+}
+
+/* LSB kernel, one bit per byte with shifts */
+static void lsb_kernel_bitwise(char data, char *image_buffer)
+{
+    char bit_data;
+
+    for(int i = 7; i >= 0; i--)
+    {
+        bit_data = ((data >> i) & 1);  //Get the bit
+        image_buffer[7 - i] = image_buffer[7 - i] & (~1);  //clear the bit
+        image_buffer[7 - i] = image_buffer[7 - i] | bit_data; //set the bit
+    }
+}
+
+/* Byte value spread over 8 bytes, one bit each, MSB first */
+static uint64_t lsb_spread[256];
+
+/* LSB kernel, all 8 bytes at once with a 64-bit word */
+static void lsb_kernel_table(char data, char *image_buffer)
+{
+    uint64_t word;
+
+    memcpy(&word, image_buffer, 8);
+    word = (word & ~lsb_spread[0xff]) | lsb_spread[(unsigned char)data];
+    memcpy(image_buffer, &word, 8);
+}
+
+static const struct
+{
+    const char *name;
+    LsbKernel fn;
+} lsb_kernels[] = {
+    {"bitwise", lsb_kernel_bitwise},
+    {"table", lsb_kernel_table},
+};
+
+static LsbKernel lsb_kernel = lsb_kernel_bitwise;
+
+/* LSB kernel index, NULL past the last one */
+LsbKernel get_lsb_kernel(int index, const char **name)
+{
+    if(index < 0 || index >= (int)(sizeof(lsb_kernels) / sizeof(lsb_kernels[0])))
+    {
+        return NULL;
+    }
+
+    //the table is built in memory order, so it holds on any endianness
+    if(lsb_spread[0xff] == 0)
+    {
+        for(int v = 0; v < 256; v++)
+        {
+            unsigned char bytes[8];
+
+            for(int i = 0; i < 8; i++)
+            {
+                bytes[i] = (v >> (7 - i)) & 1;
+            }
+            memcpy(&lsb_spread[v], bytes, 8);
+        }
+    }
+
+    if(name != NULL)
+    {
+        *name = lsb_kernels[index].name;
+    }
+    return lsb_kernels[index].fn;
+}
+
+/* Use the named LSB kernel from now on (before any threads start) */
+Status set_lsb_kernel(const char *name)
+{
+    LsbKernel fn;
+    const char *kname;
+
+    for(int i = 0; (fn = get_lsb_kernel(i, &kname)) != NULL; i++)
+    {
+        if(strcmp(kname, name) == 0)
+        {
+            lsb_kernel = fn;
+            return e_success;
+        }
+    }
+    return e_failure;
+}
+
+/* Encode a byte into LSB of image data array */
+/*Encodes (hides) one byte of secret data into 
+  8 bytes of image data using Least Significant Bit (LSB) method.
+  The kernel doing it is picked by --autotune.*/
+Status encode_byte_to_lsb(char data, char *image_buffer)
+{
+    lsb_kernel(data, image_buffer);
+
+    return e_success; //if all 8 bits are encoded successfully
+}
+
+/* Store Magic String */
+/*Encodes a predefined magic string(*#) into the image
+ This magic string acts as an identifier or signature
+ during decoding to confirm that the image actually
+ contains hidden data.*/
+Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo)
+{
+    //Declare array of size 8
+    char arr[8];
+
+    //Run the loop strlen(magic_string) times
+    for(int i = 0; i < strlen(magic_string); i++)
+    {
+        //Read the 8byte of data from src file
+        fread(arr, 1, 8, encInfo -> fptr_src_image);
+
+        /* Encode a byte into LSB of image data array */
+        if((encode_byte_to_lsb(magic_string[i], arr)) == e_success)
+        {
+            //Write the 8 byte data to destination
+            fwrite(arr, 1, 8, encInfo -> fptr_stego_image);
+        }
+        else
+        {
+            return e_failure;
+        }
+    }
+    return e_success; 
+}
+
+/* Encode function, which does the real encoding */
+/*This function hides a 32-bit integer value into 32 image 
+bytes — one bit per image byte.It moves from the most
+ significant bit (MSB) to the least significant bit (LSB)
+and stores each bit in the LSB of an image byte, 
+keeping the image visually unchanged.*/
+Status encode_int_to_lsb(int size, char *image_buffer) //collecting 32 bytes of data
+{
+    char bit_data;
+
+    for(int i = 31; i >= 0; i--)
+    {
+        bit_data = ((size >> i) & 1);  //Get the bit
+        image_buffer[31 - i] = image_buffer[31 - i] & (~1);  //clear the bit
+        image_buffer[31 - i] = image_buffer[31 - i] | bit_data; //set the bit
+    }
+
+    return e_success; 
+}
+
+/* Encode extenstion size */
+/*Encodes the size (length) of the secret file's 
+  extension (like"shreedhar.txt"->4) into the BMP image data.*/
+Status encode_secret_extn_file_size(int size, EncodeInfo *encInfo)
+{
+    //Declare the array with size 32
+    char arr[32];
+
+    //Read 32 byte of data from src file
+    fread(arr, 1, 32, encInfo -> fptr_src_image);
+
+    if((encode_int_to_lsb(strlen(encInfo -> extn_secret_file), arr)) == e_success)
+    {
+        //write  the 32 byte data into dest file
+        fwrite(arr, 1, 32, encInfo->fptr_stego_image);
+        return e_success;
+    } 
+
+    return e_failure;
+}
+
+/* Encode secret file extenstion */
+/*Encodes the secret file's extension (like "shreedhar.txt")
+  into the BMP image using the Least Significant Bit (LSB) method.*/
+Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo)
+{
+    //Declare array of size 8
+    char arr[8];
+
+    //Run the loop strlen(file_extn) times
+    for(int i = 0; i < strlen(file_extn); i++)
+    {
+        //Read the 8byte of data from src file
+        fread(arr, 1, 8, encInfo -> fptr_src_image);
+
+        /* Encode a byte into LSB of image data array */
+        if((encode_byte_to_lsb(file_extn[i], arr)) == e_success)
+        {
+            //Write the 8byted data to destination
+            fwrite(arr, 1, 8, encInfo -> fptr_stego_image);
+        } 
+        else
+        {
+            return e_failure;
+        }
+    }
+    return e_success;
+}
+
+/* Encode secret file size */
+/*This function hides the total size of your secret file in bytes inside the BMP image.
+Example:
+If your secret file secret.txt is 150 bytes long,
+this function stores 150 in binary form inside the LSBs of 32 image bytes.
+Later, when decoding, this exact number tells the program:*/
+Status encode_secret_file_size(long file_size, EncodeInfo *encInfo)
+{
+    //Declare the array with size 32
+    char arr[32];
+
+    //Read 32 byte of data from src file
+    fread(arr, 1, 32, encInfo->fptr_src_image);
+
+    if((encode_int_to_lsb(file_size, arr)) == e_success)
+    {
+        //write  the 32 byte data into dest file
+        fwrite(arr, 1, 32, encInfo->fptr_stego_image);
+        return e_success;
+    }
+    return e_failure;
+}
+
+/* Encode secret file data*/
+/*This function hides the real data of your secret file into the BMP image.
+It takes 1 character at a time from your secret file,
+and hides that character into 8 bytes of the image using LSB encoding.*/
+Status encode_secret_file_data(EncodeInfo *encInfo)
+{
+    char arr[8];
+    char ch;
+    long start = 0;
+
+    //Rewind for fptr_secret
+    rewind(encInfo -> fptr_secret);
+
+    //--resume, checkpoints fall on secret byte boundaries from here
+    if(encInfo -> journal != NULL && (start = resume_secret_file_data(encInfo)) < 0)
+    {
+        return e_failure;
+    }
+
+    //Run the loop  encInfo -> size_secret_file times
+    for(long i = start; i < encInfo -> size_secret_file; i++)
+    {
+        //Read 1 byte from secret file
+        fread(&ch, 1, 1, encInfo -> fptr_secret);
+
+        //Encrypt it on the way in (--key)
+        if(encInfo -> stego_flags & STEGO_FLAG_CIPHER)
+        {
+            chacha20_xor(&encInfo -> cipher, (unsigned char *)&ch, 1);
+        }
+        
+        //Read 8 bytes from source image
+        fread(arr, 1, 8, encInfo -> fptr_src_image);
+
+        /* Encode a byte into LSB of image data array */
+        if((encode_byte_to_lsb(ch, arr)) == e_success)
+        {
+            //Write the 8 bytes to stego image
+            fwrite(arr, 1, 8, encInfo -> fptr_stego_image);
+        }
+        else
+        {
+            return e_failure;
+        }
+    }
+    return e_success;  
+}
+
+/* Skip to the last checkpoint of an interrupted run */
+/*Everything before the secret data has just been written
+  again, so all streams move to the checkpoint offset: secret
+  byte (offset - data start) / 8, or past the data when the
+  run stopped while copying the rest of the image.
+  Returns the first secret byte to encode, -1 on error*/
+long resume_secret_file_data(EncodeInfo *encInfo)
+{
+    long origin = ftell(encInfo -> fptr_stego_image);
+    long offset = encInfo -> journal -> rec.offset;
+    long start;
+
+    journal_set_origin(encInfo -> journal, origin, 8);
+    if(!encInfo -> journal -> resuming)
+    {
+        return 0;
+    }
+
+    start = (offset - origin) / 8;
+    if(start > encInfo -> size_secret_file)
+    {
+        start = encInfo -> size_secret_file;
+    }
+
+    if(offset < origin || journal_resume(encInfo -> journal, encInfo -> fptr_stego_image) == e_failure ||
+       fseek(encInfo -> fptr_src_image, offset, SEEK_SET) != 0 ||
+       fseek(encInfo -> fptr_secret, start, SEEK_SET) != 0)
+    {
+        printf("Error: Unable to resume at byte %ld\n", offset);
+        return -1;
+    }
+
+    if(encInfo -> stego_flags & STEGO_FLAG_CIPHER)
+    {
+        chacha20_seek(&encInfo -> cipher, 1, start);
+    }
+
+    return start;
+}
+
+/* Copy remaining image bytes from src to stego image after encoding */
+/*After encoding the secret message,
+there’s still unused image data left the rest of the BMP image pixels
+This function simply copies all the leftover bytes
+from the source image to the stego image*/
+Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest)
+{ 
+   size_t block = tune_block_size();
+   char *buffer = malloc(block);
+   size_t n;
+   Status ret = e_success;
+
+   if(buffer == NULL)
+   {
+        printf("Error: Out of memory\n");
+        return e_failure;
+   }
+
+   //read and write remaining data a block at a time
+   while((n = fread(buffer, 1, block, fptr_src)) > 0)
+   {
+        if(fwrite(buffer, 1, n, fptr_dest) != n)
+        {
+            ret = e_failure;
+            break;
+        }
+   }
+
+   free(buffer);
+   return ret;
+}
+
+/* Encode header flags (extended format only) */
+/*Stores the 32-bit flags word right after MAGIC_STRING_EXT,
+  one bit per image byte like the other ints*/
+Status encode_stego_flags(uint flags, EncodeInfo *encInfo)
+{
+    char arr[32];
+
+    fread(arr, 1, 32, encInfo->fptr_src_image);
+
+    if((encode_int_to_lsb(flags, arr)) == e_success)
+    {
+        fwrite(arr, 1, 32, encInfo->fptr_stego_image);
+        return e_success;
+    }
+    return e_failure;
+}
+
+/* Encode flags word and the fields the flags ask for */
+/*Extended header layout after MAGIC_STRING_EXT:
+  flags, then nonce + key check if STEGO_FLAG_CIPHER,
+  then parity count + payload length if STEGO_FLAG_ECC*/
+Status encode_stego_header(EncodeInfo *encInfo)
+{
+    if((encode_stego_flags(encInfo->stego_flags, encInfo)) == e_failure)
+    {
+        return e_failure;
+    }
+
+    if(encInfo->stego_flags & STEGO_FLAG_CIPHER)
+    {
+        if((encode_cipher_header(encInfo)) == e_failure)
+        {
+            return e_failure;
+        }
+    }
+
+    if(encInfo->stego_flags & STEGO_FLAG_ECC)
+    {
+        return encode_ecc_header(encInfo);
+    }
+
+    return e_success;
+}
+
+/* Encode nonce and key check, set up the cipher */
+/*A fresh random nonce is stored as three ints, followed by
+  the first keystream word so the decoder can tell a wrong key.
+  Secret data is then encrypted from keystream block 1 on,
+  byte by byte inside encode_secret_file_data().*/
+Status encode_cipher_header(EncodeInfo *encInfo)
+{
+    unsigned char key[CHACHA_KEY_SIZE];
+    unsigned char nonce[CHACHA_NONCE_SIZE];
+    unsigned char check[4] = {0};
+    char arr[32];
+
+    //a resumed run must reproduce the keystream of the first one
+    if(encInfo->journal != NULL && encInfo->journal->resuming)
+    {
+        memcpy(nonce, encInfo->journal->rec.nonce, sizeof(nonce));
+    }
+    else if(getrandom(nonce, sizeof(nonce), 0) != sizeof(nonce))
+    {
+        perror("getrandom");
+        return e_failure;
+    }
+    if(encInfo->journal != NULL)
+    {
+        memcpy(encInfo->journal->rec.nonce, nonce, sizeof(nonce));
+    }
+
+    chacha20_key_from_string(encInfo->opts.key, key);
+    chacha20_init(&encInfo->cipher, key, nonce, 0);
+    chacha20_xor(&encInfo->cipher, check, sizeof(check));
+
+    for(int i = 0; i < CHACHA_NONCE_SIZE + 4; i += 4)
+    {
+        const unsigned char *p = i < CHACHA_NONCE_SIZE ? nonce + i : check;
+        int word = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint)p[3] << 24);
+
+        fread(arr, 1, 32, encInfo->fptr_src_image);
+        encode_int_to_lsb(word, arr);
+        fwrite(arr, 1, 32, encInfo->fptr_stego_image);
+    }
+
+    chacha20_init(&encInfo->cipher, key, nonce, 1);
+    memset(key, 0, sizeof(key));
+
+    return e_success;
+}
+
+/* Encode ECC parameters */
+/*Parity count and uncoded payload length, each written
+  ECC_HEADER_COPIES times since the header itself is not
+  coded, the decoder takes a bitwise majority*/
+Status encode_ecc_header(EncodeInfo *encInfo)
+{
+    int fields[2];
+    char arr[32];
+
+    fields[0] = encInfo->opts.ecc_parity;
+    fields[1] = sizeof(int) + MAX_FILE_SUFFIX + sizeof(int) + encInfo->size_secret_file;
+
+    for(int i = 0; i < 2 * ECC_HEADER_COPIES; i++)
+    {
+        fread(arr, 1, 32, encInfo->fptr_src_image);
+        encode_int_to_lsb(fields[i / ECC_HEADER_COPIES], arr);
+        fwrite(arr, 1, 32, encInfo->fptr_stego_image);
+    }
+
+    return e_success;
+}
+
+/* Encode the payload through Reed-Solomon */
+/*The same fields as encode_secret_payload() (big endian ints,
+  data encrypted if --key) are gathered in memory, coded by
+  ecc_encode() and the coded block is hidden byte by byte.
+  The block is interleaved across codewords, so a damaged run
+  of pixels costs each codeword only a few symbols.*/
+Status encode_ecc_payload(EncodeInfo *encInfo)
+{
+    long len = sizeof(int) + MAX_FILE_SUFFIX + sizeof(int) + encInfo->size_secret_file;
+    long coded_len = ecc_encoded_size(len, encInfo->opts.ecc_parity);
+    unsigned char *payload = malloc(len);
+    unsigned char *coded = malloc(coded_len);
+    char arr[8 * 512];
+    Status ret = e_failure;
+
+    if(payload == NULL || coded == NULL)
+    {
+        printf("Error: Out of memory for ECC payload\n");
+        free(payload);
+        free(coded);
+        return e_failure;
+    }
+
+    for(int i = 0; i < 4; i++)
+    {
+        payload[i] = (unsigned int)strlen(encInfo->extn_secret_file) >> (24 - 8 * i);
+        payload[8 + i] = (unsigned long)encInfo->size_secret_file >> (24 - 8 * i);
+    }
+    memcpy(payload + 4, encInfo->extn_secret_file, MAX_FILE_SUFFIX);
+
+    rewind(encInfo->fptr_secret);
+    if(fread(payload + 12, 1, encInfo->size_secret_file, encInfo->fptr_secret) == (size_t)encInfo->size_secret_file)
+    {
+        if(encInfo->stego_flags & STEGO_FLAG_CIPHER)
+        {
+            chacha20_xor(&encInfo->cipher, payload + 12, encInfo->size_secret_file);
+        }
+
+        if(ecc_encode(payload, len, encInfo->opts.ecc_parity, coded) == e_success)
+        {
+            ret = e_success;
+
+            //hide the coded block, 512 bytes per image read
+            for(long i = 0; i < coded_len && ret == e_success; i += 512)
+            {
+                long n = coded_len - i < 512 ? coded_len - i : 512;
+
+                if(fread(arr, 1, n * 8, encInfo->fptr_src_image) != (size_t)(n * 8))
+                {
+                    ret = e_failure;
+                    break;
+                }
+                for(long j = 0; j < n; j++)
+                {
+                    encode_byte_to_lsb(coded[i + j], arr + j * 8);
+                }
+                if(fwrite(arr, 1, n * 8, encInfo->fptr_stego_image) != (size_t)(n * 8))
+                {
+                    ret = e_failure;
+                }
+            }
+        }
+    }
+
+    free(payload);
+    free(coded);
+    return ret;
+}
+
+/* Encode extension, size and data of the secret file */
+/*Everything after the magic string (and flags) goes
+  through here, whatever streams the encoInfo points at*/
+Status encode_secret_payload(EncodeInfo *encInfo)
+{
+    if(encInfo->stego_flags & STEGO_FLAG_ECC)
+    {
+        return encode_ecc_payload(encInfo);
+    }
+
+    /* Encode extenstion size */
+    if((encode_secret_extn_file_size(MAX_FILE_SUFFIX, encInfo)) == e_success)
+    {
+        //printf("Encoded secret File extention Size Successfully...\n");
+        /* Encode secret file extenstion */
+        if((encode_secret_file_extn(encInfo -> extn_secret_file, encInfo)) == e_success)
+        {
+           // printf("Encoded secret File extention Successfully...\n");
+            //fixed size segments instead of the size field, see segment.h
+            if(encInfo -> stego_flags & STEGO_FLAG_SEGMENTED)
+            {
+                if(encInfo -> fptr_secret != stdin)
+                {
+                    rewind(encInfo -> fptr_secret);
+                }
+                return encode_segmented_data(encInfo);
+            }
+
+            /* Encode secret file size */
+            if((encode_secret_file_size(encInfo -> size_secret_file, encInfo)) == e_success)
+            {
+               // printf("secret File Size encoded Successfully...\n");
+                /* Encode secret file data*/
+                if((encode_secret_file_data(encInfo)) == e_success)
+                {
+                    //printf("File data encoded Successfully...\n");
+                    return e_success;
+                }
+            }
+        }
+    }
+    return e_failure;
+}
+
+/* Encode the payload spread over the image with the spread key */
+/*The rest of the cover is copied first, then the payload
+  is written through a spread stream which reorders the bytes
+  block by block. The normal field encoders are reused as is,
+  they just see the spread streams instead of the files.*/
+Status encode_spread_payload(EncodeInfo *encInfo)
+{
+    SpreadMap map;
+    FILE *fptr_src = encInfo->fptr_src_image;
+    FILE *fptr_stego = encInfo->fptr_stego_image;
+    long region_start = ftell(fptr_src);
+    long region_bytes = get_file_size(fptr_src) - region_start;
+    long payload_bytes = get_payload_size(encInfo) * 8;
+    Status ret;
+
+    if(spread_map_init(&map, spread_key_from_string(encInfo->opts.spread_key), region_start, region_bytes) == e_failure ||
+       payload_bytes > spread_capacity(&map))
+    {
+        printf("Capacity check failed\n");
+        return e_failure;
+    }
+
+    //copy the untouched cover first, payload blocks are patched in below
+    fseek(fptr_src, region_start, SEEK_SET);
+    if(copy_remaining_img_data(fptr_src, fptr_stego) == e_failure)
+    {
+        return e_failure;
+    }
+
+    encInfo->fptr_src_image = spread_open_reader(fptr_src, &map);
+    encInfo->fptr_stego_image = spread_open_writer(fptr_src, fptr_stego, &map);
+
+    if(encInfo->fptr_src_image == NULL || encInfo->fptr_stego_image == NULL)
+    {
+        ret = e_failure;
+    }
+    else
+    {
+        ret = encode_secret_payload(encInfo);
+    }
+
+    if(encInfo->fptr_src_image != NULL)
+        fclose(encInfo->fptr_src_image);
+    if(encInfo->fptr_stego_image != NULL && fclose(encInfo->fptr_stego_image) != 0)
+        ret = e_failure;
+
+    encInfo->fptr_src_image = fptr_src;
+    encInfo->fptr_stego_image = fptr_stego;
+
+    return ret;
+}
+
+/* Header flags for the requested options */
+void set_stego_flags(EncodeInfo *encInfo)
+{
+    encInfo->stego_flags = 0;
+    if(encInfo->opts.spread_key != NULL)
+    {
+        encInfo->stego_flags |= STEGO_FLAG_SPREAD;
+    }
+    if(encInfo->opts.key != NULL)
+    {
+        encInfo->stego_flags |= STEGO_FLAG_CIPHER;
+    }
+    if(encInfo->opts.ecc_parity != 0)
+    {
+        encInfo->stego_flags |= STEGO_FLAG_ECC;
+    }
+    if(encInfo->opts.segmented)
+    {
+        encInfo->stego_flags |= STEGO_FLAG_SEGMENTED;
+    }
+}
+
+/* Encode with the streams already open */
+/*Source image, secret and stego image streams are set up
+  (open_files() or in-memory streams from stego_async.hpp)
+  and the header flags are set*/
+Status encode_streams(EncodeInfo *encInfo)
+{
+    // Initialize file information, stdin has no size up front
+    encInfo->size_secret_file = encInfo->fptr_secret == stdin ? -1L : (long)get_file_size(encInfo->fptr_secret);
+    strcpy(encInfo->extn_secret_file, ".txt"); // file extension
+    
+    if(encInfo->size_secret_file < 0)
+        printf("Size of secret file: unknown, read as it arrives\n");
+    else
+        printf("Size of secret file: %ld bytes\n", encInfo->size_secret_file);
+
+    //video is cut into per-frame slices, see y4m.h
+    if(encInfo->image_format == e_y4m)
+    {
+        return y4m_encode(encInfo);
+    }
+   // printf("extension type: %s\n", encInfo->extn_secret_file);
+
+    if((check_capacity(encInfo)) == e_success)
+    {
+        //printf("Checking the capacity of file done...\n");
+        /* Copy bmp image header */
+        if((copy_bmp_header(encInfo -> fptr_src_image, encInfo -> fptr_stego_image)) == e_success)
+        {
+           // printf("Copied header successfully...\n");
+            /* Store Magic String, the extended one carries flags */
+            if((encode_magic_string(encInfo->stego_flags ? MAGIC_STRING_EXT : MAGIC_STRING, encInfo)) == e_success)
+            {
+                printf("Magic string uploaded...\n");
+                /* Encode header flags and their fields */
+                if(encInfo->stego_flags == 0 || (encode_stego_header(encInfo)) == e_success)
+                {
+                    if(encInfo->stego_flags & STEGO_FLAG_SPREAD)
+                    {
+                        if((encode_spread_payload(encInfo)) == e_success)
+                        {
+                            printf("Secret file data uploaded...!\n");
+                            return e_success;
+                        }
+                    }
+                    else if((encode_secret_payload(encInfo)) == e_success)
+                    {
+                        if((copy_remaining_img_data(encInfo -> fptr_src_image, encInfo -> fptr_stego_image)) == e_success)
+                        {
+                            printf("Secret file data uploaded...!\n");                                       
+                            if(encInfo -> journal != NULL)
+                            {
+                                encInfo -> journal -> complete = 1;
+                            }
+                            return e_success; 
+                        }
+                    }
+                }
+            }
+        }
+    }
+    else
+    {
+        printf("Capacity check failed\n");
+    }
+    return e_failure;
+}
+
+/* Perform the complete encoding */
+Status do_encoding(EncodeInfo *encInfo)
+{
+    // Header flags for the requested options
+    set_stego_flags(encInfo);
+
+    /* Get File pointers for i/p and o/p files */
+    if((open_files(encInfo)) == e_success)
+    {
+        printf("File Opened ready to encode...!\n");
+
+        return encode_streams(encInfo);
+    }
+    else
+    {
+        printf("Failed to open files\n");
+    }
+    return e_failure;
+}
@@ -1,90 +1,152 @@
-#ifndef ENCODE_H
-#define ENCODE_H
-#include <stdio.h>
-#include "types.h" // Contains user defined types
-
-/* 
- * Structure to store information required for
- * encoding secret file to source Image
- * Info about output and intermediate data is
- * also stored
- */
-
-#define MAX_SECRET_BUF_SIZE 1
-#define MAX_IMAGE_BUF_SIZE (MAX_SECRET_BUF_SIZE * 8)
-#define MAX_FILE_SUFFIX 4
-
-typedef struct _EncodeInfo
-{
-    /* Source Image info */
-    char *src_image_fname;
-    FILE *fptr_src_image;
-    uint image_capacity;
-    uint bits_per_pixel;
-    char image_data[MAX_IMAGE_BUF_SIZE];
-
-    /* Secret File Info */
-    char *secret_fname;  //store the secrete file name
-    FILE *fptr_secret;
-    char extn_secret_file[MAX_FILE_SUFFIX]; 
-    char secret_data[MAX_SECRET_BUF_SIZE];
-    long size_secret_file;
-
-    /* Stego Image Info */
-    char *stego_image_fname;
-    FILE *fptr_stego_image;
-
-} EncodeInfo;
-
-
-/* Encoding function prototype */
-
-/* Check operation type */
-OperationType check_operation_type(char *argv[]);
-
-/* Read and validate Encode args from argv */
-Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo);
-
-/* Perform the encoding */
-Status do_encoding(EncodeInfo *encInfo);
-
-/* Get File pointers for i/p and o/p files */
-Status open_files(EncodeInfo *encInfo);
-
-/* check capacity */
-Status check_capacity(EncodeInfo *encInfo);
-
-/* Get image size */
-uint get_image_size_for_bmp(FILE *fptr_image);
-
-/* Get file size */
-uint get_file_size(FILE *fptr);
-
-/* Copy bmp image header */
-Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image);
-
-/* Store Magic String */
-Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo);
-
-/* Encode extenstion size */
-Status encode_secret_extn_file_size(int size, EncodeInfo *encInfo);
-
-/* Encode secret file extenstion */
-Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo);
-
-/* Encode secret file size */
-Status encode_secret_file_size(long file_size, EncodeInfo *encInfo);
-
-/* Encode secret file data*/
-Status encode_secret_file_data(EncodeInfo *encInfo);
-
-/* Encode int into LSB*/
-Status encode_int_to_lsb(int size, char *image_buffer); 
-
-/* Encode a byte into LSB of image data array */
-Status encode_byte_to_lsb(char data, char *image_buffer); 
-
-/* Copy remaining image bytes from src to stego image after encoding */
-Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest);
-
-#endif
+#ifndef ENCODE_H
+#define ENCODE_H
+#include <stdio.h>
+#include "types.h" // Contains user defined types
+#include "cover_cache.h"
+#include "options.h"
+#include "chacha.h"
+#include "selfcheck.h"
+#include "journal.h"
+
+/* 
+ * Structure to store information required for
+ * encoding secret file to source Image
+ * Info about output and intermediate data is
+ * also stored
+ */
+
+#define MAX_SECRET_BUF_SIZE 1
+#define MAX_IMAGE_BUF_SIZE (MAX_SECRET_BUF_SIZE * 8)
+#define MAX_FILE_SUFFIX 4
+
+/* Hides one byte in the LSBs of 8 image bytes, MSB first */
+typedef void (*LsbKernel)(char data, char *image_buffer);
+
+typedef struct _EncodeInfo
+{
+    /* Source Image info */
+    char *src_image_fname;
+    FILE *fptr_src_image;
+    ImageFormat image_format;
+    uint image_capacity;
+    uint bits_per_pixel;
+    char image_data[MAX_IMAGE_BUF_SIZE];
+
+    /* Secret File Info */
+    char *secret_fname;  //store the secrete file name
+    FILE *fptr_secret;
+    char extn_secret_file[MAX_FILE_SUFFIX]; 
+    char secret_data[MAX_SECRET_BUF_SIZE];
+    long size_secret_file;
+
+    /* Stego Image Info */
+    char *stego_image_fname;
+    FILE *fptr_stego_image;
+
+    /* Optional switches and the header flags they map to */
+    StegoOptions opts;
+    uint stego_flags;
+    ChaCha20 cipher;    // keystream for --key
+    StegoCheck check;   // --self-check statistics
+    Journal *journal;   // --resume checkpoints, NULL when unused
+
+    /* Cover cache (batch mode), NULL when unused */
+    CoverCache *cover_cache;
+    CoverEntry *cover_entry;
+
+} EncodeInfo;
+
+
+/* Encoding function prototype */
+
+/* Check operation type */
+OperationType check_operation_type(char *argv[]);
+
+/* Read and validate Encode args from argv */
+Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo);
+
+/* Perform the encoding */
+Status do_encoding(EncodeInfo *encInfo);
+
+/* Encode with the streams already open */
+Status encode_streams(EncodeInfo *encInfo);
+
+/* Header flags for the requested options */
+void set_stego_flags(EncodeInfo *encInfo);
+
+/* Get File pointers for i/p and o/p files */
+Status open_files(EncodeInfo *encInfo);
+
+/* Close the files opened by open_files() */
+Status close_files(EncodeInfo *encInfo);
+
+/* check capacity */
+Status check_capacity(EncodeInfo *encInfo);
+
+/* Get image size */
+uint get_image_size_for_bmp(FILE *fptr_image);
+
+/* Get file size */
+uint get_file_size(FILE *fptr);
+
+/* Get payload size */
+long get_payload_size(EncodeInfo *encInfo);
+
+/* Copy bmp image header */
+Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image);
+
+/* Store Magic String */
+Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo);
+
+/* Encode header flags (extended format only) */
+Status encode_stego_flags(uint flags, EncodeInfo *encInfo);
+
+/* Encode flags word and the fields the flags ask for */
+Status encode_stego_header(EncodeInfo *encInfo);
+
+/* Encode nonce and key check, set up the cipher */
+Status encode_cipher_header(EncodeInfo *encInfo);
+
+/* Encode ECC parameters */
+Status encode_ecc_header(EncodeInfo *encInfo);
+
+/* Encode extension, size and data of the secret file */
+Status encode_secret_payload(EncodeInfo *encInfo);
+
+/* Encode the payload through Reed-Solomon */
+Status encode_ecc_payload(EncodeInfo *encInfo);
+
+/* Encode the payload spread over the image with the spread key */
+Status encode_spread_payload(EncodeInfo *encInfo);
+
+/* Encode extenstion size */
+Status encode_secret_extn_file_size(int size, EncodeInfo *encInfo);
+
+/* Encode secret file extenstion */
+Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo);
+
+/* Encode secret file size */
+Status encode_secret_file_size(long file_size, EncodeInfo *encInfo);
+
+/* Encode secret file data*/
+Status encode_secret_file_data(EncodeInfo *encInfo);
+
+/* Move the streams to the last --resume checkpoint */
+long resume_secret_file_data(EncodeInfo *encInfo);
+
+/* Encode int into LSB*/
+Status encode_int_to_lsb(int size, char *image_buffer); 
+
+/* Encode a byte into LSB of image data array */
+Status encode_byte_to_lsb(char data, char *image_buffer); 
+
+/* LSB kernel index, NULL past the last one */
+LsbKernel get_lsb_kernel(int index, const char **name);
+
+/* Use the named LSB kernel from now on (before any threads start) */
+Status set_lsb_kernel(const char *name);
+
+/* Copy remaining image bytes from src to stego image after encoding */
+Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest);
+
+#endif
@@ -0,0 +1,351 @@
+#define _GNU_SOURCE     // fopencookie
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "journal.h"
+#include "types.h"
+
+/* Function Definitions */
+
+/* Fill the identity part of a record from the input files */
+Status journal_identity(JournalRecord *rec, const char *src_fname, const char *secret_fname, uint32_t flags)
+{
+    struct stat st;
+
+    memset(rec, 0, sizeof(*rec));
+    rec->magic = JOURNAL_MAGIC;
+    rec->version = JOURNAL_VERSION;
+    rec->flags = flags;
+
+    if(stat(src_fname, &st) != 0)
+    {
+        perror("stat");
+        return e_failure;
+    }
+    rec->src_size = st.st_size;
+    rec->src_mtime = st.st_mtime;
+
+    if(secret_fname != NULL)
+    {
+        if(stat(secret_fname, &st) != 0)
+        {
+            perror("stat");
+            return e_failure;
+        }
+        rec->secret_size = st.st_size;
+        rec->secret_mtime = st.st_mtime;
+    }
+
+    return e_success;
+}
+
+/* CRC-32 of len part file bytes at offset */
+static Status crc_range(int fd, uint64_t offset, uint64_t len, uint32_t *crc)
+{
+    unsigned char buf[65536];
+
+    *crc = crc32(0L, Z_NULL, 0);
+    while(len > 0)
+    {
+        size_t want = len < sizeof(buf) ? len : sizeof(buf);
+        ssize_t n = pread(fd, buf, want, offset);
+
+        if(n <= 0)
+        {
+            return e_failure;
+        }
+        *crc = crc32(*crc, buf, n);
+        offset += n;
+        len -= n;
+    }
+
+    return e_success;
+}
+
+/* Is the saved checkpoint usable for this job
+ * Same inputs and flags, and the last interval of the part
+ * file still reads back with the CRC it was written with.
+ */
+static int checkpoint_valid(Journal *journal, const JournalRecord *saved)
+{
+    const JournalRecord *id = &journal->rec;
+    uint32_t crc;
+
+    if(saved->magic != JOURNAL_MAGIC || saved->version != JOURNAL_VERSION)
+        return 0;
+    if(saved->src_size != id->src_size || saved->src_mtime != id->src_mtime)
+        return 0;
+    if(saved->secret_size != id->secret_size || saved->secret_mtime != id->secret_mtime)
+        return 0;
+    if(saved->flags != id->flags || saved->prev_offset >= saved->offset)
+        return 0;
+
+    if(crc_range(journal->fd, saved->prev_offset, saved->offset - saved->prev_offset, &crc) == e_failure)
+        return 0;
+
+    return crc == saved->interval_crc;
+}
+
+/* Open <final>.part, resuming if <final>.journal matches rec */
+Status journal_open(Journal *journal, const char *final_fname, const JournalRecord *identity)
+{
+    JournalRecord saved;
+    FILE *fptr;
+
+    memset(journal, 0, sizeof(*journal));
+    journal->final_fname = final_fname;
+    journal->rec = *identity;
+    journal->crc = crc32(0L, Z_NULL, 0);
+    journal->interval_crc = journal->crc;
+
+    if(snprintf(journal->part_fname, PATH_MAX, "%s" JOURNAL_PART_SUFFIX, final_fname) >= PATH_MAX ||
+       snprintf(journal->journal_fname, PATH_MAX, "%s" JOURNAL_SUFFIX, final_fname) >= PATH_MAX)
+    {
+        printf("Error: Output name %s is too long\n", final_fname);
+        return e_failure;
+    }
+
+    //a part file without a readable journal is of no use
+    journal->fd = open(journal->part_fname, O_RDWR);
+    fptr = journal->fd < 0 ? NULL : fopen(journal->journal_fname, "r");
+    if(fptr != NULL)
+    {
+        if(fread(&saved, sizeof(saved), 1, fptr) == 1 && checkpoint_valid(journal, &saved))
+        {
+            journal->rec = saved;
+            journal->resuming = 1;
+        }
+        fclose(fptr);
+    }
+
+    if(journal->resuming)
+    {
+        printf("INFO: Resuming %s at byte %llu\n", final_fname, (unsigned long long)saved.offset);
+        return e_success;
+    }
+
+    if(journal->fd >= 0)
+    {
+        printf("INFO: No usable checkpoint for %s, starting over\n", final_fname);
+        close(journal->fd);
+    }
+    unlink(journal->journal_fname);
+    journal->fd = open(journal->part_fname, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(journal->fd < 0)
+    {
+        perror("open");
+        fprintf(stderr, "ERROR: Unable to open file %s\n", journal->part_fname);
+        return e_failure;
+    }
+
+    return e_success;
+}
+
+/* Make everything up to end durable and record it
+ * Data is synced before the journal names it, and the
+ * journal itself is replaced atomically.
+ */
+static Status write_checkpoint(Journal *journal)
+{
+    JournalRecord rec = journal->rec;
+    char tmp_fname[PATH_MAX + 8];
+    int fd;
+    Status ret = e_failure;
+
+    rec.prev_offset = journal->rec.offset;
+    rec.offset = journal->end;
+    rec.interval_crc = journal->interval_crc;
+    rec.crc = journal->crc;
+
+    snprintf(tmp_fname, sizeof(tmp_fname), "%s.tmp", journal->journal_fname);
+    if(fdatasync(journal->fd) != 0)
+    {
+        perror("fdatasync");
+        return e_failure;
+    }
+
+    fd = open(tmp_fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd >= 0)
+    {
+        if(write(fd, &rec, sizeof(rec)) == sizeof(rec) && fsync(fd) == 0)
+        {
+            ret = e_success;
+        }
+        close(fd);
+    }
+    if(ret == e_success && rename(tmp_fname, journal->journal_fname) != 0)
+    {
+        ret = e_failure;
+    }
+
+    if(ret == e_failure)
+    {
+        perror("journal");
+        unlink(tmp_fname);
+        return e_failure;
+    }
+
+    journal->rec = rec;
+    journal->interval_crc = crc32(0L, Z_NULL, 0);
+    return e_success;
+}
+
+/* Next offset a checkpoint may be taken at */
+static uint64_t next_checkpoint(const Journal *journal)
+{
+    uint64_t base = journal->rec.offset > journal->origin ? journal->rec.offset : journal->origin;
+    uint64_t next = base + JOURNAL_INTERVAL;
+
+    //round down onto the caller's grid, but always move forward
+    next -= (next - journal->origin) % journal->align;
+    if(next <= journal->rec.offset)
+        next += journal->align;
+
+    return next;
+}
+
+static ssize_t journal_write(void *cookie, const char *data, size_t size)
+{
+    Journal *journal = cookie;
+    size_t done = 0;
+
+    while(done < size)
+    {
+        ssize_t n = pwrite(journal->fd, data + done, size - done, journal->pos + done);
+
+        if(n <= 0)
+        {
+            perror("pwrite");
+            return -1;
+        }
+        done += n;
+    }
+
+    if(journal->pos != journal->end)
+    {
+        //not a plain append, the running CRC no longer holds
+        journal->broken = 1;
+    }
+
+    //CRC in pieces split at checkpoint offsets
+    for(done = 0; !journal->broken && done < size;)
+    {
+        size_t piece = size - done;
+        uint64_t next = journal->align ? next_checkpoint(journal) : UINT64_MAX;
+        uint32_t crc;
+
+        if(next - journal->end < piece)
+            piece = next - journal->end;
+
+        crc = crc32(0L, (const unsigned char *)data + done, piece);
+        journal->crc = crc32_combine(journal->crc, crc, piece);
+        journal->interval_crc = crc32_combine(journal->interval_crc, crc, piece);
+        journal->end += piece;
+        done += piece;
+
+        if(journal->end == next && write_checkpoint(journal) == e_failure)
+        {
+            return -1;
+        }
+    }
+
+    journal->pos += size;
+    if(journal->pos > journal->end)
+        journal->end = journal->pos;
+
+    return size;
+}
+
+static int journal_seek(void *cookie, off64_t *offset, int whence)
+{
+    Journal *journal = cookie;
+    off64_t pos = *offset;
+
+    if(whence == SEEK_CUR)
+        pos += journal->pos;
+    else if(whence == SEEK_END)
+        pos += journal->end;
+
+    if(pos < 0)
+    {
+        return -1;
+    }
+
+    journal->pos = pos;
+    *offset = pos;
+    return 0;
+}
+
+static int journal_stream_close(void *cookie)
+{
+    Journal *journal = cookie;
+
+    return fdatasync(journal->fd);
+}
+
+/* Write stream over the part file */
+FILE *journal_open_stream(Journal *journal)
+{
+    cookie_io_functions_t io = {NULL, journal_write, journal_seek, journal_stream_close};
+
+    return fopencookie(journal, "w", io);
+}
+
+/* Allow checkpoints at origin + k * align from now on */
+void journal_set_origin(Journal *journal, uint64_t origin, int align)
+{
+    journal->origin = origin;
+    journal->align = align;
+}
+
+/* Jump the stream to the last checkpoint
+ * Everything before the checkpoint has been written again
+ * or is taken as verified, so the running CRCs carry on
+ * from the saved ones.
+ */
+Status journal_resume(Journal *journal, FILE *fptr)
+{
+    if(fflush(fptr) != 0 || journal->broken || journal->end > journal->rec.offset)
+    {
+        return e_failure;
+    }
+
+    journal->end = journal->rec.offset;
+    journal->crc = journal->rec.crc;
+    journal->interval_crc = crc32(0L, Z_NULL, 0);
+    journal->resuming = 0;
+
+    return fseek(fptr, journal->rec.offset, SEEK_SET) == 0 ? e_success : e_failure;
+}
+
+/* Rename the part file into place if complete, free the journal */
+Status journal_close(Journal *journal)
+{
+    Status ret = e_success;
+
+    if(journal->complete)
+    {
+        //stale bytes past the end from an earlier, longer run
+        if(ftruncate(journal->fd, journal->end) != 0 || rename(journal->part_fname, journal->final_fname) != 0)
+        {
+            perror("journal");
+            ret = e_failure;
+        }
+        else
+        {
+            unlink(journal->journal_fname);
+        }
+    }
+    else
+    {
+        printf("INFO: Partial output kept in %s, run again with --resume\n", journal->part_fname);
+    }
+
+    close(journal->fd);
+    free(journal);
+    return ret;
+}
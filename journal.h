@@ -0,0 +1,95 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+#include "types.h" // Contains user defined types
+#include "chacha.h"
+
+/*
+ * Checkpoint journal for --resume.
+ * The output is written to <name>.part through a journal
+ * stream. Every JOURNAL_INTERVAL bytes the part file is
+ * synced and <name>.journal is replaced (write temp, rename)
+ * with the completed offset, a CRC-32 of the interval just
+ * finished and a running CRC-32 of the whole prefix.
+ * A restart with the same inputs checks the last interval
+ * against its CRC and carries on from that offset, so at
+ * most one interval of work is lost. Checkpoints are only
+ * taken at origin + k * align, where the caller can pick
+ * the work back up (8 image bytes per secret byte).
+ * On success the part file is renamed to <name>.
+ */
+
+#ifndef JOURNAL_INTERVAL
+#define JOURNAL_INTERVAL (64L << 20)    // output bytes between checkpoints
+#endif
+#define JOURNAL_MAGIC 0x4c4e524a        // "JRNL"
+#define JOURNAL_VERSION 1
+#define JOURNAL_PART_SUFFIX ".part"
+#define JOURNAL_SUFFIX ".journal"
+
+/* On-disk checkpoint, host byte order */
+typedef struct _JournalRecord
+{
+    uint32_t magic;
+    uint32_t version;
+
+    /* Job identity, a changed input means starting over */
+    uint64_t src_size;
+    int64_t src_mtime;
+    uint64_t secret_size;
+    int64_t secret_mtime;
+    uint32_t flags;
+    unsigned char nonce[CHACHA_NONCE_SIZE];    // --key nonce, reused on resume
+
+    /* Last checkpoint */
+    uint64_t offset;            // output bytes safely on disk
+    uint64_t prev_offset;       // checkpoint before it
+    uint32_t interval_crc;      // CRC-32 of [prev_offset, offset)
+    uint32_t crc;               // CRC-32 of [0, offset)
+
+} JournalRecord;
+
+typedef struct _Journal
+{
+    const char *final_fname;
+    char part_fname[PATH_MAX];
+    char journal_fname[PATH_MAX];
+    int fd;                     // part file
+    JournalRecord rec;          // identity and last checkpoint
+    int resuming;               // rec holds a verified checkpoint
+    int complete;               // output finished, rename on close
+
+    /* Stream state */
+    uint64_t pos;
+    uint64_t end;               // bytes written in order so far
+    uint32_t crc;               // CRC-32 of [0, end)
+    uint32_t interval_crc;      // CRC-32 of [rec.offset, end)
+    uint64_t origin;            // checkpoints at origin + k * align
+    int align;                  // 0 until the caller allows checkpoints
+    int broken;                 // written out of order, no more checkpoints
+
+} Journal;
+
+/* Journal function prototypes */
+
+/* Fill the identity part of a record from the input files */
+Status journal_identity(JournalRecord *rec, const char *src_fname, const char *secret_fname, uint32_t flags);
+
+/* Open <final>.part, resuming if <final>.journal matches rec */
+Status journal_open(Journal *journal, const char *final_fname, const JournalRecord *identity);
+
+/* Write stream over the part file */
+FILE *journal_open_stream(Journal *journal);
+
+/* Allow checkpoints at origin + k * align from now on */
+void journal_set_origin(Journal *journal, uint64_t origin, int align);
+
+/* Jump the stream to the last checkpoint */
+Status journal_resume(Journal *journal, FILE *fptr);
+
+/* Rename the part file into place if complete, free the journal */
+Status journal_close(Journal *journal);
+
+#endif
@@ -1,111 +1,304 @@
-#include <stdio.h>
-#include "encode.h"
-#include "decode.h"
-#include "types.h"
-#include <string.h>
-
-/* Check operation type */
-/*This function checks the command-line argument 
-  to identify which operation the user wants 
-  to perform encoding or decoding.argv[]=array of cmd lines*/
-OperationType check_operation_type(char *argv[])
-{
-    if(strcmp(argv[1], "-e") == 0)
-    {
-        return e_encode; //encoding
-    }
-    else if(strcmp(argv[1], "-d") == 0)
-    {
-        return e_decode;//decoding
-    }
-    else
-    {
-        return e_unsupported;//anyother than -e or -d
-    }
-}
-/*If argv[1] is "-e", it means user selected encoding
-  If argv[1] is "-d", it means user selected decoding
-  Otherwise,it returns unsupported operation type*/
-
-int main(int argc, char *argv[])
-{
-    EncodeInfo encInfo;  //structure variable
-    
-    int ret = check_operation_type(argv); 
-
-    if(ret == 0)
-    {
-        if(argc >= 4)
-        {
-            /* Read and validate Encode args from argv */
-            Status ret1 = read_and_validate_encode_args(argv, &encInfo);
-
-           if(ret1 == e_failure)
-           {
-                printf("Error: Invalid arguments for encoding\n");
-                return 0;
-           }
-           else
-           {
-                 /* Perform the encoding */
-                if(do_encoding(&encInfo) == e_success)
-                {
-                    printf("File Encoding completed successfully\n");
-                }
-                else
-                {
-                    printf("Encoding failed!\n");
-                }
-           }
-        }
-        else
-        {
-            printf("Error: Insufficient arguments for encoding\n");
-        }
-    }
-    else if(ret == 1)
-    {
-        DecodeInfo decInfo; 
-
-        if(argc >= 3)
-        {
-            /* Read and validate Decode args from argv */
-            Status ret2 = read_and_validate_decode_args(argv, &decInfo);
-
-            if(ret2 == e_failure)
-            {
-                printf("Error: Invalid arguments for decoding\n");
-                return 0;
-            }
-            else
-            {
-                if(do_decoding(&decInfo) == e_success)
-                {
-                    printf("Data Decoding completed successfully\n");
-                    return 0;
-                }
-                else
-                {
-                    printf("Decoding failed!\n");
-                    return 1;
-                }
-            }
-        }
-        else
-        {
-            return 1;
-        }
-    }
-    else
-    {
-        //Error messages
-        printf("Error: Unsupported operation\n");
-        printf("Use -e for encoding or -d for decoding\n");
-        return 0;
-    }
-
-    return 0;
-}
-/*his is the main function of the program.
-  It decides whether to perform encoding or decoding
+#include <stdio.h>
+#include "encode.h"
+#include "decode.h"
+#include "batch.h"
+#include "watch.h"
+#include "cover_index.h"
+#include "update.h"
+#include "broadcast.h"
+#include "tune.h"
+#include "types.h"
+#include <string.h>
+#include <stdlib.h>
+
+/* Check operation type */
+/*This function checks the command-line argument 
+  to identify which operation the user wants 
+  to perform encoding or decoding.argv[]=array of cmd lines*/
+OperationType check_operation_type(char *argv[])
+{
+    if(strcmp(argv[1], "-e") == 0)
+    {
+        return e_encode; //encoding
+    }
+    else if(strcmp(argv[1], "-d") == 0)
+    {
+        return e_decode;//decoding
+    }
+    else if(strcmp(argv[1], "-b") == 0)
+    {
+        return e_batch;//batch encoding
+    }
+    else if(strcmp(argv[1], "-w") == 0)
+    {
+        return e_watch;//hot-folder watch mode
+    }
+    else if(strcmp(argv[1], "-i") == 0)
+    {
+        return e_index;//build cover index
+    }
+    else if(strcmp(argv[1], "-q") == 0)
+    {
+        return e_query;//query cover index
+    }
+    else if(strcmp(argv[1], "-u") == 0)
+    {
+        return e_update;//in-place payload update
+    }
+    else if(strcmp(argv[1], "-m") == 0)
+    {
+        return e_broadcast;//one secret into many covers
+    }
+    else
+    {
+        return e_unsupported;//anyother than -e or -d
+    }
+}
+/*If argv[1] is "-e", it means user selected encoding
+  If argv[1] is "-d", it means user selected decoding
+  If argv[1] is "-b", it means user selected batch encoding
+  If argv[1] is "-w", it means user selected watch mode
+  If argv[1] is "-i" / "-q", it means user selected cover index update / query
+  If argv[1] is "-u", it means user selected updating a stego image in place
+  If argv[1] is "-m", it means user selected broadcasting one secret to many covers
+  Otherwise,it returns unsupported operation type*/
+
+int main(int argc, char *argv[])
+{
+    EncodeInfo encInfo = {0};  //structure variable
+    StegoOptions opts;
+
+    //strip --options, the rest are positional arguments
+    argc = parse_stego_options(argc, argv, &opts);
+    if(argc < 0)
+    {
+        return 1;
+    }
+    encInfo.opts = opts;
+
+    //host tuning saved by an earlier --autotune, defaults if there is none
+    tune_load();
+    if(opts.autotune)
+    {
+        //"--autotune [dir]" on its own only tunes
+        if(argc < 2 || argv[1][0] != '-')
+        {
+            return tune_run(argc >= 2 ? argv[1] : ".") == e_success ? 0 : 1;
+        }
+        if(tune_run(".") == e_failure)
+        {
+            return 1;
+        }
+    }
+    
+    int ret = check_operation_type(argv); 
+
+    if(ret == 0)
+    {
+        if(argc >= 4)
+        {
+            /* Read and validate Encode args from argv */
+            Status ret1 = read_and_validate_encode_args(argv, &encInfo);
+
+           if(ret1 == e_failure)
+           {
+                printf("Error: Invalid arguments for encoding\n");
+                return 0;
+           }
+           else
+           {
+                 /* Perform the encoding, closing finishes the stego image */
+                Status ret3 = do_encoding(&encInfo);
+                if(close_files(&encInfo) == e_failure)
+                {
+                    ret3 = e_failure;
+                }
+
+                if(ret3 == e_success)
+                {
+                    printf("File Encoding completed successfully\n");
+
+                    //steganalysis of what was just written
+                    if(encInfo.opts.self_check)
+                    {
+                        stego_check_report(&encInfo.check, stdout);
+                    }
+                }
+                else
+                {
+                    printf("Encoding failed!\n");
+                }
+           }
+        }
+        else
+        {
+            printf("Error: Insufficient arguments for encoding\n");
+        }
+    }
+    else if(ret == 1)
+    {
+        DecodeInfo decInfo = {0}; 
+        decInfo.opts = opts;
+
+        if(argc >= 3)
+        {
+            /* Read and validate Decode args from argv */
+            Status ret2 = read_and_validate_decode_args(argv, &decInfo);
+
+            if(ret2 == e_failure)
+            {
+                printf("Error: Invalid arguments for decoding\n");
+                return 0;
+            }
+            else
+            {
+                if(do_decoding(&decInfo) == e_success)
+                {
+                    printf("Data Decoding completed successfully\n");
+                    return 0;
+                }
+                else
+                {
+                    printf("Decoding failed!\n");
+                    return 1;
+                }
+            }
+        }
+        else
+        {
+            return 1;
+        }
+    }
+    else if(ret == e_batch)
+    {
+        if(argc >= 3)
+        {
+            //optional cover cache budget in MB
+            size_t budget = DEFAULT_COVER_CACHE_BUDGET;
+            if(argc >= 4)
+            {
+                budget = strtoul(argv[3], NULL, 10) * 1024 * 1024;
+            }
+
+            if(do_batch_encoding(argv[2], budget, &opts) == e_success)
+            {
+                return 0;
+            }
+            return 1;
+        }
+        else
+        {
+            printf("Error: Insufficient arguments for batch encoding\n");
+            return 1;
+        }
+    }
+    else if(ret == e_watch)
+    {
+        if(argc >= 5)
+        {
+            //optional worker count, default one per CPU
+            int workers = 0;
+            if(argc >= 6)
+            {
+                workers = atoi(argv[5]);
+            }
+
+            if(do_watch_encoding(argv[2], argv[3], argv[4], workers, &opts) == e_success)
+            {
+                return 0;
+            }
+            return 1;
+        }
+        else
+        {
+            printf("Error: Insufficient arguments for watch mode\n");
+            return 1;
+        }
+    }
+    else if(ret == e_index)
+    {
+        if(argc >= 3)
+        {
+            //index file defaults to one inside the cover directory
+            if(cover_index_update(argv[2], argc >= 4 ? argv[3] : NULL) == e_success)
+            {
+                return 0;
+            }
+            return 1;
+        }
+        else
+        {
+            printf("Error: Insufficient arguments for cover index\n");
+            return 1;
+        }
+    }
+    else if(ret == e_query)
+    {
+        if(argc >= 4)
+        {
+            if(cover_index_query(argv[2], strtol(argv[3], NULL, 10)) == e_success)
+            {
+                return 0;
+            }
+            return 1;
+        }
+        else
+        {
+            printf("Error: Insufficient arguments for cover query\n");
+            return 1;
+        }
+    }
+    else if(ret == e_update)
+    {
+        if(argc >= 4)
+        {
+            if(do_update(argv[2], argv[3], &opts) == e_success)
+            {
+                return 0;
+            }
+            return 1;
+        }
+        else
+        {
+            printf("Error: Insufficient arguments for update\n");
+            return 1;
+        }
+    }
+    else if(ret == e_broadcast)
+    {
+        if(argc >= 5)
+        {
+            //optional worker count, default one per CPU
+            int workers = 0;
+            if(argc >= 6)
+            {
+                workers = atoi(argv[5]);
+            }
+
+            if(do_broadcast_encoding(argv[2], argv[3], argv[4], workers, &opts) == e_success)
+            {
+                return 0;
+            }
+            return 1;
+        }
+        else
+        {
+            printf("Error: Insufficient arguments for broadcast\n");
+            return 1;
+        }
+    }
+    else
+    {
+        //Error messages
+        printf("Error: Unsupported operation\n");
+        printf("Use -e for encoding, -d for decoding, -b for batch encoding, -w for watch mode\n");
+        printf("-i / -q to build / query a cover index, -u to update a stego image\n");
+        printf("or -m to embed one secret into many covers\n");
+        return 0;
+    }
+
+    return 0;
+}
+/*his is the main function of the program.
+  It decides whether to perform encoding or decoding
    based on user input from the command line*/
\ No newline at end of file
@@ -0,0 +1,328 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "mem_budget.h"
+#include "ecc.h"
+#include "out_writer.h"
+#include "png.h"
+#include "segment.h"
+#include "tune.h"
+#include "y4m.h"
+#include "types.h"
+
+/* Function Definitions */
+
+/* Number in a cgroup file, 0 for "max" or a missing file */
+static size_t read_cgroup_value(const char *dir, const char *name)
+{
+    char path[2 * PATH_MAX];
+    char value[64];
+    FILE *fptr;
+    size_t ret = 0;
+
+    snprintf(path, sizeof(path), "%s%s/%s", MEM_BUDGET_CGROUP_ROOT, dir, name);
+    fptr = fopen(path, "r");
+    if(fptr == NULL)
+        return 0;
+
+    if(fgets(value, sizeof(value), fptr) != NULL && strncmp(value, "max", 3) != 0)
+        ret = strtoull(value, NULL, 10);
+
+    fclose(fptr);
+    return ret;
+}
+
+/* Bytes memory.max leaves above memory.current for this process's cgroup, 0 if unlimited */
+size_t mem_budget_cgroup_limit(void)
+{
+    FILE *fptr = fopen("/proc/self/cgroup", "r");
+    char line[PATH_MAX + 8];
+    char dir[PATH_MAX + 8] = "";
+    size_t limit = 0, current;
+    int found = 0;
+
+    if(fptr == NULL)
+        return 0;
+
+    //the v2 hierarchy is the "0::<path>" line
+    while(!found && fgets(line, sizeof(line), fptr) != NULL)
+    {
+        if(strncmp(line, "0::", 3) == 0)
+        {
+            line[strcspn(line, "\n")] = '\0';
+            snprintf(dir, sizeof(dir), "%s", line + 3);
+            found = 1;
+        }
+    }
+    fclose(fptr);
+    if(!found)
+        return 0;
+
+    current = read_cgroup_value(dir, "memory.current");
+
+    //a parent may be tighter than our own group
+    for(;;)
+    {
+        size_t max = read_cgroup_value(dir, "memory.max");
+        char *slash = strrchr(dir, '/');
+
+        if(max > 0 && (limit == 0 || max < limit))
+            limit = max;
+        if(slash == NULL)
+            break;
+        *slash = '\0';
+    }
+
+    if(limit == 0)
+        return 0;
+    return limit > current ? limit - current : 1;
+}
+
+/* Initialize with limit bytes, 0 works it out from the cgroup */
+Status mem_budget_init(MemBudget *budget, size_t limit)
+{
+    const char *source = "--mem-budget";
+
+    memset(budget, 0, sizeof(*budget));
+
+    if(limit == 0)
+    {
+        size_t free_bytes = mem_budget_cgroup_limit();
+
+        source = "cgroup memory.max";
+        if(free_bytes == 0)
+        {
+            free_bytes = (size_t)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+            source = "physical memory";
+        }
+        limit = free_bytes / 100 * MEM_BUDGET_SHARE;
+    }
+    budget->limit = limit;
+
+    if(pthread_mutex_init(&budget->lock, NULL) != 0)
+    {
+        return e_failure;
+    }
+    if(pthread_cond_init(&budget->cond, NULL) != 0)
+    {
+        pthread_mutex_destroy(&budget->lock);
+        return e_failure;
+    }
+
+    printf("INFO: Memory budget %zu MB (%s)\n", limit >> 20, source);
+    return e_success;
+}
+
+/* Workers an engine runs with, the tuned count up to max */
+static int engine_threads(int low_memory, int max)
+{
+    int n = low_memory ? 1 : tune_threads();
+
+    return n < 1 ? 1 : n > max ? max : n;
+}
+
+/* PNG row bytes (plus filter byte) or Y4M frame bytes of the cover, 0 if neither */
+static size_t cover_unit(const EncodeInfo *encInfo)
+{
+    unsigned char buf[PNG_SIGNATURE_SIZE + 8 + 13 + 4];
+    FILE *fptr;
+    PngInfo png_info;
+    Y4mInfo y4m_info;
+    size_t ret = 0;
+
+    if(encInfo->image_format != e_png && encInfo->image_format != e_y4m)
+        return 0;
+
+    fptr = fopen(encInfo->src_image_fname, "r");
+    if(fptr == NULL)
+        return 0;
+
+    //quiet parsers, the encode itself reports bad headers
+    if(encInfo->image_format == e_y4m)
+    {
+        if(y4m_parse_header(fptr, &y4m_info) == e_success)
+            ret = y4m_info.frame_size;
+    }
+    else if(fread(buf, 1, sizeof(buf), fptr) == sizeof(buf) && png_parse_ihdr(buf, sizeof(buf), &png_info) == e_success)
+    {
+        ret = (size_t)png_info.rowbytes + 1;
+    }
+
+    fclose(fptr);
+    return ret;
+}
+
+/* Row buffers, deflate bands and zlib state of a PNG reader and writer */
+static size_t png_working_set(size_t row, int low_memory)
+{
+    int n = engine_threads(low_memory, PNG_MAX_THREADS);
+    size_t band;
+
+    if(row == 0)
+        return 0;
+
+    //same band size as png_open_writer()
+    band = PNG_BAND_SIZE / row > 0 ? PNG_BAND_SIZE / row * row : row;
+
+    //reader: current and previous row, inflate; writer: rows, filter candidates, band in and out
+    return 2 * row + MEM_BUDGET_DEFLATE + 7 * row + n * (2 * band + MEM_BUDGET_DEFLATE);
+}
+
+/* Working set for a parsed cover, with the normal or the low memory engines */
+static size_t estimate(const EncodeInfo *encInfo, size_t unit, int low_memory)
+{
+    const StegoOptions *opts = &encInfo->opts;
+    int from_stdin = strcmp(encInfo->secret_fname, "-") == 0;
+    size_t bytes = MEM_BUDGET_JOB_BASE + tune_block_size();     // copy buffer of the remaining pixels
+    struct stat st;
+
+    if(encInfo->image_format == e_png)
+    {
+        bytes += png_working_set(unit, low_memory);
+    }
+    else if(encInfo->image_format == e_y4m)
+    {
+        //frames in flight and their slices
+        bytes += engine_threads(low_memory, Y4M_MAX_THREADS) * (unit + unit / 8);
+    }
+
+    //aligned block of the output writer, same rules as open_files()
+    if(encInfo->image_format != e_png && opts->spread_key == NULL && !opts->resume && !low_memory)
+    {
+        size_t block = tune_block_size() > OUT_WRITER_MIN_BLOCK ? tune_block_size() : OUT_WRITER_MIN_BLOCK;
+
+        bytes += (block + OUT_WRITER_ALIGN - 1) & ~(size_t)(OUT_WRITER_ALIGN - 1);
+    }
+
+    if(opts->segmented || from_stdin)
+    {
+        bytes += engine_threads(low_memory, SEGMENT_MAX_THREADS) * (SEGMENT_SIZE + 8 * SEGMENT_STRIDE);
+    }
+
+    //payload and coded block in memory, plus the parity rows of ecc_encode()
+    if(opts->ecc_parity > 0 && !from_stdin && stat(encInfo->secret_fname, &st) == 0)
+    {
+        long len = sizeof(int) + MAX_FILE_SUFFIX + sizeof(int) + st.st_size;
+        long k = (len + ECC_N - opts->ecc_parity - 1) / (ECC_N - opts->ecc_parity);
+
+        bytes += len + ecc_encoded_size(len, opts->ecc_parity) + (opts->ecc_parity + 1) * k;
+    }
+
+    return bytes;
+}
+
+/* Working sets of an encode job set up by read_and_validate_encode_args() */
+/*Only buffers that grow with the cover, the secret or the
+  worker count are counted, on top of a fixed
+  MEM_BUDGET_JOB_BASE. The cover header is read once for
+  both; one the estimate cannot read counts as nothing, the
+  job fails on it anyway.*/
+void mem_budget_estimate_encode(const EncodeInfo *encInfo, size_t *full, size_t *low)
+{
+    size_t unit = cover_unit(encInfo);
+
+    *low = estimate(encInfo, unit, 1);
+    *full = encInfo->opts.low_memory ? *low : estimate(encInfo, unit, 0);
+}
+
+/* Wait until the job fits and reserve it, returns the bytes reserved */
+/*Tickets keep admission in arrival order: only the oldest
+  waiting job may take room, so a stream of small jobs can not
+  keep a big one out forever. Whoever is admitted wakes the
+  others, the next in line may fit as well.*/
+size_t mem_budget_reserve(MemBudget *budget, size_t full, size_t low, int *low_memory)
+{
+    unsigned long ticket;
+    size_t bytes = 0;
+    int waited = 0;
+
+    if(low > full)
+        low = full;
+    *low_memory = 0;
+
+    pthread_mutex_lock(&budget->lock);
+    ticket = budget->next_ticket++;
+
+    for(;;)
+    {
+        size_t room = budget->reserved < budget->limit ? budget->limit - budget->reserved : 0;
+
+        if(ticket == budget->serving)
+        {
+            if(full <= room)
+            {
+                bytes = full;
+                break;
+            }
+            if(low <= room)
+            {
+                bytes = low;
+                *low_memory = 1;
+                break;
+            }
+
+            //larger than the whole budget, run it alone
+            if(budget->reserved == 0)
+            {
+                bytes = low;
+                *low_memory = low < full;
+                budget->oversize++;
+                break;
+            }
+        }
+
+        if(!waited)
+        {
+            waited = 1;
+            budget->queued++;
+            budget->waiting++;
+        }
+        pthread_cond_wait(&budget->cond, &budget->lock);
+    }
+
+    if(waited)
+        budget->waiting--;
+    budget->serving++;
+    budget->reserved += bytes;
+    budget->running++;
+    budget->admitted++;
+    if(*low_memory)
+        budget->low_memory++;
+    if(budget->reserved > budget->peak)
+        budget->peak = budget->reserved;
+
+    pthread_cond_broadcast(&budget->cond);
+    pthread_mutex_unlock(&budget->lock);
+    return bytes;
+}
+
+/* Give back bytes from mem_budget_reserve() */
+void mem_budget_release(MemBudget *budget, size_t bytes)
+{
+    pthread_mutex_lock(&budget->lock);
+    budget->reserved -= bytes;
+    budget->running--;
+    pthread_cond_broadcast(&budget->cond);
+    pthread_mutex_unlock(&budget->lock);
+}
+
+/* Print reservations, queue depth and counters */
+void mem_budget_print_stats(MemBudget *budget, FILE *fptr)
+{
+    pthread_mutex_lock(&budget->lock);
+    fprintf(fptr, "Memory budget: reserved=%zu/%zu bytes peak=%zu running=%d waiting=%d "
+            "admitted=%lu low-memory=%lu queued=%lu oversize=%lu\n",
+            budget->reserved, budget->limit, budget->peak, budget->running, budget->waiting,
+            budget->admitted, budget->low_memory, budget->queued, budget->oversize);
+    pthread_mutex_unlock(&budget->lock);
+}
+
+/* Free the lock and condition */
+void mem_budget_destroy(MemBudget *budget)
+{
+    pthread_mutex_destroy(&budget->lock);
+    pthread_cond_destroy(&budget->cond);
+}
@@ -0,0 +1,82 @@
+#ifndef MEM_BUDGET_H
+#define MEM_BUDGET_H
+#include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "types.h" // Contains user defined types
+#include "encode.h"
+
+/*
+ * Memory admission control for jobs running side by side in
+ * one process (watch and batch mode).
+ * The budget is MEM_BUDGET_SHARE percent of what the cgroup
+ * v2 memory.max (tightest of this cgroup and its parents)
+ * leaves above the usage at start up, or of physical memory
+ * outside a limited cgroup; --mem-budget MB sets it instead.
+ * Before a job runs it reserves its estimated working set,
+ * worked out from the cover header and the engines the job
+ * will use (PNG deflate bands, Y4M frames, segments, ECC
+ * blocks, output buffer). A job that does not fit falls back
+ * to the --low-memory engines (one worker, small buffers) if
+ * that fits, otherwise it waits its turn; jobs are admitted
+ * in arrival order so big ones are not starved. A job larger
+ * than the whole budget runs once nothing else is reserved.
+ * Cover cache mappings are clean file pages the kernel can
+ * reclaim and are not counted.
+ */
+
+#define MEM_BUDGET_SHARE 80                 // percent of the free limit handed to jobs
+#define MEM_BUDGET_JOB_BASE (256UL * 1024)  // EncodeInfo, stdio buffers, stream state
+#define MEM_BUDGET_DEFLATE (384UL * 1024)   // zlib state and slack per deflate band
+#define MEM_BUDGET_CGROUP_ROOT "/sys/fs/cgroup"
+
+typedef struct _MemBudget
+{
+    size_t limit;       // bytes jobs may hold reserved
+    size_t reserved;    // bytes held by running jobs
+    int running;
+    int waiting;        // queue depth
+
+    /* Arrival order, the job holding serving is admitted next */
+    unsigned long next_ticket;
+    unsigned long serving;
+
+    pthread_mutex_t lock;   // guards everything above and the stats
+    pthread_cond_t cond;
+
+    /* Stats */
+    size_t peak;
+    unsigned long admitted;
+    unsigned long low_memory;   // ran on the low memory engines to fit
+    unsigned long queued;       // had to wait
+    unsigned long oversize;     // larger than the whole budget
+
+} MemBudget;
+
+/* Memory budget function prototypes */
+
+/* Bytes memory.max leaves above memory.current for this process's cgroup, 0 if unlimited */
+size_t mem_budget_cgroup_limit(void);
+
+/* Initialize with limit bytes, 0 works it out from the cgroup */
+Status mem_budget_init(MemBudget *budget, size_t limit);
+
+/* Working sets of an encode job set up by read_and_validate_encode_args(),
+ * full with the normal engines and low with the --low-memory ones */
+void mem_budget_estimate_encode(const EncodeInfo *encInfo, size_t *full, size_t *low);
+
+/* Wait until the job fits and reserve it, returns the bytes reserved
+ * full is the working set of the normal engines, low that of the
+ * low memory ones, *low_memory is set when they have to be used */
+size_t mem_budget_reserve(MemBudget *budget, size_t full, size_t low, int *low_memory);
+
+/* Give back bytes from mem_budget_reserve() */
+void mem_budget_release(MemBudget *budget, size_t bytes);
+
+/* Print reservations, queue depth and counters */
+void mem_budget_print_stats(MemBudget *budget, FILE *fptr);
+
+/* Free the lock and condition */
+void mem_budget_destroy(MemBudget *budget);
+
+#endif
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "options.h"
+#include "types.h"
+#include "ecc.h"
+
+/* Function Definitions */
+
+/* Pull known options out of argv, returns new argc or -1 on error
+ * Remaining arguments are shifted down and argv stays
+ * NULL terminated, so positional checks like argv[4] == NULL
+ * keep working.
+ */
+int parse_stego_options(int argc, char *argv[], StegoOptions *opts)
+{
+    int out = 0;
+
+    memset(opts, 0, sizeof(*opts));
+
+    for(int i = 0; i < argc; i++)
+    {
+        if(strncmp(argv[i], "--", 2) != 0)
+        {
+            argv[out++] = argv[i];  //positional argument, keep it
+            continue;
+        }
+
+        if(strcmp(argv[i], "--spread") == 0)
+        {
+            if(i + 1 >= argc)
+            {
+                printf("Error: --spread needs a key\n");
+                return -1;
+            }
+            opts->spread_key = argv[++i];
+        }
+        else if(strcmp(argv[i], "--key") == 0)
+        {
+            if(i + 1 >= argc)
+            {
+                printf("Error: --key needs a key\n");
+                return -1;
+            }
+            opts->key = argv[++i];
+        }
+        else if(strcmp(argv[i], "--self-check") == 0)
+        {
+            opts->self_check = 1;
+        }
+        else if(strcmp(argv[i], "--resume") == 0)
+        {
+            opts->resume = 1;
+        }
+        else if(strcmp(argv[i], "--segmented") == 0)
+        {
+            opts->segmented = 1;
+        }
+        else if(strcmp(argv[i], "--direct") == 0)
+        {
+            opts->direct = 1;
+        }
+        else if(strcmp(argv[i], "--autotune") == 0)
+        {
+            opts->autotune = 1;
+        }
+        else if(strcmp(argv[i], "--low-memory") == 0)
+        {
+            opts->low_memory = 1;
+        }
+        else if(strcmp(argv[i], "--mem-budget") == 0)
+        {
+            char *end;
+
+            if(i + 1 >= argc)
+            {
+                printf("Error: --mem-budget needs a size in MB\n");
+                return -1;
+            }
+            opts->mem_budget = strtoul(argv[++i], &end, 10) * 1024 * 1024;
+            if(*end != '\0' || opts->mem_budget == 0)
+            {
+                printf("Error: --mem-budget takes a size in MB\n");
+                return -1;
+            }
+        }
+        else if(strcmp(argv[i], "--ecc") == 0)
+        {
+            char *end;
+
+            if(i + 1 >= argc)
+            {
+                printf("Error: --ecc needs a parity count\n");
+                return -1;
+            }
+            opts->ecc_parity = strtol(argv[++i], &end, 10);
+            if(*end != '\0' || opts->ecc_parity < ECC_MIN_PARITY || opts->ecc_parity > ECC_MAX_PARITY)
+            {
+                printf("Error: --ecc takes %d to %d parity bytes\n", ECC_MIN_PARITY, ECC_MAX_PARITY);
+                return -1;
+            }
+        }
+        else
+        {
+            printf("Error: Unknown option %s\n", argv[i]);
+            return -1;
+        }
+    }
+
+    argv[out] = NULL;
+    return out;
+}
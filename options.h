@@ -0,0 +1,34 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+#include <stddef.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Optional "--name value" switches (and plain "--name"
+ * flags) accepted after the
+ * normal positional arguments of -e / -d / -b.
+ * They are removed from argv before the positional
+ * arguments are validated.
+ */
+
+typedef struct _StegoOptions
+{
+    char *spread_key;   // --spread KEY, keyed pixel spreading
+    char *key;          // --key KEY, encrypt the secret data
+    int ecc_parity;     // --ecc N, Reed-Solomon parity bytes per 255, 0 if off
+    int self_check;     // --self-check, run steganalysis on the stego image
+    int resume;         // --resume, checkpoint the output and continue an interrupted run
+    int segmented;      // --segmented, data in checksummed segments, implied by secret "-"
+    int direct;         // --direct, O_DIRECT output, inputs dropped from the page cache
+    int autotune;       // --autotune, benchmark this host and cache the tuning
+    int low_memory;     // --low-memory, one PNG band / Y4M frame / segment worker, no output writer buffer
+    size_t mem_budget;  // --mem-budget MB, memory for concurrent jobs, 0 reads the cgroup limit
+
+} StegoOptions;
+
+/* Options function prototypes */
+
+/* Pull known options out of argv, returns new argc or -1 on error */
+int parse_stego_options(int argc, char *argv[], StegoOptions *opts);
+
+#endif
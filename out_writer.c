@@ -0,0 +1,213 @@
+#define _GNU_SOURCE     // fopencookie, O_DIRECT, fallocate, sync_file_range
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "out_writer.h"
+#include "types.h"
+#include "tune.h"
+
+typedef struct _OutWriter
+{
+    int fd;
+    int direct;             // opened O_DIRECT
+    int drop_behind;        // --direct without O_DIRECT, write back and drop each block
+    unsigned char *buf;     // OUT_WRITER_ALIGN aligned
+    size_t block;           // multiple of OUT_WRITER_ALIGN
+    size_t fill;            // bytes in buf
+    off_t off;              // file offset of buf
+    int failed;
+
+} OutWriter;
+
+/* Function Definitions */
+
+/* Write the buffered block, len is fill rounded as the mode needs */
+static int flush_block(OutWriter *writer, size_t len)
+{
+    size_t done = 0;
+
+    while(done < len)
+    {
+        ssize_t n = pwrite(writer->fd, writer->buf + done, len - done, writer->off + done);
+
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+        {
+            perror("pwrite");
+            writer->failed = 1;
+            return -1;
+        }
+        done += n;
+    }
+
+    //start writeback of this block, wait for the one before and drop it
+    if(writer->drop_behind)
+    {
+        sync_file_range(writer->fd, writer->off, len, SYNC_FILE_RANGE_WRITE);
+        if(writer->off >= (off_t)writer->block)
+        {
+            off_t prev = writer->off - writer->block;
+
+            sync_file_range(writer->fd, prev, writer->block,
+                            SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+            posix_fadvise(writer->fd, prev, writer->block, POSIX_FADV_DONTNEED);
+        }
+    }
+
+    writer->off += writer->fill;
+    writer->fill = 0;
+    return 0;
+}
+
+static ssize_t writer_write(void *cookie, const char *data, size_t len)
+{
+    OutWriter *writer = cookie;
+    size_t done = 0;
+
+    if(writer->failed)
+        return -1;
+
+    while(done < len)
+    {
+        size_t n = writer->block - writer->fill;
+
+        if(n > len - done)
+            n = len - done;
+        memcpy(writer->buf + writer->fill, data + done, n);
+        writer->fill += n;
+        done += n;
+
+        if(writer->fill == writer->block && flush_block(writer, writer->block) < 0)
+            return -1;
+    }
+    return len;
+}
+
+/* Only the current position can be asked for (ftell) */
+static int writer_seek(void *cookie, off64_t *offset, int whence)
+{
+    OutWriter *writer = cookie;
+    off_t pos = writer->off + writer->fill;
+
+    if((whence == SEEK_CUR && *offset == 0) || (whence == SEEK_SET && *offset == pos))
+    {
+        *offset = pos;
+        return 0;
+    }
+
+    errno = ESPIPE;
+    return -1;
+}
+
+/* Write the tail, trim padding and preallocated space past the end */
+static int writer_close(void *cookie)
+{
+    OutWriter *writer = cookie;
+    off_t end = writer->off + writer->fill;
+    int ret = writer->failed ? -1 : 0;
+
+    if(ret == 0 && writer->fill > 0)
+    {
+        size_t len = writer->fill;
+
+        //O_DIRECT lengths must be aligned, the padding is cut off below
+        if(writer->direct)
+        {
+            len = (len + OUT_WRITER_ALIGN - 1) & ~(size_t)(OUT_WRITER_ALIGN - 1);
+            memset(writer->buf + writer->fill, 0, len - writer->fill);
+        }
+        ret = flush_block(writer, len);
+    }
+
+    if(ftruncate(writer->fd, end) != 0)
+    {
+        perror("ftruncate");
+        ret = -1;
+    }
+    if(writer->drop_behind && ret == 0 && fdatasync(writer->fd) == 0)
+    {
+        posix_fadvise(writer->fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+    if(close(writer->fd) != 0)
+    {
+        perror("close");
+        ret = -1;
+    }
+
+    free(writer->buf);
+    free(writer);
+    return ret;
+}
+
+/* Create fname for size bytes of output, direct asks for O_DIRECT */
+FILE *out_writer_open(const char *fname, off_t size, int direct)
+{
+    cookie_io_functions_t io = {NULL, writer_write, writer_seek, writer_close};
+    OutWriter *writer = calloc(1, sizeof(OutWriter));
+    FILE *fptr;
+    void *buf = NULL;
+
+    if(writer == NULL)
+        return NULL;
+
+    //tuned block size, rounded up to whole pages
+    writer->block = tune_block_size();
+    if(writer->block < OUT_WRITER_MIN_BLOCK)
+        writer->block = OUT_WRITER_MIN_BLOCK;
+    writer->block = (writer->block + OUT_WRITER_ALIGN - 1) & ~(size_t)(OUT_WRITER_ALIGN - 1);
+
+    writer->fd = -1;
+    if(direct)
+    {
+        writer->fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+        writer->direct = writer->fd >= 0;
+        writer->drop_behind = writer->fd < 0;
+    }
+    if(writer->fd < 0)
+    {
+        writer->fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+
+    if(writer->fd < 0 || posix_memalign(&buf, OUT_WRITER_ALIGN, writer->block) != 0)
+    {
+        if(writer->fd >= 0)
+            close(writer->fd);
+        free(writer);
+        return NULL;
+    }
+    writer->buf = buf;
+
+    //one allocation up front, not supported everywhere and not needed
+    if(size > 0 && fallocate(writer->fd, FALLOC_FL_KEEP_SIZE, 0, size) != 0 &&
+       errno != EOPNOTSUPP && errno != ENOSYS)
+    {
+        perror("fallocate");
+    }
+
+    fptr = fopencookie(writer, "w", io);
+    if(fptr == NULL)
+    {
+        close(writer->fd);
+        free(writer->buf);
+        free(writer);
+        return NULL;
+    }
+
+    return fptr;
+}
+
+/* Drop a fully read input from the page cache */
+void out_writer_drop_input(FILE *fptr)
+{
+    int fd = fileno(fptr);
+
+    //cookie streams (cover cache, PNG reader) have no fd of their own
+    if(fd >= 0)
+    {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef OUT_WRITER_H
+#define OUT_WRITER_H
+#include <stdio.h>
+#include <sys/types.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Output stream for stego images whose final size is known
+ * up front (BMP and Y4M, same size as the cover).
+ * The file is preallocated in one go with fallocate() so it
+ * gets a few large extents instead of growing one small
+ * write at a time, and data goes out in page-aligned blocks
+ * of the tuned block size (at least OUT_WRITER_MIN_BLOCK)
+ * from an aligned buffer.
+ * With --direct the file is opened O_DIRECT, so batch runs
+ * do not fill the page cache with outputs nobody re-reads;
+ * the last block is padded and the file truncated back.
+ * Where O_DIRECT is refused (tmpfs, some network file
+ * systems) blocks are written back as they complete and
+ * dropped from the cache with posix_fadvise(DONTNEED).
+ * The stream only goes forward, so it is not used for
+ * --spread, --resume or PNG output.
+ */
+
+#define OUT_WRITER_ALIGN 4096               // O_DIRECT buffer, offset and length alignment
+#define OUT_WRITER_MIN_BLOCK (256 * 1024)
+
+/* Output writer function prototypes */
+
+/* Create fname for size bytes of output, direct asks for O_DIRECT */
+FILE *out_writer_open(const char *fname, off_t size, int direct);
+
+/* Drop a fully read input from the page cache */
+void out_writer_drop_input(FILE *fptr);
+
+#endif
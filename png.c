@@ -0,0 +1,802 @@
+#define _GNU_SOURCE     // fopencookie
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <zlib.h>
+#include "png.h"
+#include "common.h"
+#include "types.h"
+#include "tune.h"
+
+/* Function Definitions */
+
+static const unsigned char png_signature[PNG_SIGNATURE_SIZE] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+
+/* Read a big endian word */
+static uint32_t get_be32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/* Store a big endian word */
+static void put_be32(unsigned char *p, uint32_t value)
+{
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+/* Store a little endian word (BMP header fields) */
+static void put_le32(unsigned char *p, uint32_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+/* Tell cover format from the file name */
+ImageFormat get_image_format(const char *fname)
+{
+    if(strstr(fname, ".png") != NULL)
+    {
+        return e_png;
+    }
+    if(strstr(fname, ".y4m") != NULL)
+    {
+        return e_y4m;
+    }
+    return e_bmp;
+}
+
+/* Parse signature + IHDR at the start of a PNG file */
+Status png_parse_ihdr(const unsigned char *data, size_t len, PngInfo *info)
+{
+    const unsigned char *ihdr = data + PNG_SIGNATURE_SIZE + 8;
+    static const uint channels[7] = {1, 0, 3, 0, 2, 0, 4};
+
+    if(len < PNG_SIGNATURE_SIZE + 8 + 13 ||
+       memcmp(data, png_signature, PNG_SIGNATURE_SIZE) != 0 ||
+       get_be32(data + PNG_SIGNATURE_SIZE) != 13 ||
+       memcmp(data + PNG_SIGNATURE_SIZE + 4, "IHDR", 4) != 0)
+    {
+        fprintf(stderr, "ERROR: Not a PNG image\n");
+        return e_failure;
+    }
+
+    info->width = get_be32(ihdr);
+    info->height = get_be32(ihdr + 4);
+
+    //bit depth 8, no palette, no interlace
+    if(ihdr[8] != 8 || ihdr[9] > 6 || channels[ihdr[9]] == 0 || ihdr[12] != 0 ||
+       info->width == 0 || info->height == 0)
+    {
+        fprintf(stderr, "ERROR: Only 8-bit non-interlaced gray/RGB(A) PNG images are supported\n");
+        return e_failure;
+    }
+
+    info->channels = channels[ihdr[9]];
+    info->rowbytes = info->width * info->channels;
+
+    return e_success;
+}
+
+/* Read signature and IHDR chunk from a file into info */
+static Status read_ihdr(FILE *fptr, unsigned char *buf, PngInfo *info)
+{
+    if(fread(buf, 1, PNG_SIGNATURE_SIZE + 8 + 13 + 4, fptr) != PNG_SIGNATURE_SIZE + 8 + 13 + 4)
+    {
+        fprintf(stderr, "ERROR: Not a PNG image\n");
+        return e_failure;
+    }
+    return png_parse_ihdr(buf, PNG_SIGNATURE_SIZE + 8 + 13 + 4, info);
+}
+
+/* Undo the PNG filter of one row in place */
+static void unfilter_row(unsigned char filter, unsigned char *line, const unsigned char *prior, uint len, uint bpp)
+{
+    for(uint i = 0; i < len; i++)
+    {
+        int a = i >= bpp ? line[i - bpp] : 0;
+        int b = prior[i];
+        int c = i >= bpp ? prior[i - bpp] : 0;
+
+        switch(filter)
+        {
+            case 1:
+                line[i] += a;
+                break;
+            case 2:
+                line[i] += b;
+                break;
+            case 3:
+                line[i] += (a + b) >> 1;
+                break;
+            case 4:
+            {
+                int p = a + b - c;
+                int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+                line[i] += (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+}
+
+/* State behind a PNG reader stream */
+typedef struct _PngReader
+{
+    FILE *fptr;
+    PngInfo info;
+    z_stream zs;
+    uint32_t idat_left;     // bytes left in the current IDAT chunk
+    unsigned char header[BMP_HEADER_SIZE];
+    unsigned char *cur;     // filter byte + current row
+    unsigned char *prev;    // filter byte + previous row
+    long row;               // row held in cur, -1 if none
+    long pos;               // logical offset
+    long size;              // header + all rows
+    unsigned char in[PNG_IO_SIZE];
+
+} PngReader;
+
+/* Give inflate more compressed bytes, stepping over IDAT chunks */
+static int feed_input(PngReader *reader)
+{
+    unsigned char hdr[8];
+    size_t n;
+
+    while(reader->idat_left == 0)
+    {
+        //CRC of the finished chunk, then next chunk header
+        if(fread(hdr, 1, 4, reader->fptr) != 4 || fread(hdr, 1, 8, reader->fptr) != 8 ||
+           memcmp(hdr + 4, "IDAT", 4) != 0)
+        {
+            return -1;  //image data ended early
+        }
+        reader->idat_left = get_be32(hdr);
+    }
+
+    n = reader->idat_left < PNG_IO_SIZE ? reader->idat_left : PNG_IO_SIZE;
+    if(fread(reader->in, 1, n, reader->fptr) != n)
+    {
+        return -1;
+    }
+
+    reader->idat_left -= n;
+    reader->zs.next_in = reader->in;
+    reader->zs.avail_in = n;
+
+    return 0;
+}
+
+/* Inflate and unfilter the next row into cur */
+static int next_row(PngReader *reader)
+{
+    unsigned char *tmp = reader->prev;
+    reader->prev = reader->cur;
+    reader->cur = tmp;
+
+    reader->zs.next_out = reader->cur;
+    reader->zs.avail_out = reader->info.rowbytes + 1;
+
+    while(reader->zs.avail_out > 0)
+    {
+        int ret;
+
+        if(reader->zs.avail_in == 0 && feed_input(reader) != 0)
+        {
+            return -1;
+        }
+
+        ret = inflate(&reader->zs, Z_NO_FLUSH);
+        if(ret == Z_STREAM_END && reader->zs.avail_out > 0)
+        {
+            return -1;
+        }
+        if(ret != Z_OK && ret != Z_STREAM_END)
+        {
+            return -1;
+        }
+    }
+
+    unfilter_row(reader->cur[0], reader->cur + 1, reader->prev + 1, reader->info.rowbytes, reader->info.channels);
+    reader->row++;
+
+    return 0;
+}
+
+static ssize_t png_read(void *cookie, char *data, size_t size)
+{
+    PngReader *reader = cookie;
+    size_t n = 0;
+
+    while(n < size && reader->pos < reader->size)
+    {
+        size_t count;
+
+        if(reader->pos < BMP_HEADER_SIZE)
+        {
+            count = BMP_HEADER_SIZE - reader->pos;
+            if(count > size - n)
+                count = size - n;
+            memcpy(data + n, reader->header + reader->pos, count);
+        }
+        else
+        {
+            long row = (reader->pos - BMP_HEADER_SIZE) / reader->info.rowbytes;
+            long col = (reader->pos - BMP_HEADER_SIZE) % reader->info.rowbytes;
+
+            if(row < reader->row)
+            {
+                return -1;  //rows already gone, stream is forward only
+            }
+            while(reader->row < row)
+            {
+                if(next_row(reader) != 0)
+                {
+                    fprintf(stderr, "ERROR: Corrupt PNG image data\n");
+                    return -1;
+                }
+            }
+
+            count = reader->info.rowbytes - col;
+            if(count > size - n)
+                count = size - n;
+            memcpy(data + n, reader->cur + 1 + col, count);
+        }
+
+        n += count;
+        reader->pos += count;
+    }
+
+    return n;
+}
+
+static int png_reader_seek(void *cookie, off64_t *offset, int whence)
+{
+    PngReader *reader = cookie;
+    long target = *offset;
+
+    if(whence == SEEK_CUR)
+        target += reader->pos;
+    else if(whence == SEEK_END)
+        target += reader->size;
+
+    if(target < 0 || target > reader->size)
+    {
+        return -1;
+    }
+
+    reader->pos = target;
+    *offset = target;
+    return 0;
+}
+
+static int png_reader_close(void *cookie)
+{
+    PngReader *reader = cookie;
+
+    inflateEnd(&reader->zs);
+    fclose(reader->fptr);
+    free(reader->cur);
+    free(reader->prev);
+    free(reader);
+
+    return 0;
+}
+
+/* Stream of BMP style header + raw rows read from a PNG file */
+FILE *png_open_reader(FILE *fptr, PngInfo *info)
+{
+    cookie_io_functions_t io = {png_read, NULL, png_reader_seek, png_reader_close};
+    unsigned char buf[PNG_SIGNATURE_SIZE + 8 + 13 + 4];
+    unsigned char hdr[8];
+    PngReader *reader;
+    FILE *stream;
+
+    reader = calloc(1, sizeof(*reader));
+    if(reader == NULL || read_ihdr(fptr, buf, &reader->info) == e_failure)
+    {
+        free(reader);
+        fclose(fptr);
+        return NULL;
+    }
+
+    //skip ancillary chunks up to the first IDAT
+    while(fread(hdr, 1, 8, fptr) == 8 && memcmp(hdr + 4, "IDAT", 4) != 0)
+    {
+        fseek(fptr, get_be32(hdr) + 4, SEEK_CUR);
+    }
+    if(memcmp(hdr + 4, "IDAT", 4) != 0)
+    {
+        fprintf(stderr, "ERROR: PNG image has no image data\n");
+        free(reader);
+        fclose(fptr);
+        return NULL;
+    }
+
+    reader->fptr = fptr;
+    reader->idat_left = get_be32(hdr);
+    reader->cur = calloc(1, reader->info.rowbytes + 1);
+    reader->prev = calloc(1, reader->info.rowbytes + 1);
+    reader->row = -1;
+    reader->size = BMP_HEADER_SIZE + (long)reader->info.rowbytes * reader->info.height;
+
+    //BMP look-alike header, only size, width, height and depth matter
+    reader->header[0] = 'B';
+    reader->header[1] = 'M';
+    put_le32(reader->header + 2, reader->size);
+    put_le32(reader->header + 10, BMP_HEADER_SIZE);
+    put_le32(reader->header + 14, 40);
+    put_le32(reader->header + 18, reader->info.width);
+    put_le32(reader->header + 22, reader->info.height);
+    reader->header[26] = 1;
+    reader->header[28] = reader->info.channels * 8;
+
+    if(reader->cur == NULL || reader->prev == NULL || inflateInit(&reader->zs) != Z_OK)
+    {
+        png_reader_close(reader);
+        return NULL;
+    }
+
+    stream = fopencookie(reader, "r", io);
+    if(stream == NULL)
+    {
+        png_reader_close(reader);
+        return NULL;
+    }
+
+    //no stdio read-ahead, so seeking back within the current row works
+    setvbuf(stream, NULL, _IONBF, 0);
+
+    *info = reader->info;
+    return stream;
+}
+
+/* One deflate band, compressed on its own thread */
+typedef struct _PngBand
+{
+    unsigned char *in;
+    size_t in_len;
+    int finish;         // last band of the image
+    unsigned char *out;
+    size_t out_len;
+    uLong adler;
+    int ok;
+
+} PngBand;
+
+/* Raw-deflate a band, ending byte aligned so bands can be joined */
+static void *deflate_band(void *arg)
+{
+    PngBand *band = arg;
+    z_stream zs;
+    size_t cap;
+
+    memset(&zs, 0, sizeof(zs));
+    band->ok = 0;
+    band->adler = adler32(adler32(0, NULL, 0), band->in, band->in_len);
+
+    if(deflateInit2(&zs, PNG_DEFLATE_LEVEL, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        return NULL;
+    }
+
+    cap = deflateBound(&zs, band->in_len) + 64;
+    band->out = malloc(cap);
+    if(band->out != NULL)
+    {
+        int ret;
+
+        zs.next_in = band->in;
+        zs.avail_in = band->in_len;
+        zs.next_out = band->out;
+        zs.avail_out = cap;
+
+        ret = deflate(&zs, band->finish ? Z_FINISH : Z_SYNC_FLUSH);
+        band->out_len = cap - zs.avail_out;
+        band->ok = band->finish ? ret == Z_STREAM_END : (ret == Z_OK && zs.avail_in == 0);
+    }
+
+    deflateEnd(&zs);
+    return NULL;
+}
+
+/* State behind a PNG writer stream */
+typedef struct _PngWriter
+{
+    FILE *fptr;
+    FILE *fptr_cover;
+    PngInfo info;
+    long pos;               // logical offset
+    unsigned char *row;     // raw row being filled
+    unsigned char *prev;    // previous raw row
+    unsigned char *filt;    // 5 filter candidates
+    uint row_fill;
+    uint rows;
+    int nthreads;
+    int nbands;             // full bands waiting to be deflated
+    size_t band_cap;
+    unsigned char *band[PNG_MAX_THREADS];
+    size_t band_len[PNG_MAX_THREADS];
+    uLong adler;
+    int started;            // zlib header written
+    int failed;
+    uint32_t first_idat;    // length of the cover's first IDAT chunk
+
+} PngWriter;
+
+/* Write one chunk made of up to three pieces */
+static int write_chunk(FILE *fptr, const char *type, const unsigned char *a, size_t a_len,
+                       const unsigned char *b, size_t b_len, const unsigned char *c, size_t c_len)
+{
+    unsigned char hdr[8], crc[4];
+    uLong sum = crc32(0, (const Bytef *)type, 4);
+
+    sum = crc32(sum, a, a_len);
+    sum = crc32(sum, b, b_len);
+    sum = crc32(sum, c, c_len);
+
+    put_be32(hdr, a_len + b_len + c_len);
+    memcpy(hdr + 4, type, 4);
+    put_be32(crc, sum);
+
+    if(fwrite(hdr, 1, 8, fptr) != 8 || fwrite(a, 1, a_len, fptr) != a_len ||
+       fwrite(b, 1, b_len, fptr) != b_len || fwrite(c, 1, c_len, fptr) != c_len ||
+       fwrite(crc, 1, 4, fptr) != 4)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/* Copy one chunk (header already read) from cover to output */
+static int copy_chunk(PngWriter *writer, const unsigned char *hdr)
+{
+    uint32_t left = get_be32(hdr) + 4;
+    unsigned char buf[PNG_IO_SIZE];
+
+    if(fwrite(hdr, 1, 8, writer->fptr) != 8)
+        return -1;
+
+    while(left > 0)
+    {
+        size_t n = left < sizeof(buf) ? left : sizeof(buf);
+        if(fread(buf, 1, n, writer->fptr_cover) != n || fwrite(buf, 1, n, writer->fptr) != n)
+            return -1;
+        left -= n;
+    }
+    return 0;
+}
+
+/* Deflate the waiting bands in parallel and write them as IDAT chunks */
+static int flush_bands(PngWriter *writer, int finish)
+{
+    static const unsigned char zlib_header[2] = {0x78, 0x9C};
+    PngBand bands[PNG_MAX_THREADS];
+    pthread_t threads[PNG_MAX_THREADS];
+    int threaded[PNG_MAX_THREADS] = {0};
+    int n = writer->nbands;
+    int ret = 0;
+
+    //the band being filled goes too, an empty one still ends the stream
+    if(finish && (writer->band_len[n] > 0 || n == 0))
+    {
+        n++;
+    }
+
+    for(int i = 0; i < n; i++)
+    {
+        bands[i].in = writer->band[i];
+        bands[i].in_len = writer->band_len[i];
+        bands[i].finish = finish && i == n - 1;
+        bands[i].out = NULL;
+    }
+
+    if(n == 1)
+    {
+        deflate_band(&bands[0]);
+    }
+    else
+    {
+        for(int i = 0; i < n; i++)
+        {
+            threaded[i] = pthread_create(&threads[i], NULL, deflate_band, &bands[i]) == 0;
+            if(!threaded[i])
+            {
+                deflate_band(&bands[i]);
+            }
+        }
+        for(int i = 0; i < n; i++)
+        {
+            if(threaded[i])
+                pthread_join(threads[i], NULL);
+        }
+    }
+
+    for(int i = 0; i < n; i++)
+    {
+        unsigned char trailer[4];
+
+        writer->adler = adler32_combine(writer->adler, bands[i].adler, bands[i].in_len);
+        put_be32(trailer, writer->adler);
+
+        if(ret == 0 &&
+           (!bands[i].ok ||
+            write_chunk(writer->fptr, "IDAT",
+                        zlib_header, writer->started ? 0 : 2,
+                        bands[i].out, bands[i].out_len,
+                        trailer, bands[i].finish ? 4 : 0) != 0))
+        {
+            ret = -1;
+        }
+
+        writer->started = 1;
+        writer->band_len[i] = 0;
+        free(bands[i].out);
+    }
+
+    writer->nbands = 0;
+
+    return ret;
+}
+
+/* Filter a full row with the smallest sum of absolute values heuristic */
+static void filter_row(PngWriter *writer, unsigned char *out)
+{
+    uint len = writer->info.rowbytes;
+    uint bpp = writer->info.channels;
+    const unsigned char *line = writer->row;
+    const unsigned char *prior = writer->prev;
+    unsigned long best_sum = (unsigned long)-1;
+    int best = 0;
+
+    for(int filter = 0; filter < 5; filter++)
+    {
+        unsigned char *cand = writer->filt + filter * len;
+        unsigned long sum = 0;
+
+        for(uint i = 0; i < len; i++)
+        {
+            int a = i >= bpp ? line[i - bpp] : 0;
+            int b = prior[i];
+            int c = i >= bpp ? prior[i - bpp] : 0;
+            int pred = 0;
+
+            switch(filter)
+            {
+                case 1: pred = a; break;
+                case 2: pred = b; break;
+                case 3: pred = (a + b) >> 1; break;
+                case 4:
+                {
+                    int p = a + b - c;
+                    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+                    pred = (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+                    break;
+                }
+            }
+
+            cand[i] = line[i] - pred;
+            sum += abs((signed char)cand[i]);
+        }
+
+        if(sum < best_sum)
+        {
+            best_sum = sum;
+            best = filter;
+        }
+    }
+
+    out[0] = best;
+    memcpy(out + 1, writer->filt + best * len, len);
+}
+
+/* Move a finished row into the current band */
+static int finish_row(PngWriter *writer)
+{
+    size_t *len = &writer->band_len[writer->nbands];
+    unsigned char *tmp;
+
+    filter_row(writer, writer->band[writer->nbands] + *len);
+    *len += writer->info.rowbytes + 1;
+
+    tmp = writer->prev;
+    writer->prev = writer->row;
+    writer->row = tmp;
+    writer->row_fill = 0;
+    writer->rows++;
+
+    if(*len + writer->info.rowbytes + 1 > writer->band_cap)
+    {
+        writer->nbands++;
+        if(writer->nbands == writer->nthreads)
+        {
+            return flush_bands(writer, 0);
+        }
+    }
+    return 0;
+}
+
+static ssize_t png_write(void *cookie, const char *data, size_t size)
+{
+    PngWriter *writer = cookie;
+    size_t n = 0;
+
+    //header bytes are dropped, the cover's own chunks are kept
+    if(writer->pos < BMP_HEADER_SIZE)
+    {
+        n = BMP_HEADER_SIZE - writer->pos;
+        if(n > size)
+            n = size;
+        writer->pos += n;
+    }
+
+    while(n < size && writer->rows < writer->info.height && !writer->failed)
+    {
+        size_t count = writer->info.rowbytes - writer->row_fill;
+        if(count > size - n)
+            count = size - n;
+
+        memcpy(writer->row + writer->row_fill, data + n, count);
+        writer->row_fill += count;
+        writer->pos += count;
+        n += count;
+
+        if(writer->row_fill == writer->info.rowbytes && finish_row(writer) != 0)
+        {
+            writer->failed = 1;
+        }
+    }
+
+    if(writer->failed)
+    {
+        return -1;
+    }
+    return n;
+}
+
+static int png_writer_seek(void *cookie, off64_t *offset, int whence)
+{
+    PngWriter *writer = cookie;
+
+    //only ftell() is supported
+    if(whence == SEEK_CUR && *offset == 0)
+    {
+        *offset = writer->pos;
+        return 0;
+    }
+    return -1;
+}
+
+/* Free everything the writer owns */
+static void free_writer(PngWriter *writer)
+{
+    for(int i = 0; i < PNG_MAX_THREADS; i++)
+    {
+        free(writer->band[i]);
+    }
+    free(writer->row);
+    free(writer->prev);
+    free(writer->filt);
+    free(writer);
+}
+
+static int png_writer_close(void *cookie)
+{
+    PngWriter *writer = cookie;
+    unsigned char hdr[8];
+    int ret = -1;
+
+    if(!writer->failed && writer->rows == writer->info.height && flush_bands(writer, 1) == 0)
+    {
+        ret = 0;
+
+        //cover is right after its first IDAT header, copy what follows the IDATs
+        fseek(writer->fptr_cover, (long)writer->first_idat + 4, SEEK_CUR);
+        while(ret == 0 && fread(hdr, 1, 8, writer->fptr_cover) == 8)
+        {
+            if(memcmp(hdr + 4, "IDAT", 4) == 0)
+            {
+                fseek(writer->fptr_cover, get_be32(hdr) + 4, SEEK_CUR);
+                continue;
+            }
+            ret = copy_chunk(writer, hdr);
+            if(memcmp(hdr + 4, "IEND", 4) == 0)
+                break;
+        }
+    }
+    else
+    {
+        fprintf(stderr, "ERROR: Incomplete PNG image data\n");
+    }
+
+    if(fclose(writer->fptr) != 0)
+        ret = -1;
+    fclose(writer->fptr_cover);
+    free_writer(writer);
+
+    return ret;
+}
+
+/* Stream that writes header + raw rows out as a PNG file */
+FILE *png_open_writer(FILE *fptr, FILE *fptr_cover, int nthreads)
+{
+    cookie_io_functions_t io = {NULL, png_write, png_writer_seek, png_writer_close};
+    unsigned char buf[PNG_SIGNATURE_SIZE + 8 + 13 + 4];
+    unsigned char hdr[8];
+    PngWriter *writer;
+    FILE *stream;
+    long rows_per_band;
+
+    writer = calloc(1, sizeof(*writer));
+    if(writer == NULL || read_ihdr(fptr_cover, buf, &writer->info) == e_failure)
+    {
+        free(writer);
+        fclose(fptr);
+        fclose(fptr_cover);
+        return NULL;
+    }
+
+    writer->fptr = fptr;
+    writer->fptr_cover = fptr_cover;
+    writer->adler = adler32(0, NULL, 0);
+
+    writer->nthreads = nthreads > 0 ? nthreads : tune_threads();
+    if(writer->nthreads < 1)
+        writer->nthreads = 1;
+    if(writer->nthreads > PNG_MAX_THREADS)
+        writer->nthreads = PNG_MAX_THREADS;
+
+    rows_per_band = PNG_BAND_SIZE / (writer->info.rowbytes + 1);
+    if(rows_per_band < 1)
+        rows_per_band = 1;
+    writer->band_cap = rows_per_band * (writer->info.rowbytes + 1);
+
+    writer->row = calloc(1, writer->info.rowbytes);
+    writer->prev = calloc(1, writer->info.rowbytes);
+    writer->filt = malloc(5 * (size_t)writer->info.rowbytes + 4);
+    for(int i = 0; i < writer->nthreads; i++)
+    {
+        writer->band[i] = malloc(writer->band_cap);
+        if(writer->band[i] == NULL)
+            writer->failed = 1;
+    }
+
+    //signature, IHDR and every chunk before the image data
+    fwrite(buf, 1, sizeof(buf), fptr);
+    while(fread(hdr, 1, 8, fptr_cover) == 8 && memcmp(hdr + 4, "IDAT", 4) != 0)
+    {
+        if(copy_chunk(writer, hdr) != 0)
+            writer->failed = 1;
+    }
+
+    if(writer->row == NULL || writer->prev == NULL || writer->filt == NULL ||
+       writer->failed || memcmp(hdr + 4, "IDAT", 4) != 0)
+    {
+        fclose(fptr);
+        fclose(fptr_cover);
+        free_writer(writer);
+        return NULL;
+    }
+
+    //remember the first IDAT length to skip it on close
+    writer->first_idat = get_be32(hdr);
+
+    stream = fopencookie(writer, "w", io);
+    if(stream == NULL)
+    {
+        fclose(fptr);
+        fclose(fptr_cover);
+        free_writer(writer);
+    }
+
+    return stream;
+}
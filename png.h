@@ -0,0 +1,52 @@
+#ifndef PNG_H
+#define PNG_H
+#include <stdio.h>
+#include <stddef.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Native PNG covers.
+ * A PNG reader stream looks like a BMP to the rest of
+ * the code: a BMP_HEADER_SIZE byte header holding width
+ * and height, then the raw (unfiltered) rows top to bottom.
+ * Rows are inflated and unfiltered as they are read.
+ * A PNG writer stream takes the same layout, filters the
+ * rows and deflates row bands on several threads.
+ * Only 8-bit, non-interlaced gray / RGB / alpha images are
+ * supported, LSB changes in palette indices would show.
+ */
+
+#define PNG_SIGNATURE_SIZE 8
+#define PNG_IO_SIZE 65536
+#define PNG_BAND_SIZE (1 << 20)     // filtered bytes per deflate band
+#define PNG_MAX_THREADS 8
+#define PNG_DEFLATE_LEVEL 6
+
+typedef struct _PngInfo
+{
+    uint width;
+    uint height;
+    uint channels;  // bytes per pixel
+    uint rowbytes;  // width * channels
+
+} PngInfo;
+
+/* PNG function prototypes */
+
+/* Tell cover format from the file name */
+ImageFormat get_image_format(const char *fname);
+
+/* Parse signature + IHDR at the start of a PNG file */
+Status png_parse_ihdr(const unsigned char *data, size_t len, PngInfo *info);
+
+/* Stream of BMP style header + raw rows read from a PNG file,
+ * takes ownership of fptr. Forward only, apart from the header
+ * and the current row. */
+FILE *png_open_reader(FILE *fptr, PngInfo *info);
+
+/* Stream that writes header + raw rows out as a PNG file,
+ * non pixel chunks are copied from fptr_cover. Takes ownership
+ * of both files. nthreads deflate workers, 0 for the tuned count. */
+FILE *png_open_writer(FILE *fptr, FILE *fptr_cover, int nthreads);
+
+#endif
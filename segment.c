@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <zlib.h>
+#include "segment.h"
+#include "common.h"
+#include "chacha.h"
+#include "tune.h"
+#include "types.h"
+
+typedef struct _Segment
+{
+    long index;
+    uint length;                // data bytes
+    int last;
+    int damaged;                // decode: header or CRC did not check out
+    unsigned char *data;        // SEGMENT_SIZE bytes
+    char *pixels;               // 8 * SEGMENT_STRIDE image bytes
+    size_t npixels;             // image bytes read
+    const ChaCha20 *cipher;     // NULL without --key
+    pthread_t thread;
+
+} Segment;
+
+/* Function Definitions */
+
+/* Payload bytes after the extension fields for size secret bytes */
+long segmented_payload_size(long size)
+{
+    long full = size / SEGMENT_SIZE;
+
+    //the last segment may be empty, it still carries the end flag
+    return (full + 1) * SEGMENT_HEADER + size;
+}
+
+/* CRC-32 over the header ints (big endian) and the stored data */
+static uint32_t segment_crc(long index, uint field, const unsigned char *data, uint length)
+{
+    unsigned char header[8];
+
+    for(int i = 0; i < 4; i++)
+    {
+        header[i] = (uint)index >> (24 - 8 * i);
+        header[4 + i] = field >> (24 - 8 * i);
+    }
+    return crc32(crc32(crc32(0, NULL, 0), header, 8), data, length);
+}
+
+/* Keystream for segment data starts at index * SEGMENT_SIZE */
+static void segment_xor(const Segment *seg)
+{
+    ChaCha20 cipher = *seg->cipher;
+
+    chacha20_seek(&cipher, 1, (uint64_t)seg->index * SEGMENT_SIZE);
+    chacha20_xor(&cipher, seg->data, seg->length);
+    memset(&cipher, 0, sizeof(cipher));
+}
+
+static void *encode_segment(void *arg)
+{
+    Segment *seg = arg;
+    uint field = seg->length | (seg->last ? SEGMENT_LAST : 0);
+
+    if(seg->cipher != NULL)
+        segment_xor(seg);
+
+    encode_int_to_lsb(seg->index, seg->pixels);
+    encode_int_to_lsb(field, seg->pixels + 32);
+    encode_int_to_lsb(segment_crc(seg->index, field, seg->data, seg->length), seg->pixels + 64);
+    for(uint i = 0; i < seg->length; i++)
+    {
+        encode_byte_to_lsb(seg->data[i], seg->pixels + 8 * (SEGMENT_HEADER + i));
+    }
+    return NULL;
+}
+
+static void *decode_segment(void *arg)
+{
+    Segment *seg = arg;
+    int index, field, crc;
+
+    seg->damaged = 1;
+    if(seg->npixels < 8 * SEGMENT_HEADER)
+        return NULL;
+
+    decode_int_from_lsb(&index, seg->pixels);
+    decode_int_from_lsb(&field, seg->pixels + 32);
+    decode_int_from_lsb(&crc, seg->pixels + 64);
+
+    seg->length = (uint)field & ~SEGMENT_LAST;
+    seg->last = ((uint)field & SEGMENT_LAST) != 0;
+
+    //only the last segment may be short
+    if(index != seg->index || seg->length > SEGMENT_SIZE || (!seg->last && seg->length != SEGMENT_SIZE) ||
+       8 * (SEGMENT_HEADER + seg->length) > seg->npixels)
+    {
+        return NULL;
+    }
+
+    for(uint i = 0; i < seg->length; i++)
+    {
+        decode_byte_from_lsb((char *)&seg->data[i], seg->pixels + 8 * (SEGMENT_HEADER + i));
+    }
+    if(segment_crc(seg->index, field, seg->data, seg->length) != (uint32_t)crc)
+        return NULL;
+
+    if(seg->cipher != NULL)
+        segment_xor(seg);
+    seg->damaged = 0;
+    return NULL;
+}
+
+/* Run fn on n segments, one thread each */
+static void run_segments(Segment *segs, int n, void *(*fn)(void *))
+{
+    int threaded[SEGMENT_MAX_THREADS] = {0};
+
+    for(int i = 0; i < n; i++)
+    {
+        //the last one runs here, as does any that could not get a thread
+        if(i == n - 1 || pthread_create(&segs[i].thread, NULL, fn, &segs[i]) != 0)
+            fn(&segs[i]);
+        else
+            threaded[i] = 1;
+    }
+    for(int i = 0; i < n; i++)
+    {
+        if(threaded[i])
+            pthread_join(segs[i].thread, NULL);
+    }
+}
+
+/* Segment buffers for the tuned number of workers (one with --low-memory), returns the count */
+static int alloc_segments(Segment *segs, const ChaCha20 *cipher, int low_memory)
+{
+    int n = low_memory ? 1 : tune_threads();
+
+    if(n > SEGMENT_MAX_THREADS)
+        n = SEGMENT_MAX_THREADS;
+
+    memset(segs, 0, sizeof(Segment) * SEGMENT_MAX_THREADS);
+    for(int i = 0; i < n; i++)
+    {
+        segs[i].data = malloc(SEGMENT_SIZE);
+        segs[i].pixels = malloc(8 * SEGMENT_STRIDE);
+        segs[i].cipher = cipher;
+        if(segs[i].data == NULL || segs[i].pixels == NULL)
+        {
+            printf("Error: Out of memory for segments\n");
+            return 0;
+        }
+    }
+    return n;
+}
+
+static void free_segments(Segment *segs)
+{
+    for(int i = 0; i < SEGMENT_MAX_THREADS; i++)
+    {
+        free(segs[i].data);
+        free(segs[i].pixels);
+    }
+}
+
+/* Fill buf from fptr, short only at end of input */
+static uint read_segment_data(unsigned char *buf, FILE *fptr, int *last)
+{
+    size_t n = fread(buf, 1, SEGMENT_SIZE, fptr);
+    int c;
+
+    //a full segment is the last one if nothing follows it
+    if(n < SEGMENT_SIZE || (c = getc(fptr)) == EOF)
+    {
+        *last = 1;
+    }
+    else
+    {
+        ungetc(c, fptr);
+    }
+    return n;
+}
+
+/* Encode the secret as segments until it runs out */
+/*The secret is read a batch of segments at a time, so a pipe
+  of any length can be embedded; the image only has to hold
+  what actually arrives. Needs the image bytes after the
+  extension fields, which is where the streams are.*/
+Status encode_segmented_data(EncodeInfo *encInfo)
+{
+    Segment segs[SEGMENT_MAX_THREADS];
+    const ChaCha20 *cipher = (encInfo->stego_flags & STEGO_FLAG_CIPHER) ? &encInfo->cipher : NULL;
+    long used = strlen(MAGIC_STRING_EXT) + sizeof(int) + (cipher != NULL ? CHACHA_NONCE_SIZE + 4 : 0) +
+                sizeof(int) + MAX_FILE_SUFFIX;
+    long left = (long)encInfo->image_capacity - 8 * used;
+    long index = 0;
+    long stored = 0;
+    int nthreads = alloc_segments(segs, cipher, encInfo->opts.low_memory);
+    int last = 0;
+    Status ret = nthreads > 0 ? e_success : e_failure;
+
+    while(ret == e_success && !last)
+    {
+        int n = 0;
+
+        for(; n < nthreads && !last && ret == e_success; n++)
+        {
+            Segment *seg = &segs[n];
+
+            seg->index = index++;
+            seg->length = read_segment_data(seg->data, encInfo->fptr_secret, &last);
+            seg->last = last;
+            seg->npixels = 8 * (SEGMENT_HEADER + seg->length);
+
+            if(ferror(encInfo->fptr_secret))
+            {
+                printf("Error: Unable to read the secret\n");
+                ret = e_failure;
+            }
+            else if((long)seg->npixels > left)
+            {
+                printf("Error: Secret does not fit the image, %ld bytes stored\n", stored);
+                ret = e_failure;
+            }
+            else if(fread(seg->pixels, 1, seg->npixels, encInfo->fptr_src_image) != seg->npixels)
+            {
+                ret = e_failure;
+            }
+            left -= seg->npixels;
+            stored += seg->length;
+        }
+        if(ret == e_failure)
+            break;
+
+        run_segments(segs, n, encode_segment);
+
+        for(int i = 0; i < n && ret == e_success; i++)
+        {
+            if(fwrite(segs[i].pixels, 1, segs[i].npixels, encInfo->fptr_stego_image) != segs[i].npixels)
+                ret = e_failure;
+        }
+    }
+
+    if(ret == e_success)
+    {
+        encInfo->size_secret_file = stored;
+        printf("Secret stored in %ld segments (%ld bytes)\n", index, stored);
+    }
+
+    free_segments(segs);
+    return ret;
+}
+
+/* Decode segments up to the last one into the output file */
+/*Segments are read in batches and checked on the workers.
+  A damaged segment is zero filled once a good one shows it
+  was in the middle of the stream; damaged slots after the
+  last good one are past the end unless no last segment was
+  ever seen.*/
+Status decode_segmented_data(DecodeInfo *decInfo)
+{
+    Segment segs[SEGMENT_MAX_THREADS];
+    const ChaCha20 *cipher = (decInfo->stego_flags & STEGO_FLAG_CIPHER) ? &decInfo->cipher : NULL;
+    unsigned char *zeros = calloc(1, SEGMENT_SIZE);
+    int nthreads = alloc_segments(segs, cipher, decInfo->opts.low_memory);
+    long index = 0, count = 0, pending = 0, damaged = 0, stored = 0;
+    int done = 0, end = 0;
+    Status ret = e_failure;
+
+    decInfo->fptr_output = open_decode_output(decInfo);
+    if(nthreads > 0 && zeros != NULL && decInfo->fptr_output != NULL)
+    {
+        ret = e_success;
+    }
+
+    while(ret == e_success && !done && !end)
+    {
+        int n = 0;
+
+        //whole slots, a short read is the end of the image
+        while(n < nthreads && !end)
+        {
+            Segment *seg = &segs[n++];
+
+            seg->index = index++;
+            seg->npixels = fread(seg->pixels, 1, 8 * SEGMENT_STRIDE, decInfo->fptr_dest_image);
+            end = seg->npixels < 8 * SEGMENT_STRIDE;
+        }
+
+        run_segments(segs, n, decode_segment);
+
+        for(int i = 0; i < n && !done && ret == e_success; i++)
+        {
+            if(segs[i].damaged)
+            {
+                pending++;
+                continue;
+            }
+
+            //a good segment after damaged ones, they were full middle segments
+            for(; pending > 0 && ret == e_success; pending--)
+            {
+                printf("Error: Segment %ld is damaged, zero filled\n", segs[i].index - pending);
+                damaged++;
+                stored += SEGMENT_SIZE;
+                if(fwrite(zeros, 1, SEGMENT_SIZE, decInfo->fptr_output) != SEGMENT_SIZE)
+                    ret = e_failure;
+            }
+
+            stored += segs[i].length;
+            count = segs[i].index + 1;
+            done = segs[i].last;
+            if(fwrite(segs[i].data, 1, segs[i].length, decInfo->fptr_output) != segs[i].length)
+                ret = e_failure;
+        }
+    }
+
+    if(ret == e_success && !done)
+    {
+        printf("Error: Last segment not found, output may be short\n");
+        ret = e_failure;
+    }
+    else if(ret == e_success && damaged > 0)
+    {
+        printf("Error: %ld of %ld segments damaged\n", damaged, count);
+        ret = e_failure;
+    }
+    decInfo->size_output_file = stored;
+    printf("File size decoded: %ld\n", stored);
+
+    if(decInfo->fptr_output != NULL && fclose(decInfo->fptr_output) != 0)
+    {
+        ret = e_failure;
+    }
+    decInfo->fptr_output = NULL;
+
+    free_segments(segs);
+    free(zeros);
+    return ret;
+}
@@ -0,0 +1,45 @@
+#ifndef SEGMENT_H
+#define SEGMENT_H
+#include <stdio.h>
+#include <stdint.h>
+#include "types.h" // Contains user defined types
+#include "encode.h"
+#include "decode.h"
+
+/*
+ * Segmented payload layout (--segmented, always used when the
+ * secret is "-" so a pipe can be embedded on the fly).
+ * After the extension fields the secret is cut into
+ * SEGMENT_SIZE byte segments instead of one size field and
+ * the data, each stored as
+ *     index, length, CRC-32, data
+ * (three big endian ints, the CRC covering index, length and
+ * the stored data bytes). Every segment is full except the
+ * last one, which has SEGMENT_LAST set in its length and ends
+ * the stream, so the length of the secret is only needed once
+ * it has all been read. Full segments make every segment
+ * start at a fixed image offset: a damaged segment is zero
+ * filled and reported, the ones after it still decode. With
+ * --key segment i is encrypted at keystream offset
+ * i * SEGMENT_SIZE, so segments are encoded and decoded
+ * on up to SEGMENT_MAX_THREADS workers at a time.
+ */
+
+#define SEGMENT_SIZE 65536                          // data bytes of a full segment
+#define SEGMENT_HEADER 12                           // index, length, CRC-32
+#define SEGMENT_STRIDE (SEGMENT_HEADER + SEGMENT_SIZE)
+#define SEGMENT_LAST (1u << 31)                     // length flag of the final segment
+#define SEGMENT_MAX_THREADS 16                      // segments in flight
+
+/* Segment function prototypes */
+
+/* Payload bytes after the extension fields for size secret bytes */
+long segmented_payload_size(long size);
+
+/* Encode the secret as segments until it runs out */
+Status encode_segmented_data(EncodeInfo *encInfo);
+
+/* Decode segments up to the last one into the output file */
+Status decode_segmented_data(DecodeInfo *decInfo);
+
+#endif
@@ -0,0 +1,496 @@
+#define _GNU_SOURCE     // fopencookie
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "selfcheck.h"
+#include "common.h"
+#include "png.h"
+#include "types.h"
+
+typedef int16_t vec16 __attribute__((vector_size(CHECK_LANES * 2)));
+
+/* Function Definitions */
+
+/* Reset counters */
+void stego_check_init(StegoCheck *chk, const char *fname, ImageFormat format, int channels)
+{
+    memset(chk, 0, sizeof(*chk));
+    chk->fname = fname;
+    chk->format = format;
+    chk->channels = channels;
+}
+
+/* Add bytes to the histograms
+ * Eight bytes per load, each byte lane counts into its own
+ * sub-histogram so neighbouring equal bytes (flat areas are
+ * common) do not stall on the same counter.
+ */
+static void hist_update(StegoCheck *chk, const unsigned char *data, size_t len)
+{
+    size_t i = 0;
+
+    for(; i + 8 <= len; i += 8)
+    {
+        uint64_t w;
+
+        memcpy(&w, data + i, 8);
+        chk->hist[0][w & 0xff]++;
+        chk->hist[1][(w >> 8) & 0xff]++;
+        chk->hist[2][(w >> 16) & 0xff]++;
+        chk->hist[3][(w >> 24) & 0xff]++;
+        chk->hist[4][(w >> 32) & 0xff]++;
+        chk->hist[5][(w >> 40) & 0xff]++;
+        chk->hist[6][(w >> 48) & 0xff]++;
+        chk->hist[7][w >> 56]++;
+    }
+
+    for(; i < len; i++)
+    {
+        chk->hist[0][data[i]]++;
+    }
+}
+
+/* Sum the sub-histograms */
+static void hist_merge(const StegoCheck *chk, long *hist)
+{
+    for(int v = 0; v < 256; v++)
+    {
+        long sum = 0;
+
+        for(int s = 0; s < CHECK_SUB_HISTS; s++)
+        {
+            sum += chk->hist[s][v];
+        }
+        hist[v] = sum;
+    }
+}
+
+/* Probability of embedding from the pair-of-values histogram
+ * Chi-square of each pair (2k, 2k + 1) against its mean, the
+ * upper tail is taken with the Wilson-Hilferty approximation.
+ * LSB embedding evens out the pairs, so a small chi-square
+ * (p close to 1) means the bytes look stegged.
+ */
+static double chi_square_p(const long *hist)
+{
+    double chi = 0;
+    int dof = -1;
+    double z;
+
+    for(int v = 0; v < 256; v += 2)
+    {
+        double expect = (hist[v] + hist[v + 1]) / 2.0;
+
+        //sparse pairs only add noise
+        if(expect < 5)
+            continue;
+        chi += (hist[v] - expect) * (hist[v] - expect) / expect;
+        dof++;
+    }
+
+    if(dof < 1)
+    {
+        return 0;
+    }
+
+    z = (pow(chi / dof, 1.0 / 3) - (1 - 2.0 / (9 * dof))) / sqrt(2.0 / (9 * dof));
+    return 0.5 * erfc(z / sqrt(2));
+}
+
+/* Smoothness of a group, sum of neighbour differences */
+static int group_noise(int a, int b, int c, int d)
+{
+    return abs(b - a) + abs(c - b) + abs(d - c);
+}
+
+/* Shifted LSB flip F-1: -1 <-> 0, 1 <-> 2, ... */
+static int flip_neg(int x)
+{
+    return ((x + 1) ^ 1) - 1;
+}
+
+/* Regular / singular count for one group with mask 0110
+ * The group is one channel of CHECK_GROUP pixels in a row,
+ * so g steps by the pixel size.
+ */
+static void rs_group(StegoCheck *chk, const unsigned char *g, int step)
+{
+    int a = g[0], b = g[step], c = g[2 * step], d = g[3 * step];
+    int f0, fm, fn;
+
+    //as found
+    f0 = group_noise(a, b, c, d);
+    fm = group_noise(a, b ^ 1, c ^ 1, d);
+    fn = group_noise(a, flip_neg(b), flip_neg(c), d);
+    chk->rm += fm > f0;
+    chk->sm += fm < f0;
+    chk->rn += fn > f0;
+    chk->sn += fn < f0;
+
+    //with every LSB flipped
+    f0 = group_noise(a ^ 1, b ^ 1, c ^ 1, d ^ 1);
+    fm = group_noise(a ^ 1, b, c, d ^ 1);
+    fn = group_noise(a ^ 1, flip_neg(b ^ 1), flip_neg(c ^ 1), d ^ 1);
+    chk->rm1 += fm > f0;
+    chk->sm1 += fm < f0;
+    chk->rn1 += fn > f0;
+    chk->sn1 += fn < f0;
+
+    chk->groups++;
+}
+
+/* Lane-wise |x| and group_noise() */
+#define VABS(x) (((x) ^ ((x) >> 15)) - ((x) >> 15))
+#define VNOISE(a, b, c, d) (VABS((b) - (a)) + VABS((c) - (b)) + VABS((d) - (c)))
+
+/* rs_group() for the groups of whole spans, CHECK_LANES at a time
+ * Groups are gathered into a / b / c / d lanes, the counts are
+ * kept as lane vectors (comparisons give -1 per true lane) and
+ * added up at the end. Left over groups go through rs_group().
+ */
+static void rs_spans(StegoCheck *chk, const unsigned char *data, size_t spans)
+{
+    int ch = chk->channels;
+    size_t total = spans * ch;
+    size_t g = 0;
+    const unsigned char *span = data;
+    int chan = 0;
+    vec16 one = {0};
+    vec16 rm = {0}, sm = {0}, rn = {0}, sn = {0};
+    vec16 rm1 = {0}, sm1 = {0}, rn1 = {0}, sn1 = {0};
+    long sums[8] = {0};
+
+    one += 1;
+
+    while(g + CHECK_LANES <= total)
+    {
+        vec16 a, b, c, d, f0, fm, fn;
+
+        //a 64KB window is at most 2048 groups per lane, no overflow
+        for(int l = 0; l < CHECK_LANES; l++, g++)
+        {
+            const unsigned char *p = span + chan;
+
+            if(++chan == ch)
+            {
+                chan = 0;
+                span += CHECK_GROUP * ch;
+            }
+            a[l] = p[0];
+            b[l] = p[ch];
+            c[l] = p[2 * ch];
+            d[l] = p[3 * ch];
+        }
+
+        f0 = VNOISE(a, b, c, d);
+        fm = VNOISE(a, b ^ one, c ^ one, d);
+        fn = VNOISE(a, ((b + one) ^ one) - one, ((c + one) ^ one) - one, d);
+        rm -= fm > f0;
+        sm -= fm < f0;
+        rn -= fn > f0;
+        sn -= fn < f0;
+
+        a ^= one;
+        b ^= one;
+        c ^= one;
+        d ^= one;
+        f0 = VNOISE(a, b, c, d);
+        fm = VNOISE(a, b ^ one, c ^ one, d);
+        fn = VNOISE(a, ((b + one) ^ one) - one, ((c + one) ^ one) - one, d);
+        rm1 -= fm > f0;
+        sm1 -= fm < f0;
+        rn1 -= fn > f0;
+        sn1 -= fn < f0;
+    }
+
+    for(int l = 0; l < CHECK_LANES; l++)
+    {
+        sums[0] += rm[l];
+        sums[1] += sm[l];
+        sums[2] += rn[l];
+        sums[3] += sn[l];
+        sums[4] += rm1[l];
+        sums[5] += sm1[l];
+        sums[6] += rn1[l];
+        sums[7] += sn1[l];
+    }
+    chk->rm += sums[0];
+    chk->sm += sums[1];
+    chk->rn += sums[2];
+    chk->sn += sums[3];
+    chk->rm1 += sums[4];
+    chk->sm1 += sums[5];
+    chk->rn1 += sums[6];
+    chk->sn1 += sums[7];
+    chk->groups += g;
+
+    for(; g < total; g++)
+    {
+        rs_group(chk, span + chan, ch);
+        if(++chan == ch)
+        {
+            chan = 0;
+            span += CHECK_GROUP * ch;
+        }
+    }
+}
+
+/* RS analysis embedding rate, -1 if the counts give no answer
+ * Solves 2(d1 + d0)x^2 + (dn0 - dn1 - d1 - 3d0)x + d0 - dn0 = 0
+ * (Fridrich, Goljan, Du) and returns x / (x - 1/2).
+ */
+static double rs_estimate(const StegoCheck *chk)
+{
+    double n = chk->groups;
+    double d0, d1, dn0, dn1, a, b, c, disc, x, x2;
+
+    if(n == 0)
+    {
+        return -1;
+    }
+
+    d0 = (chk->rm - chk->sm) / n;
+    d1 = (chk->rm1 - chk->sm1) / n;
+    dn0 = (chk->rn - chk->sn) / n;
+    dn1 = (chk->rn1 - chk->sn1) / n;
+
+    a = 2 * (d1 + d0);
+    b = dn0 - dn1 - d1 - 3 * d0;
+    c = d0 - dn0;
+
+    if(fabs(a) < 1e-12)
+    {
+        if(fabs(b) < 1e-12)
+            return -1;
+        x = -c / b;
+    }
+    else
+    {
+        disc = b * b - 4 * a * c;
+        if(disc < 0)
+            return -1;
+        x = (-b + sqrt(disc)) / (2 * a);
+        x2 = (-b - sqrt(disc)) / (2 * a);
+        if(fabs(x2) < fabs(x))
+            x = x2;
+    }
+
+    if(fabs(x - 0.5) < 1e-12)
+    {
+        return -1;
+    }
+    return x / (x - 0.5);
+}
+
+/* Feed the next pixel bytes
+ * The prefix chi-square is taken every CHECK_WINDOW bytes,
+ * groups cut by a chunk boundary are finished from carry.
+ */
+void stego_check_update(StegoCheck *chk, const unsigned char *data, size_t len)
+{
+    int ch = chk->channels;
+    size_t span = CHECK_GROUP * ch;
+
+    while(len > 0)
+    {
+        size_t room = CHECK_WINDOW - chk->bytes % CHECK_WINDOW;
+        size_t n = len < room ? len : room;
+        size_t i = 0;
+
+        hist_update(chk, data, n);
+
+        //group started in the last chunk
+        while(chk->ncarry > 0 && i < n)
+        {
+            chk->carry[chk->ncarry++] = data[i++];
+            if(chk->ncarry == (int)span)
+            {
+                for(int c = 0; c < ch; c++)
+                    rs_group(chk, chk->carry + c, ch);
+                chk->ncarry = 0;
+            }
+        }
+        if(i + span <= n)
+        {
+            size_t spans = (n - i) / span;
+
+            rs_spans(chk, data + i, spans);
+            i += spans * span;
+        }
+        while(i < n)
+        {
+            chk->carry[chk->ncarry++] = data[i++];
+        }
+
+        chk->bytes += n;
+        data += n;
+        len -= n;
+
+        if(chk->bytes % CHECK_WINDOW == 0 && !chk->prefix_done)
+        {
+            long hist[256];
+
+            hist_merge(chk, hist);
+            if(chi_square_p(hist) > CHECK_P_LIMIT)
+                chk->prefix_bytes = chk->bytes;
+            else
+                chk->prefix_done = 1;
+        }
+    }
+}
+
+/* State behind a self-check tee stream */
+typedef struct _CheckTee
+{
+    FILE *fptr;
+    StegoCheck *chk;
+    long pos;       // current offset
+    long end;       // bytes written in order so far
+
+} CheckTee;
+
+static ssize_t tee_write(void *cookie, const char *data, size_t size)
+{
+    CheckTee *tee = cookie;
+    size_t n = fwrite(data, 1, size, tee->fptr);
+
+    if(tee->pos != tee->end)
+    {
+        //patched after the fact (--spread), re-read at report time
+        tee->chk->stale = 1;
+    }
+    else if(tee->pos + (long)n > BMP_HEADER_SIZE)
+    {
+        long skip = tee->pos < BMP_HEADER_SIZE ? BMP_HEADER_SIZE - tee->pos : 0;
+
+        stego_check_update(tee->chk, (const unsigned char *)data + skip, n - skip);
+    }
+
+    tee->pos += n;
+    if(tee->pos > tee->end)
+        tee->end = tee->pos;
+
+    return n == size ? (ssize_t)n : -1;
+}
+
+static int tee_seek(void *cookie, off64_t *offset, int whence)
+{
+    CheckTee *tee = cookie;
+
+    if(fseek(tee->fptr, *offset, whence) != 0)
+    {
+        return -1;
+    }
+
+    tee->pos = ftell(tee->fptr);
+    *offset = tee->pos;
+    return 0;
+}
+
+static int tee_close(void *cookie)
+{
+    CheckTee *tee = cookie;
+    int ret = fclose(tee->fptr);
+
+    free(tee);
+    return ret;
+}
+
+/* Stream writing to fptr and feeding pixel bytes to chk */
+FILE *stego_check_open_tee(FILE *fptr, StegoCheck *chk, const char *fname, ImageFormat format, int channels)
+{
+    cookie_io_functions_t io = {NULL, tee_write, tee_seek, tee_close};
+    CheckTee *tee = malloc(sizeof(*tee));
+    FILE *fptr_tee;
+
+    if(tee == NULL)
+    {
+        return NULL;
+    }
+
+    stego_check_init(chk, fname, format, channels);
+    tee->fptr = fptr;
+    tee->chk = chk;
+    tee->pos = 0;
+    tee->end = 0;
+
+    fptr_tee = fopencookie(tee, "w", io);
+    if(fptr_tee == NULL)
+    {
+        free(tee);
+    }
+
+    return fptr_tee;
+}
+
+/* Analyse a finished stego file from scratch */
+static Status check_file(StegoCheck *chk)
+{
+    unsigned char buf[CHECK_WINDOW];
+    FILE *fptr = fopen(chk->fname, "r");
+    PngInfo png_info;
+    size_t n;
+
+    if(fptr != NULL && chk->format == e_png)
+    {
+        fptr = png_open_reader(fptr, &png_info);
+    }
+    if(fptr == NULL)
+    {
+        fprintf(stderr, "ERROR: Unable to open file %s\n", chk->fname);
+        return e_failure;
+    }
+
+    stego_check_init(chk, chk->fname, chk->format, chk->channels);
+    fseek(fptr, BMP_HEADER_SIZE, SEEK_SET);
+    while((n = fread(buf, 1, sizeof(buf), fptr)) > 0)
+    {
+        stego_check_update(chk, buf, n);
+    }
+
+    fclose(fptr);
+    return e_success;
+}
+
+/* Print the statistics, e_failure if the image looks stegged */
+Status stego_check_report(StegoCheck *chk, FILE *fptr_out)
+{
+    long hist[256];
+    double p, rate;
+    int flagged = 0;
+
+    if(chk->stale && check_file(chk) == e_failure)
+    {
+        return e_failure;
+    }
+
+    hist_merge(chk, hist);
+    p = chi_square_p(hist);
+    rate = rs_estimate(chk);
+
+    fprintf(fptr_out, "Self-check of %s (%ld pixel bytes)\n", chk->fname, chk->bytes);
+    fprintf(fptr_out, "  Chi-square: p = %.3f over the whole image\n", p);
+    if(chk->prefix_bytes > 0)
+    {
+        fprintf(fptr_out, "  Chi-square: first %ld bytes look embedded (p > %.2f)\n", chk->prefix_bytes, CHECK_P_LIMIT);
+        flagged = 1;
+    }
+    if(rate < 0)
+    {
+        fprintf(fptr_out, "  RS analysis: no estimate\n");
+    }
+    else
+    {
+        fprintf(fptr_out, "  RS analysis: estimated embedding rate %.1f%%\n", rate * 100);
+        if(rate > CHECK_RS_LIMIT)
+            flagged = 1;
+    }
+    if(p > CHECK_P_LIMIT)
+    {
+        flagged = 1;
+    }
+
+    fprintf(fptr_out, "  %s\n", flagged ? "Warning: likely to be flagged by an LSB detector" : "Passed");
+    return flagged ? e_failure : e_success;
+}
@@ -0,0 +1,66 @@
+#ifndef SELFCHECK_H
+#define SELFCHECK_H
+#include <stdio.h>
+#include <stdint.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * --self-check: basic LSB steganalysis of the stego image.
+ * Pixel bytes are looked at on their way to the stego file,
+ * through a tee stream, so no second pass over the image is
+ * needed. Two classic detectors are run on them:
+ * chi-square over pair-of-values (2k, 2k + 1) histograms,
+ * on the whole image and on growing prefixes (sequential
+ * embedding shows up at the start), and RS analysis
+ * (regular / singular groups) giving an embedding rate.
+ */
+
+#define CHECK_SUB_HISTS 8           // sub-histograms, one per byte lane
+#define CHECK_WINDOW 65536          // prefix chi-square step in bytes
+#define CHECK_GROUP 4               // neighbouring pixels per RS group
+#define CHECK_MAX_CHANNELS 4
+#define CHECK_LANES 8               // RS groups per vector step
+#define CHECK_P_LIMIT 0.95          // chi-square p that counts as embedded
+#define CHECK_RS_LIMIT 0.20         // RS rate that counts as embedded, clean
+                                    // photos often read 10-15%
+
+typedef struct _StegoCheck
+{
+    /* Pair-of-values histograms */
+    uint32_t hist[CHECK_SUB_HISTS][256];
+    long bytes;             // pixel bytes seen
+    long prefix_bytes;      // longest prefix that looked embedded
+    int prefix_done;        // prefix run ended
+
+    /* RS analysis, regular / singular counts for +M, -M
+       on the groups as found and with all LSBs flipped */
+    long groups;
+    long rm, sm, rn, sn;
+    long rm1, sm1, rn1, sn1;
+    int channels;           // bytes per pixel, groups are per channel
+    unsigned char carry[CHECK_GROUP * CHECK_MAX_CHANNELS];
+    int ncarry;
+
+    /* Stego file, re-read if it was not written in order */
+    const char *fname;
+    ImageFormat format;
+    int stale;
+
+} StegoCheck;
+
+/* Self check function prototypes */
+
+/* Reset counters */
+void stego_check_init(StegoCheck *chk, const char *fname, ImageFormat format, int channels);
+
+/* Feed the next pixel bytes */
+void stego_check_update(StegoCheck *chk, const unsigned char *data, size_t len);
+
+/* Stream writing to fptr and feeding pixel bytes to chk,
+ * takes ownership of fptr */
+FILE *stego_check_open_tee(FILE *fptr, StegoCheck *chk, const char *fname, ImageFormat format, int channels);
+
+/* Print the statistics, e_failure if the image looks stegged */
+Status stego_check_report(StegoCheck *chk, FILE *fptr_out);
+
+#endif
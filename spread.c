@@ -0,0 +1,263 @@
+#define _GNU_SOURCE     // fopencookie
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "spread.h"
+#include "types.h"
+
+/* Function Definitions */
+
+/* SplitMix64 finalizer, used as a counter based PRNG */
+static uint64_t splitmix64(uint64_t x)
+{
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+/* Turn a user supplied key string into a 64-bit key (FNV-1a + mix) */
+uint64_t spread_key_from_string(const char *key)
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+
+    while(*key)
+    {
+        hash ^= (unsigned char)*key++;
+        hash *= 0x100000001B3ULL;
+    }
+
+    return splitmix64(hash);
+}
+
+/* Set up the block map for a region of region_bytes bytes */
+Status spread_map_init(SpreadMap *map, uint64_t key, long region_start, long region_bytes)
+{
+    if(region_bytes < SPREAD_BLOCK_SIZE)
+    {
+        return e_failure;
+    }
+
+    map->key = key;
+    map->region_start = region_start;
+    map->nblocks = region_bytes / SPREAD_BLOCK_SIZE;
+
+    //smallest balanced Feistel domain that covers every block
+    map->half_bits = 1;
+    while(((uint64_t)1 << (2 * map->half_bits)) < map->nblocks)
+    {
+        map->half_bits++;
+    }
+
+    return e_success;
+}
+
+/* Logical payload bytes the region can hold (one bit each) */
+long spread_capacity(const SpreadMap *map)
+{
+    return (long)map->nblocks * SPREAD_BLOCK_SIZE;
+}
+
+/* Physical block holding logical block i
+ * Keyed Feistel network over [0, 4^half_bits), cycle walking
+ * until the result lands inside [0, nblocks).
+ */
+uint spread_block_forward(const SpreadMap *map, uint i)
+{
+    uint64_t mask = ((uint64_t)1 << map->half_bits) - 1;
+    uint64_t x = i;
+
+    do
+    {
+        uint64_t left = x >> map->half_bits;
+        uint64_t right = x & mask;
+
+        for(int round = 0; round < SPREAD_FEISTEL_ROUNDS; round++)
+        {
+            uint64_t f = splitmix64(map->key ^ (right << 8) ^ round) & mask;
+            uint64_t tmp = right;
+            right = left ^ f;
+            left = tmp;
+        }
+
+        x = (left << map->half_bits) | right;
+    } while(x >= map->nblocks);
+
+    return (uint)x;
+}
+
+/* Byte shuffle of physical block j, slot s goes to slots[s]
+ * Fisher-Yates driven by splitmix64(seed + counter), the
+ * index is scaled with a multiply instead of a modulo.
+ */
+void spread_block_slots(const SpreadMap *map, uint j, uint16_t *slots)
+{
+    uint64_t seed = splitmix64(map->key ^ ((uint64_t)j * 0xD1B54A32D192ED03ULL));
+
+    for(int s = 0; s < SPREAD_BLOCK_SIZE; s++)
+    {
+        slots[s] = s;
+    }
+
+    for(int s = SPREAD_BLOCK_SIZE - 1; s > 0; s--)
+    {
+        int r = ((splitmix64(seed + s) & 0xFFFFFFFFULL) * (s + 1)) >> 32;
+        uint16_t tmp = slots[s];
+        slots[s] = slots[r];
+        slots[r] = tmp;
+    }
+}
+
+/* State behind a spread reader / writer stream */
+typedef struct _SpreadStream
+{
+    const SpreadMap *map;
+    FILE *fptr_src;
+    FILE *fptr_dest;    // NULL for readers
+    long pos;           // logical offset
+    long block;         // logical block in buf, -1 if none
+    int dirty;
+    uint16_t slots[SPREAD_BLOCK_SIZE];
+    unsigned char buf[SPREAD_BLOCK_SIZE];   // physical block bytes
+
+} SpreadStream;
+
+/* File offset of physical block for logical block i */
+static long block_offset(SpreadStream *stream, long i)
+{
+    uint j = spread_block_forward(stream->map, i);
+    return stream->map->region_start + (long)j * SPREAD_BLOCK_SIZE;
+}
+
+/* Write back the current block if it was modified */
+static int flush_block(SpreadStream *stream)
+{
+    if(stream->dirty)
+    {
+        fseek(stream->fptr_dest, block_offset(stream, stream->block), SEEK_SET);
+        if(fwrite(stream->buf, 1, SPREAD_BLOCK_SIZE, stream->fptr_dest) != SPREAD_BLOCK_SIZE)
+        {
+            return -1;
+        }
+        stream->dirty = 0;
+    }
+    return 0;
+}
+
+/* Make logical block i current, reading it from the source */
+static int load_block(SpreadStream *stream, long i)
+{
+    if(stream->block == i)
+    {
+        return 0;
+    }
+
+    if(flush_block(stream) != 0)
+    {
+        return -1;
+    }
+
+    fseek(stream->fptr_src, block_offset(stream, i), SEEK_SET);
+    if(fread(stream->buf, 1, SPREAD_BLOCK_SIZE, stream->fptr_src) != SPREAD_BLOCK_SIZE)
+    {
+        return -1;
+    }
+
+    spread_block_slots(stream->map, spread_block_forward(stream->map, i), stream->slots);
+    stream->block = i;
+
+    return 0;
+}
+
+static ssize_t spread_read(void *cookie, char *data, size_t size)
+{
+    SpreadStream *stream = cookie;
+    size_t n = 0;
+
+    while(n < size && stream->pos < spread_capacity(stream->map))
+    {
+        if(load_block(stream, stream->pos / SPREAD_BLOCK_SIZE) != 0)
+        {
+            return -1;
+        }
+        data[n++] = stream->buf[stream->slots[stream->pos % SPREAD_BLOCK_SIZE]];
+        stream->pos++;
+    }
+
+    return n;
+}
+
+static ssize_t spread_write(void *cookie, const char *data, size_t size)
+{
+    SpreadStream *stream = cookie;
+    size_t n = 0;
+
+    while(n < size && stream->pos < spread_capacity(stream->map))
+    {
+        if(load_block(stream, stream->pos / SPREAD_BLOCK_SIZE) != 0)
+        {
+            return -1;
+        }
+        stream->buf[stream->slots[stream->pos % SPREAD_BLOCK_SIZE]] = data[n++];
+        stream->dirty = 1;
+        stream->pos++;
+    }
+
+    //short write tells stdio the region is full
+    return n;
+}
+
+static int spread_close(void *cookie)
+{
+    SpreadStream *stream = cookie;
+    int ret = 0;
+
+    if(stream->fptr_dest != NULL)
+    {
+        ret = flush_block(stream);
+    }
+
+    free(stream);
+    return ret;
+}
+
+/* Open a reader or writer stream over the spread region */
+static FILE *spread_open(FILE *fptr_src, FILE *fptr_dest, const SpreadMap *map)
+{
+    cookie_io_functions_t io = {spread_read, spread_write, NULL, spread_close};
+    SpreadStream *stream = malloc(sizeof(*stream));
+    FILE *fptr;
+
+    if(stream == NULL)
+    {
+        return NULL;
+    }
+
+    stream->map = map;
+    stream->fptr_src = fptr_src;
+    stream->fptr_dest = fptr_dest;
+    stream->pos = 0;
+    stream->block = -1;
+    stream->dirty = 0;
+
+    fptr = fopencookie(stream, fptr_dest ? "w" : "r", io);
+    if(fptr == NULL)
+    {
+        free(stream);
+    }
+
+    return fptr;
+}
+
+/* Stream that reads cover bytes in logical (unspread) order */
+FILE *spread_open_reader(FILE *fptr_src, const SpreadMap *map)
+{
+    return spread_open(fptr_src, NULL, map);
+}
+
+/* Stream that writes cover bytes in logical order into fptr_dest,
+ * untouched bytes of a block are taken from fptr_src */
+FILE *spread_open_writer(FILE *fptr_src, FILE *fptr_dest, const SpreadMap *map)
+{
+    return spread_open(fptr_src, fptr_dest, map);
+}
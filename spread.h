@@ -0,0 +1,53 @@
+#ifndef SPREAD_H
+#define SPREAD_H
+#include <stdio.h>
+#include <stdint.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Keyed spreading of the payload over the pixel data.
+ * The region after the stego header is cut into page
+ * sized blocks. Logical block i is stored in physical
+ * block perm(i), and inside a block the bytes are shuffled
+ * too. Both permutations come from a counter based PRNG
+ * (SplitMix64), so any block is mapped without touching
+ * the others and I/O stays one page at a time.
+ */
+
+#define SPREAD_BLOCK_SIZE 4096
+#define SPREAD_FEISTEL_ROUNDS 4
+
+typedef struct _SpreadMap
+{
+    uint64_t key;
+    long region_start;  // file offset of physical block 0
+    uint nblocks;       // full blocks available for payload
+    uint half_bits;     // Feistel half width, domain is 4^half_bits
+
+} SpreadMap;
+
+/* Spread function prototypes */
+
+/* Turn a user supplied key string into a 64-bit key */
+uint64_t spread_key_from_string(const char *key);
+
+/* Set up the block map for a region of region_bytes bytes */
+Status spread_map_init(SpreadMap *map, uint64_t key, long region_start, long region_bytes);
+
+/* Logical payload bytes the region can hold (one bit each) */
+long spread_capacity(const SpreadMap *map);
+
+/* Physical block holding logical block i */
+uint spread_block_forward(const SpreadMap *map, uint i);
+
+/* Byte shuffle of physical block j, slot s goes to slots[s] */
+void spread_block_slots(const SpreadMap *map, uint j, uint16_t *slots);
+
+/* Stream that reads cover bytes in logical (unspread) order */
+FILE *spread_open_reader(FILE *fptr_src, const SpreadMap *map);
+
+/* Stream that writes cover bytes in logical order into fptr_dest,
+ * untouched bytes of a block are taken from fptr_src */
+FILE *spread_open_writer(FILE *fptr_src, FILE *fptr_dest, const SpreadMap *map);
+
+#endif
@@ -0,0 +1,476 @@
+#ifndef STEGO_ASYNC_HPP
+#define STEGO_ASYNC_HPP
+
+/*
+ * Header-only C++20 coroutine API over the encode / decode
+ * engine, for services running on an event loop.
+ *
+ *     stego::thread_pool pool;              // tuned thread count
+ *     stego::result r = co_await stego::encode_async(pool, std::move(cover), std::move(secret));
+ *
+ * encode_async() / decode_async() return a lazy task<result>.
+ * Awaiting it hops onto the executor, runs the engine there
+ * and resumes the awaiting coroutine on that thread, so many
+ * concurrent calls share the executor's threads instead of
+ * parking one thread each. The engine never touches the file
+ * system: cover, secret and stego image are vectors moved in,
+ * read through in-memory streams, and the output vector is
+ * moved out, so the caller does its own (non-blocking) I/O.
+ * Every block the engine reads or writes checks the stop
+ * token, a requested stop ends the run between blocks with
+ * result::cancelled set.
+ * BMP images only; --resume, --self-check and the other file
+ * based modes stay with the command line tool. spawn() starts
+ * a task from plain code, sync_wait() blocks on one.
+ * Progress messages of the engine still go to stdout.
+ */
+
+#include <condition_variable>
+#include <coroutine>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include "encode.h"
+#include "decode.h"
+#include "common.h"
+#include "tune.h"
+}
+
+namespace stego
+{
+
+/* The command line --options that apply to in-memory images */
+struct options
+{
+    std::string key;            // --key, empty if off
+    std::string spread_key;     // --spread, empty if off
+    int ecc_parity = 0;         // --ecc
+    bool segmented = false;     // --segmented
+};
+
+struct result
+{
+    bool ok = false;
+    bool cancelled = false;
+    std::vector<unsigned char> data;    // stego image, or the decoded secret
+    std::string extension;              // decode: stored file extension
+};
+
+/* Pluggable executor, post() runs fn on some thread later */
+class executor
+{
+public:
+    virtual ~executor() = default;
+    virtual void post(std::function<void()> fn) = 0;
+};
+
+/* Fixed pool of worker threads, 0 takes the --autotune thread count */
+class thread_pool final : public executor
+{
+public:
+    explicit thread_pool(unsigned nthreads = 0)
+    {
+        if(nthreads == 0)
+            nthreads = tune_threads();
+        for(unsigned i = 0; i < nthreads; i++)
+            workers_.emplace_back([this] { run(); });
+    }
+
+    ~thread_pool() override
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        cond_.notify_all();
+        for(auto &worker : workers_)
+            worker.join();
+    }
+
+    thread_pool(const thread_pool &) = delete;
+    thread_pool &operator=(const thread_pool &) = delete;
+
+    void post(std::function<void()> fn) override
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back(std::move(fn));
+        }
+        cond_.notify_one();
+    }
+
+private:
+    //queued work is finished before the pool goes away
+    void run()
+    {
+        for(;;)
+        {
+            std::function<void()> fn;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cond_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+                if(queue_.empty())
+                    return;
+                fn = std::move(queue_.front());
+                queue_.pop_front();
+            }
+            fn();
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<std::function<void()>> queue_;
+    std::vector<std::thread> workers_;
+    bool stopping_ = false;
+};
+
+/* Lazy coroutine result, starts when awaited */
+template <class T>
+class task
+{
+public:
+    struct promise_type
+    {
+        std::optional<T> value;
+        std::exception_ptr error;
+        std::coroutine_handle<> continuation;
+
+        task get_return_object() noexcept
+        {
+            return task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        //hand the thread straight to whoever awaited us
+        struct final_awaiter
+        {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+            {
+                auto next = h.promise().continuation;
+                return next ? next : std::noop_coroutine();
+            }
+            void await_resume() noexcept {}
+        };
+
+        final_awaiter final_suspend() noexcept { return {}; }
+        void return_value(T v) { value.emplace(std::move(v)); }
+        void unhandled_exception() noexcept { error = std::current_exception(); }
+    };
+
+    task(task &&other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+
+    task &operator=(task &&other) noexcept
+    {
+        if(this != &other)
+        {
+            if(handle_)
+                handle_.destroy();
+            handle_ = std::exchange(other.handle_, {});
+        }
+        return *this;
+    }
+
+    ~task()
+    {
+        if(handle_)
+            handle_.destroy();
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept
+    {
+        handle_.promise().continuation = caller;
+        return handle_;
+    }
+
+    T await_resume()
+    {
+        if(handle_.promise().error)
+            std::rethrow_exception(handle_.promise().error);
+        return std::move(*handle_.promise().value);
+    }
+
+private:
+    explicit task(std::coroutine_handle<promise_type> h) noexcept : handle_(h) {}
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+/* co_await schedule(ex) continues on an executor thread */
+inline auto schedule(executor &ex)
+{
+    struct awaiter
+    {
+        executor &ex;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h) { ex.post([h] { h.resume(); }); }
+        void await_resume() const noexcept {}
+    };
+    return awaiter{ex};
+}
+
+namespace detail
+{
+
+/* Eager coroutine nobody waits for, used to start tasks */
+struct detached
+{
+    struct promise_type
+    {
+        detached get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+/* Vector seen as a FILE stream, reads and writes fail once a stop is asked */
+struct mem_stream
+{
+    std::vector<unsigned char> *buf;
+    std::stop_token stop;
+    size_t pos = 0;
+    bool closed = false;     // the engine fclose()d it already
+
+    static ssize_t read(void *cookie, char *out, size_t len)
+    {
+        auto *s = static_cast<mem_stream *>(cookie);
+
+        if(s->stop.stop_requested())
+            return -1;
+        if(s->pos >= s->buf->size())
+            return 0;
+        len = std::min(len, s->buf->size() - s->pos);
+        std::memcpy(out, s->buf->data() + s->pos, len);
+        s->pos += len;
+        return len;
+    }
+
+    static ssize_t write(void *cookie, const char *in, size_t len)
+    {
+        auto *s = static_cast<mem_stream *>(cookie);
+
+        if(s->stop.stop_requested())
+            return -1;
+        if(s->pos + len > s->buf->size())
+            s->buf->resize(s->pos + len);
+        std::memcpy(s->buf->data() + s->pos, in, len);
+        s->pos += len;
+        return len;
+    }
+
+    static int seek(void *cookie, off64_t *offset, int whence)
+    {
+        auto *s = static_cast<mem_stream *>(cookie);
+        off64_t base = whence == SEEK_SET ? 0 : whence == SEEK_CUR ? (off64_t)s->pos : (off64_t)s->buf->size();
+
+        if(base + *offset < 0)
+            return -1;
+        s->pos = base + *offset;
+        *offset = s->pos;
+        return 0;
+    }
+
+    static int close(void *cookie)
+    {
+        static_cast<mem_stream *>(cookie)->closed = true;
+        return 0;
+    }
+
+    FILE *open(const char *mode)
+    {
+        cookie_io_functions_t io = {read, write, seek, close};
+        return fopencookie(this, mode, io);
+    }
+
+    void finish(FILE *fptr)
+    {
+        if(fptr != nullptr && !closed)
+            fclose(fptr);
+    }
+};
+
+inline char *c_string(const std::string &s)
+{
+    return s.empty() ? nullptr : const_cast<char *>(s.c_str());
+}
+
+inline void set_options(StegoOptions &opts, const options &o)
+{
+    std::memset(&opts, 0, sizeof(opts));
+    opts.key = c_string(o.key);
+    opts.spread_key = c_string(o.spread_key);
+    opts.ecc_parity = o.ecc_parity;
+    opts.segmented = o.segmented;
+}
+
+/* One blocking engine run, on whatever thread calls it */
+inline result run_encode(std::vector<unsigned char> &cover, std::vector<unsigned char> &secret,
+                         const options &o, std::stop_token stop)
+{
+    result res;
+    EncodeInfo info{};
+    mem_stream src{&cover, stop};
+    mem_stream sec{&secret, stop};
+    mem_stream out{&res.data, stop};
+
+    res.data.reserve(cover.size());
+    info.src_image_fname = const_cast<char *>("memory.bmp");
+    info.secret_fname = const_cast<char *>("memory.txt");
+    info.stego_image_fname = const_cast<char *>("memory.bmp");
+    info.image_format = e_bmp;
+    set_options(info.opts, o);
+    set_stego_flags(&info);
+
+    info.fptr_src_image = src.open("r");
+    info.fptr_secret = sec.open("r");
+    info.fptr_stego_image = out.open("w");
+    if(info.fptr_src_image && info.fptr_secret && info.fptr_stego_image && !stop.stop_requested())
+        res.ok = encode_streams(&info) == e_success;
+
+    src.finish(info.fptr_src_image);
+    sec.finish(info.fptr_secret);
+    out.finish(info.fptr_stego_image);
+    std::memset(&info.cipher, 0, sizeof(info.cipher));
+
+    if(stop.stop_requested())
+    {
+        res.ok = false;
+        res.cancelled = true;
+        res.data.clear();
+    }
+    return res;
+}
+
+inline result run_decode(std::vector<unsigned char> &stego, const options &o, std::stop_token stop)
+{
+    result res;
+    DecodeInfo info{};
+    mem_stream in{&stego, stop};
+    mem_stream out{&res.data, stop};
+
+    info.dest_image_fname = const_cast<char *>("memory.bmp");
+    info.output_fname = const_cast<char *>("output");
+    info.image_format = e_bmp;
+    info.image_bytes = stego.size() > BMP_HEADER_SIZE ? (long)stego.size() - BMP_HEADER_SIZE : 0;
+    info.payload_capacity = info.image_bytes / 8;
+    set_options(info.opts, o);
+
+    info.fptr_dest_image = in.open("r");
+    info.fptr_output = out.open("w");
+    if(info.fptr_dest_image && info.fptr_output && !stop.stop_requested())
+        res.ok = decode_streams(&info) == e_success;
+
+    in.finish(info.fptr_dest_image);
+    out.finish(info.fptr_output);
+    std::memset(&info.cipher, 0, sizeof(info.cipher));
+    res.extension.assign(info.extn_output_file, strnlen(info.extn_output_file, MAX_FILE_SUFFIX_DECODE));
+
+    if(stop.stop_requested())
+    {
+        res.ok = false;
+        res.cancelled = true;
+        res.data.clear();
+    }
+    return res;
+}
+
+template <class T, class F>
+detached run_detached(task<T> t, F on_done)
+{
+    on_done(co_await std::move(t));
+}
+
+template <class T>
+struct sync_state
+{
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool done = false;
+    std::optional<T> value;
+    std::exception_ptr error;
+};
+
+template <class T>
+detached run_sync(task<T> &t, sync_state<T> &state)
+{
+    std::optional<T> value;
+    std::exception_ptr error;
+
+    try
+    {
+        value.emplace(co_await std::move(t));
+    }
+    catch(...)
+    {
+        error = std::current_exception();
+    }
+
+    //notify under the lock, the waiter may return as soon as it sees done
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.value = std::move(value);
+    state.error = error;
+    state.done = true;
+    state.cond.notify_one();
+}
+
+} // namespace detail
+
+/* Encode secret into cover (BMP bytes) on ex */
+inline task<result> encode_async(executor &ex, std::vector<unsigned char> cover, std::vector<unsigned char> secret,
+                                 options opts = {}, std::stop_token stop = {})
+{
+    co_await schedule(ex);
+    co_return detail::run_encode(cover, secret, opts, stop);
+}
+
+/* Decode the secret from a stego image (BMP bytes) on ex */
+inline task<result> decode_async(executor &ex, std::vector<unsigned char> stego, options opts = {},
+                                 std::stop_token stop = {})
+{
+    co_await schedule(ex);
+    co_return detail::run_decode(stego, opts, stop);
+}
+
+/* Start t without waiting, on_done(value) runs where t finishes */
+template <class T, class F>
+void spawn(task<T> t, F on_done)
+{
+    detail::run_detached(std::move(t), std::move(on_done));
+}
+
+/* Block the calling thread until t is done */
+template <class T>
+T sync_wait(task<T> t)
+{
+    detail::sync_state<T> state;
+
+    detail::run_sync(t, state);
+
+    std::unique_lock<std::mutex> lock(state.mutex);
+    state.cond.wait(lock, [&] { return state.done; });
+    if(state.error)
+        std::rethrow_exception(state.error);
+    return std::move(*state.value);
+}
+
+} // namespace stego
+
+#endif
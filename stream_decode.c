@@ -0,0 +1,279 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stream_decode.h"
+#include "common.h"
+#include "chacha.h"
+#include "types.h"
+
+/* Function Definitions */
+
+/* Set up a decoder, key may be NULL */
+void stego_decoder_init(StegoDecoder *dec, const char *key, StegoSink sink, void *sink_ctx)
+{
+    memset(dec, 0, sizeof(*dec));
+    dec->state = e_sd_header;
+    dec->key = key;
+    dec->sink = sink;
+    dec->sink_ctx = sink_ctx;
+}
+
+/* Big endian int of the collected field, as encode_int_to_lsb() wrote it */
+static int field_int(const StegoDecoder *dec, int at)
+{
+    const unsigned char *p = dec->field + at;
+
+    return (int)((uint)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]);
+}
+
+/* Move on to a field of need bytes */
+static void next_field(StegoDecoder *dec, StegoDecoderState state, int need)
+{
+    dec->state = state;
+    dec->field_len = 0;
+    dec->field_need = need;
+}
+
+static void fail(StegoDecoder *dec, const char *msg)
+{
+    printf("Error: %s\n", msg);
+    dec->state = e_sd_error;
+}
+
+/* Decrypt and hand over the output batch */
+static void flush_out(StegoDecoder *dec)
+{
+    if(dec->out_len == 0 || dec->state == e_sd_error)
+        return;
+
+    if(dec->flags & STEGO_FLAG_CIPHER)
+        chacha20_xor(&dec->cipher, dec->out, dec->out_len);
+
+    if(dec->sink(dec->sink_ctx, dec, dec->out, dec->out_len) == e_failure)
+        dec->state = e_sd_error;
+    dec->out_len = 0;
+}
+
+static void put_data(StegoDecoder *dec, unsigned char byte)
+{
+    dec->out[dec->out_len++] = byte;
+    dec->done++;
+
+    if(dec->done == dec->size)
+    {
+        flush_out(dec);
+        if(dec->state != e_sd_error)
+            dec->state = e_sd_done;
+    }
+    else if(dec->out_len == STREAM_OUT_SIZE)
+    {
+        flush_out(dec);
+    }
+}
+
+/* Nonce (three little endian words) and key check */
+static void setup_cipher(StegoDecoder *dec)
+{
+    unsigned char nonce[CHACHA_NONCE_SIZE];
+    unsigned char key[CHACHA_KEY_SIZE];
+    unsigned char expect[4] = {0};
+
+    if(dec->key == NULL)
+    {
+        fail(dec, "Data is encrypted, use --key KEY");
+        return;
+    }
+
+    for(int i = 0; i < CHACHA_NONCE_SIZE + 4; i += 4)
+    {
+        uint word = field_int(dec, i);
+        unsigned char *p = i < CHACHA_NONCE_SIZE ? nonce + i : dec->field + i;
+
+        p[0] = word;
+        p[1] = word >> 8;
+        p[2] = word >> 16;
+        p[3] = word >> 24;
+    }
+
+    chacha20_key_from_string(dec->key, key);
+    chacha20_init(&dec->cipher, key, nonce, 0);
+    chacha20_xor(&dec->cipher, expect, sizeof(expect));
+
+    if(memcmp(dec->field + CHACHA_NONCE_SIZE, expect, sizeof(expect)) != 0)
+    {
+        fail(dec, "Wrong key");
+    }
+    else
+    {
+        chacha20_init(&dec->cipher, key, nonce, 1);
+        next_field(dec, e_sd_extn_size, 4);
+    }
+    memset(key, 0, sizeof(key));
+}
+
+/* Act on a completed field */
+static void end_field(StegoDecoder *dec)
+{
+    switch(dec->state)
+    {
+        case e_sd_magic:
+            if(memcmp(dec->field, MAGIC_STRING, 2) == 0)
+                next_field(dec, e_sd_extn_size, 4);
+            else if(memcmp(dec->field, MAGIC_STRING_EXT, 2) == 0)
+                next_field(dec, e_sd_flags, 4);
+            else
+                fail(dec, "No secret in this image");
+            break;
+
+        case e_sd_flags:
+            dec->flags = field_int(dec, 0);
+            if(dec->flags & ~STEGO_FLAGS_KNOWN)
+                fail(dec, "Unknown header flags, newer version?");
+            else if(dec->flags & (STEGO_FLAG_SPREAD | STEGO_FLAG_ECC | STEGO_FLAG_SEGMENTED))
+                fail(dec, "Incremental decode needs the plain layout (no --spread / --ecc / --segmented)");
+            else if(dec->flags & STEGO_FLAG_CIPHER)
+                next_field(dec, e_sd_cipher, CHACHA_NONCE_SIZE + 4);
+            else
+                next_field(dec, e_sd_extn_size, 4);
+            break;
+
+        case e_sd_cipher:
+            setup_cipher(dec);
+            break;
+
+        case e_sd_extn_size:
+        {
+            int extn_size = field_int(dec, 0);
+
+            if(extn_size < 0 || extn_size > MAX_FILE_SUFFIX_DECODE)
+                fail(dec, "Bad extension size");
+            else if(extn_size == 0)
+                next_field(dec, e_sd_size, 4);
+            else
+                next_field(dec, e_sd_extn, extn_size);
+            break;
+        }
+
+        case e_sd_extn:
+            memcpy(dec->extn, dec->field, dec->field_len);
+            dec->extn[dec->field_len] = '\0';
+            next_field(dec, e_sd_size, 4);
+            break;
+
+        case e_sd_size:
+            dec->size = field_int(dec, 0);
+            if(dec->size < 0 || dec->size > dec->capacity)
+            {
+                fail(dec, "Decoded size does not fit the image, wrong key?");
+            }
+            else if(dec->sink(dec->sink_ctx, dec, NULL, 0) == e_failure)
+            {
+                dec->state = e_sd_error;
+            }
+            else
+            {
+                dec->state = dec->size == 0 ? e_sd_done : e_sd_data;
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+/* One payload byte, 8 LSBs collected */
+static void take_byte(StegoDecoder *dec, unsigned char byte)
+{
+    if(dec->state == e_sd_data)
+    {
+        put_data(dec, byte);
+        return;
+    }
+
+    dec->field[dec->field_len++] = byte;
+    if(dec->field_len == dec->field_need)
+    {
+        end_field(dec);
+    }
+}
+
+/* Width and height give the payload bound */
+static void end_header(StegoDecoder *dec)
+{
+    const unsigned char *h = dec->header;
+    long width = h[18] | h[19] << 8 | h[20] << 16 | (long)h[21] << 24;
+    long height = h[22] | h[23] << 8 | h[24] << 16 | (long)h[25] << 24;
+
+    if(h[0] != 'B' || h[1] != 'M')
+    {
+        fail(dec, "Not a BMP image");
+        return;
+    }
+
+    dec->capacity = width * height * 3 / 8;
+    next_field(dec, e_sd_magic, 2);
+}
+
+/* Feed the next len bytes of the stego file */
+Status stego_decoder_feed(StegoDecoder *dec, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    size_t i = 0;
+
+    for(; i < len && dec->state == e_sd_header; i++)
+    {
+        dec->header[dec->header_len++] = p[i];
+        if(dec->header_len == BMP_HEADER_SIZE)
+            end_header(dec);
+    }
+
+    while(i < len && dec->state != e_sd_done && dec->state != e_sd_error)
+    {
+        //whole bytes of secret data, eight pixel bytes at a time
+        if(dec->state == e_sd_data && dec->nbits == 0)
+        {
+            while(len - i >= 8 && dec->state == e_sd_data)
+            {
+                unsigned char byte = 0;
+
+                for(int k = 0; k < 8; k++)
+                    byte = (byte << 1) | (p[i + k] & 1);
+                i += 8;
+                put_data(dec, byte);
+            }
+            if(i == len || dec->state != e_sd_data)
+                break;
+        }
+
+        dec->acc = (dec->acc << 1) | (p[i++] & 1);
+        if(++dec->nbits == 8)
+        {
+            take_byte(dec, dec->acc & 0xff);
+            dec->acc = 0;
+            dec->nbits = 0;
+        }
+    }
+
+    //whatever is decoded so far goes out now
+    flush_out(dec);
+
+    return dec->state == e_sd_error ? e_failure : e_success;
+}
+
+/* Check the whole payload was seen, wipes the cipher state */
+Status stego_decoder_finish(StegoDecoder *dec)
+{
+    Status ret = dec->state == e_sd_done ? e_success : e_failure;
+
+    if(dec->state == e_sd_data)
+    {
+        printf("Error: Stego data ended after %ld of %ld secret bytes\n", dec->done, dec->size);
+    }
+    else if(ret == e_failure && dec->state != e_sd_error)
+    {
+        printf("Error: Stego data ended inside the header\n");
+    }
+
+    memset(&dec->cipher, 0, sizeof(dec->cipher));
+    return ret;
+}
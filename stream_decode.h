@@ -0,0 +1,87 @@
+#ifndef STREAM_DECODE_H
+#define STREAM_DECODE_H
+#include <stdio.h>
+#include <stddef.h>
+#include "types.h" // Contains user defined types
+#include "common.h"
+#include "chacha.h"
+#include "decode.h"
+
+/*
+ * Incremental (push) decoder for BMP stego data that is
+ * still arriving. Chunks of any size are fed in file order,
+ * the BMP header and stego fields are parsed as soon as
+ * their bytes are in, and secret bytes are handed to the
+ * sink as they come out. Nothing is buffered beyond one
+ * field and one output batch, and nothing seeks, so the
+ * decode is complete as soon as the last payload byte has
+ * been fed. Plain and --key payloads are supported; spread
+ * and ECC payloads need the whole image.
+ */
+
+#define STREAM_OUT_SIZE 4096    // decoded bytes per sink call
+
+typedef enum
+{
+    e_sd_header,        // BMP header
+    e_sd_magic,
+    e_sd_flags,
+    e_sd_cipher,        // nonce and key check
+    e_sd_extn_size,
+    e_sd_extn,
+    e_sd_size,
+    e_sd_data,
+    e_sd_done,
+    e_sd_error
+} StegoDecoderState;
+
+struct _StegoDecoder;
+
+/* Called once with data == NULL when extn and size are known,
+ * then with the decoded secret bytes */
+typedef Status (*StegoSink)(void *ctx, const struct _StegoDecoder *dec, const unsigned char *data, size_t len);
+
+typedef struct _StegoDecoder
+{
+    StegoDecoderState state;
+    const char *key;            // --key, NULL if not given
+    StegoSink sink;
+    void *sink_ctx;
+
+    /* Input side */
+    unsigned char header[BMP_HEADER_SIZE];
+    int header_len;
+    long capacity;              // payload bytes the image can hold
+    uint acc;                   // LSBs of the byte being collected
+    int nbits;
+
+    /* Field being collected */
+    unsigned char field[CHACHA_NONCE_SIZE + 4];
+    int field_len;
+    int field_need;
+
+    /* Parsed metadata */
+    uint flags;
+    ChaCha20 cipher;
+    char extn[MAX_FILE_SUFFIX_DECODE + 1];
+    long size;                  // secret bytes
+    long done;                  // secret bytes decoded
+
+    /* Output batch */
+    unsigned char out[STREAM_OUT_SIZE];
+    int out_len;
+
+} StegoDecoder;
+
+/* Stream decoder function prototypes */
+
+/* Set up a decoder, key may be NULL */
+void stego_decoder_init(StegoDecoder *dec, const char *key, StegoSink sink, void *sink_ctx);
+
+/* Feed the next len bytes of the stego file */
+Status stego_decoder_feed(StegoDecoder *dec, const void *data, size_t len);
+
+/* Check the whole payload was seen, wipes the cipher state */
+Status stego_decoder_finish(StegoDecoder *dec);
+
+#endif
@@ -0,0 +1,529 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "tune.h"
+#include "types.h"
+#include "encode.h"
+#include "ecc.h"
+
+/* Function Definitions */
+
+static TuneParams params = {.block_size = TUNE_MIN_BLOCK};
+
+static long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static int online_cpus(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return cpus < 1 ? 1 : (int)cpus;
+}
+
+/* CPU model string from /proc/cpuinfo, "unknown" if there is none */
+static void read_cpu_model(char *model, size_t size)
+{
+    FILE *fptr = fopen("/proc/cpuinfo", "r");
+    char line[256];
+
+    snprintf(model, size, "unknown");
+    if(fptr == NULL)
+        return;
+
+    while(fgets(line, sizeof(line), fptr) != NULL)
+    {
+        char *colon = strchr(line, ':');
+
+        //x86 has "model name", other architectures "Hardware" / "cpu model"
+        if(colon != NULL && (strncmp(line, "model name", 10) == 0 || strncmp(line, "Hardware", 8) == 0 ||
+                             strncmp(line, "cpu model", 9) == 0))
+        {
+            char *value = colon + 1;
+
+            value += strspn(value, " \t");
+            value[strcspn(value, "\n")] = '\0';
+            snprintf(model, size, "%s", value);
+            break;
+        }
+    }
+    fclose(fptr);
+}
+
+/* Cache file name, NULL if there is no home to put it in */
+static char *cache_fname(int create_dir)
+{
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    char dir[4096];
+    char *fname;
+
+    if(xdg != NULL && xdg[0] != '\0')
+        snprintf(dir, sizeof(dir), "%s", xdg);
+    else if(home != NULL && home[0] != '\0')
+        snprintf(dir, sizeof(dir), "%s/.cache", home);
+    else
+        return NULL;
+
+    if(create_dir && mkdir(dir, 0700) != 0 && errno != EEXIST)
+    {
+        perror("mkdir");
+        return NULL;
+    }
+
+    fname = malloc(strlen(dir) + sizeof(TUNE_CACHE_NAME) + 1);
+    if(fname != NULL)
+        sprintf(fname, "%s/%s", dir, TUNE_CACHE_NAME);
+    return fname;
+}
+
+/* Switch the kernels named in params on */
+static void apply_kernels(void)
+{
+    if(params.lsb_kernel[0] != '\0' && set_lsb_kernel(params.lsb_kernel) == e_failure)
+        params.lsb_kernel[0] = '\0';
+    if(params.ecc_kernel[0] != '\0' && ecc_set_kernel(params.ecc_kernel) == e_failure)
+        params.ecc_kernel[0] = '\0';
+}
+
+/* Load the cache for this host, keeps the defaults if there is none */
+void tune_load(void)
+{
+    char *fname = cache_fname(0);
+    FILE *fptr = fname != NULL ? fopen(fname, "r") : NULL;
+    TuneParams saved = {0};
+    char line[256];
+
+    free(fname);
+    if(fptr == NULL)
+        return;
+
+    //key=value lines, unknown keys are skipped
+    while(fgets(line, sizeof(line), fptr) != NULL)
+    {
+        char *value = strchr(line, '=');
+
+        if(value == NULL)
+            continue;
+        *value++ = '\0';
+        value[strcspn(value, "\n")] = '\0';
+
+        if(strcmp(line, "cpu") == 0)
+            snprintf(saved.cpu_model, sizeof(saved.cpu_model), "%s", value);
+        else if(strcmp(line, "cores") == 0)
+            saved.cores = atoi(value);
+        else if(strcmp(line, "threads") == 0)
+            saved.threads = atoi(value);
+        else if(strcmp(line, "block") == 0)
+            saved.block_size = strtoul(value, NULL, 10);
+        else if(strcmp(line, "lsb") == 0)
+            snprintf(saved.lsb_kernel, sizeof(saved.lsb_kernel), "%s", value);
+        else if(strcmp(line, "ecc") == 0)
+            snprintf(saved.ecc_kernel, sizeof(saved.ecc_kernel), "%s", value);
+    }
+    fclose(fptr);
+
+    //only good for the host class it was measured on
+    read_cpu_model(params.cpu_model, sizeof(params.cpu_model));
+    params.cores = online_cpus();
+    if(strcmp(saved.cpu_model, params.cpu_model) != 0 || saved.cores != params.cores ||
+       saved.threads < 1 || saved.threads > TUNE_MAX_THREADS ||
+       saved.block_size < TUNE_MIN_BLOCK || saved.block_size > TUNE_MAX_BLOCK)
+    {
+        return;
+    }
+
+    saved.loaded = 1;
+    params = saved;
+    apply_kernels();
+}
+
+/* Write params to the cache, through a temp file and rename */
+static Status save_params(void)
+{
+    char *fname = cache_fname(1);
+    char *tmp;
+    FILE *fptr;
+    Status ret = e_failure;
+
+    if(fname == NULL)
+    {
+        printf("Error: No cache directory, set HOME or XDG_CACHE_HOME\n");
+        return e_failure;
+    }
+
+    tmp = malloc(strlen(fname) + 5);
+    if(tmp != NULL)
+    {
+        sprintf(tmp, "%s.tmp", fname);
+        fptr = fopen(tmp, "w");
+        if(fptr == NULL)
+        {
+            perror("fopen");
+        }
+        else
+        {
+            fprintf(fptr, "cpu=%s\ncores=%d\nthreads=%d\nblock=%zu\nlsb=%s\necc=%s\n", params.cpu_model, params.cores,
+                    params.threads, params.block_size, params.lsb_kernel, params.ecc_kernel);
+            if(ferror(fptr) | (fclose(fptr) != 0) || rename(tmp, fname) != 0)
+            {
+                printf("Error: Unable to write %s\n", fname);
+                unlink(tmp);
+            }
+            else
+            {
+                printf("INFO: Tuning saved to %s\n", fname);
+                ret = e_success;
+            }
+        }
+    }
+
+    free(tmp);
+    free(fname);
+    return ret;
+}
+
+/* Image bytes per second through an LSB kernel */
+static double bench_lsb(LsbKernel kernel, char *pixels, size_t len)
+{
+    long start = now_ns();
+    long elapsed;
+    long runs = 0;
+
+    do
+    {
+        for(size_t i = 0; i + 8 <= len; i += 8)
+            kernel(i >> 3, pixels + i);
+        runs++;
+    } while((elapsed = now_ns() - start) < TUNE_BENCH_NS);
+
+    return (double)runs * len * 1e9 / elapsed;
+}
+
+/* Bytes per second through an ECC region kernel */
+static double bench_ecc(EccRegionKernel kernel, unsigned char *dst, const unsigned char *src, size_t len)
+{
+    long start = now_ns();
+    long elapsed;
+    long runs = 0;
+
+    do
+    {
+        kernel(dst, src, 0x53 + runs, len);
+        runs++;
+    } while((elapsed = now_ns() - start) < TUNE_BENCH_NS);
+
+    return (double)runs * len * 1e9 / elapsed;
+}
+
+/* Fastest LSB kernel, its name goes into params */
+static LsbKernel pick_lsb_kernel(char *pixels)
+{
+    LsbKernel kernel, best = NULL;
+    const char *name;
+    double best_rate = 0;
+
+    for(int i = 0; (kernel = get_lsb_kernel(i, &name)) != NULL; i++)
+    {
+        double rate = bench_lsb(kernel, pixels, TUNE_KERNEL_BYTES);
+
+        printf("INFO: LSB kernel %-8s %8.0f MB/s\n", name, rate / 1e6);
+        if(rate > best_rate)
+        {
+            best_rate = rate;
+            best = kernel;
+            snprintf(params.lsb_kernel, sizeof(params.lsb_kernel), "%s", name);
+        }
+    }
+    return best;
+}
+
+/* Fastest ECC region kernel, its name goes into params */
+static void pick_ecc_kernel(unsigned char *dst, const unsigned char *src)
+{
+    EccRegionKernel kernel;
+    const char *name;
+    double best_rate = 0;
+
+    for(int i = 0; (kernel = ecc_get_kernel(i, &name)) != NULL; i++)
+    {
+        double rate = bench_ecc(kernel, dst, src, TUNE_KERNEL_BYTES);
+
+        printf("INFO: ECC kernel %-8s %8.0f MB/s\n", name, rate / 1e6);
+        if(rate > best_rate)
+        {
+            best_rate = rate;
+            snprintf(params.ecc_kernel, sizeof(params.ecc_kernel), "%s", name);
+        }
+    }
+}
+
+/* memcpy bandwidth over a buffer larger than the caches */
+static Status bench_memcpy(void)
+{
+    char *src = malloc(TUNE_MEMCPY_BYTES);
+    char *dst = malloc(TUNE_MEMCPY_BYTES);
+    volatile char sink;
+    long start, elapsed;
+    long runs = 0;
+
+    if(src == NULL || dst == NULL)
+    {
+        free(src);
+        free(dst);
+        return e_failure;
+    }
+
+    memset(src, 0x5a, TUNE_MEMCPY_BYTES);
+    memset(dst, 0, TUNE_MEMCPY_BYTES);
+    start = now_ns();
+    do
+    {
+        memcpy(dst, src, TUNE_MEMCPY_BYTES);
+        src[runs & 4095]++;
+        runs++;
+    } while((elapsed = now_ns() - start) < TUNE_BENCH_NS);
+    sink = dst[runs & 4095];
+    (void)sink;
+
+    printf("INFO: memcpy %8.0f MB/s\n", (double)runs * TUNE_MEMCPY_BYTES * 1e3 / elapsed);
+    free(src);
+    free(dst);
+    return e_success;
+}
+
+/* Read rate of a scratch file in dir for each block size, the
+ * smallest block within TUNE_BLOCK_SLACK of the best goes into params
+ * The file is synced and dropped from the page cache before
+ * every pass, so the passes read the directory's storage and
+ * not the copy just written. */
+static Status pick_block_size(const char *dir)
+{
+    char *fname = malloc(strlen(dir) + 32);
+    char *buf = malloc(TUNE_MAX_BLOCK);
+    double rates[16];
+    int nsizes = 0;
+    double best_rate = 0;
+    int fd = -1;
+    Status ret = e_failure;
+
+    if(fname != NULL && buf != NULL)
+    {
+        sprintf(fname, "%s/.stego_tune.XXXXXX", dir);
+        fd = mkstemp(fname);
+    }
+    if(fd < 0)
+    {
+        if(fname != NULL && buf != NULL)
+            printf("Error: Unable to create a scratch file in %s\n", dir);
+        free(fname);
+        free(buf);
+        return e_failure;
+    }
+
+    memset(buf, 0xa5, TUNE_MAX_BLOCK);
+    for(long done = 0; done < TUNE_FILE_SIZE; done += TUNE_MAX_BLOCK)
+    {
+        if(write(fd, buf, TUNE_MAX_BLOCK) != TUNE_MAX_BLOCK)
+            break;
+    }
+
+    if(lseek(fd, 0, SEEK_END) == TUNE_FILE_SIZE && fdatasync(fd) == 0)
+    {
+        ret = e_success;
+        for(size_t block = TUNE_MIN_BLOCK; block <= TUNE_MAX_BLOCK; block *= 4, nsizes++)
+        {
+            long start = now_ns();
+            long elapsed = 1;
+            long bytes = 0;
+            ssize_t n;
+
+            //whole passes over the file until the time is up
+            do
+            {
+                posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+                lseek(fd, 0, SEEK_SET);
+                while((n = read(fd, buf, block)) > 0)
+                    bytes += n;
+            } while(n == 0 && (elapsed = now_ns() - start) < TUNE_BENCH_NS);
+
+            if(n < 0)
+            {
+                perror("read");
+                ret = e_failure;
+                break;
+            }
+            rates[nsizes] = (double)bytes * 1e9 / elapsed;
+            if(rates[nsizes] > best_rate)
+                best_rate = rates[nsizes];
+            printf("INFO: read %7zu B blocks %8.0f MB/s\n", block, rates[nsizes] / 1e6);
+        }
+    }
+    else
+    {
+        printf("Error: Unable to write a scratch file in %s\n", dir);
+    }
+
+    if(ret == e_success)
+    {
+        size_t block = TUNE_MIN_BLOCK;
+
+        for(int i = 0; i < nsizes; i++, block *= 4)
+        {
+            if(rates[i] >= best_rate * TUNE_BLOCK_SLACK)
+            {
+                params.block_size = block;
+                break;
+            }
+        }
+    }
+
+    close(fd);
+    unlink(fname);
+    free(fname);
+    free(buf);
+    return ret;
+}
+
+typedef struct _TuneWorker
+{
+    pthread_t thread;
+    LsbKernel kernel;
+    char *pixels;
+    double rate;
+
+} TuneWorker;
+
+static void *lsb_worker(void *arg)
+{
+    TuneWorker *worker = arg;
+
+    worker->rate = bench_lsb(worker->kernel, worker->pixels, TUNE_KERNEL_BYTES);
+    return NULL;
+}
+
+/* Combined LSB rate of nthreads threads */
+static double bench_threads(LsbKernel kernel, TuneWorker *workers, int nthreads)
+{
+    double total = 0;
+    int started = 0;
+
+    for(; started < nthreads; started++)
+    {
+        workers[started].kernel = kernel;
+        if(pthread_create(&workers[started].thread, NULL, lsb_worker, &workers[started]) != 0)
+            break;
+    }
+    for(int i = 0; i < started; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        total += workers[i].rate;
+    }
+    return total;
+}
+
+/* Fewest threads within TUNE_THREAD_SLACK of the best rate */
+static Status pick_threads(LsbKernel kernel)
+{
+    int max = params.cores < TUNE_MAX_THREADS ? params.cores : TUNE_MAX_THREADS;
+    TuneWorker *workers = calloc(max, sizeof(TuneWorker));
+    double rates[32];
+    int counts[32];
+    int ncounts = 0;
+    double best_rate = 0;
+    Status ret = e_success;
+
+    if(workers == NULL)
+        return e_failure;
+
+    for(int i = 0; i < max && ret == e_success; i++)
+    {
+        workers[i].pixels = calloc(1, TUNE_KERNEL_BYTES);
+        if(workers[i].pixels == NULL)
+            ret = e_failure;
+    }
+
+    //1, 2, 4 ... threads and all of them
+    for(int n = 1; ret == e_success; n = n * 2 < max ? n * 2 : max)
+    {
+        counts[ncounts] = n;
+        rates[ncounts] = bench_threads(kernel, workers, n);
+        if(rates[ncounts] > best_rate)
+            best_rate = rates[ncounts];
+        printf("INFO: %3d threads %8.0f MB/s\n", n, rates[ncounts] / 1e6);
+        if(++ncounts == 32 || n == max)
+            break;
+    }
+
+    for(int i = 0; i < ncounts && ret == e_success; i++)
+    {
+        if(rates[i] >= best_rate * TUNE_THREAD_SLACK)
+        {
+            params.threads = counts[i];
+            break;
+        }
+    }
+
+    for(int i = 0; i < max; i++)
+        free(workers[i].pixels);
+    free(workers);
+    return ret;
+}
+
+/* Benchmark this host, reading a scratch file in dir, and save the result */
+Status tune_run(const char *dir)
+{
+    char *pixels = calloc(1, TUNE_KERNEL_BYTES);
+    unsigned char *dst = calloc(1, TUNE_KERNEL_BYTES);
+    LsbKernel kernel;
+    Status ret = e_failure;
+
+    read_cpu_model(params.cpu_model, sizeof(params.cpu_model));
+    params.cores = online_cpus();
+    printf("INFO: Tuning for %s, %d cores\n", params.cpu_model, params.cores);
+
+    if(pixels == NULL || dst == NULL)
+    {
+        printf("Error: Out of memory\n");
+    }
+    else if((kernel = pick_lsb_kernel(pixels)) != NULL)
+    {
+        pick_ecc_kernel(dst, (unsigned char *)pixels);
+
+        if(bench_memcpy() == e_success && pick_block_size(dir) == e_success &&
+           pick_threads(kernel) == e_success)
+        {
+            printf("INFO: Using %s LSB kernel, %s ECC kernel, %zu B blocks, %d threads\n",
+                   params.lsb_kernel, params.ecc_kernel, params.block_size, params.threads);
+            params.loaded = 1;
+            apply_kernels();
+            ret = save_params();
+        }
+    }
+
+    free(pixels);
+    free(dst);
+    return ret;
+}
+
+/* Worker threads to use, online CPUs until tuned */
+int tune_threads(void)
+{
+    return params.loaded ? params.threads : online_cpus();
+}
+
+/* I/O block size in bytes */
+size_t tune_block_size(void)
+{
+    return params.block_size;
+}
@@ -0,0 +1,65 @@
+#ifndef TUNE_H
+#define TUNE_H
+#include <stddef.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Per-host tuning for --autotune.
+ * A few milliseconds of microbenchmarks pick the LSB kernel
+ * and the ECC region kernel, measure memcpy bandwidth, find
+ * the I/O block size that reads a scratch file in the target
+ * directory fastest from storage (dropped from the page cache
+ * before each pass), and the smallest thread count that gets
+ * within TUNE_THREAD_SLACK of the best parallel LSB rate.
+ * The choice is saved to a small text cache keyed by CPU
+ * model and online core count
+ *     $XDG_CACHE_HOME/stego_tune  (or ~/.cache/stego_tune)
+ * and loaded at startup; a cache from another host class is
+ * ignored. Without a cache the built-in defaults are used
+ * (widest ECC kernel, bitwise LSB, 4 KB blocks, one thread
+ * per online CPU).
+ */
+
+#define TUNE_CACHE_NAME "stego_tune"
+#define TUNE_BENCH_NS 2000000L          // time per measurement
+#define TUNE_KERNEL_BYTES (64 * 1024)   // kernel working set, stays in cache
+#define TUNE_MEMCPY_BYTES (8L << 20)    // memcpy working set, misses the caches
+#define TUNE_FILE_SIZE (4L << 20)       // scratch file for the read test
+#define TUNE_MIN_BLOCK 4096
+#define TUNE_MAX_BLOCK (1L << 20)
+#define TUNE_BLOCK_SLACK 0.95           // smallest block within 5% of the best wins
+#define TUNE_THREAD_SLACK 0.90          // fewest threads within 10% of the best win
+#define TUNE_MAX_THREADS 256
+#define TUNE_MAX_NAME 64
+
+typedef struct _TuneParams
+{
+    /* Host class the values are for */
+    char cpu_model[128];
+    int cores;
+
+    /* Chosen values */
+    int threads;
+    size_t block_size;
+    char lsb_kernel[TUNE_MAX_NAME];
+    char ecc_kernel[TUNE_MAX_NAME];
+
+    int loaded;     // came from the cache or a run, not defaults
+
+} TuneParams;
+
+/* Tune function prototypes */
+
+/* Load the cache for this host, keeps the defaults if there is none */
+void tune_load(void);
+
+/* Benchmark this host, reading a scratch file in dir, and save the result */
+Status tune_run(const char *dir);
+
+/* Worker threads to use, online CPUs until tuned */
+int tune_threads(void);
+
+/* I/O block size in bytes */
+size_t tune_block_size(void);
+
+#endif
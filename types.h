@@ -1,21 +1,34 @@
-#ifndef TYPES_H
-#define TYPES_H
-
-/* User defined types */
-typedef unsigned int uint;
-
-/* Status will be used in fn. return type */
-typedef enum
-{
-    e_success,
-    e_failure
-} Status;
-
-typedef enum
-{
-    e_encode,
-    e_decode,
-    e_unsupported
-} OperationType;
-
-#endif
+#ifndef TYPES_H
+#define TYPES_H
+
+/* User defined types */
+typedef unsigned int uint;
+
+/* Status will be used in fn. return type */
+typedef enum
+{
+    e_success,
+    e_failure
+} Status;
+
+typedef enum
+{
+    e_encode,
+    e_decode,
+    e_batch,
+    e_watch,
+    e_index,
+    e_query,
+    e_update,
+    e_broadcast,
+    e_unsupported
+} OperationType;
+
+typedef enum
+{
+    e_bmp,
+    e_png,
+    e_y4m
+} ImageFormat;
+
+#endif
@@ -0,0 +1,475 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/random.h>
+#include "update.h"
+#include "encode.h"
+#include "decode.h"
+#include "common.h"
+#include "png.h"
+#include "types.h"
+
+/* Function Definitions */
+
+/* Read the stored header up to the first data byte
+ * Same steps as do_decoding(), leaves the stream at the
+ * secret data and the cipher (if any) at data byte 0.
+ * cipher_start is the offset of the nonce with --key,
+ * extn_start that of the stored extension.
+ */
+static Status read_stored_header(DecodeInfo *decInfo, long *data_start, long *cipher_start, char *extn,
+                                 long *extn_start)
+{
+    int extn_size;
+    char arr[8];
+
+    if(skip_bmp_header(decInfo->fptr_dest_image) == e_failure)
+    {
+        return e_failure;
+    }
+
+    decInfo->stego_flags = 0;
+    if(decode_magic_string(MAGIC_STRING, decInfo) == e_failure)
+    {
+        if(skip_bmp_header(decInfo->fptr_dest_image) == e_failure ||
+           decode_magic_string(MAGIC_STRING_EXT, decInfo) == e_failure)
+        {
+            printf("Error: %s carries no secret\n", decInfo->dest_image_fname);
+            return e_failure;
+        }
+        if(decode_stego_header(decInfo) == e_failure)
+        {
+            return e_failure;
+        }
+
+        //nonce and key check are the last header fields without --ecc
+        *cipher_start = ftell(decInfo->fptr_dest_image) - (CHACHA_NONCE_SIZE + 4) * 8;
+    }
+
+    //spread and coded payloads do not map bytes to fixed windows
+    if(decInfo->stego_flags & (STEGO_FLAG_SPREAD | STEGO_FLAG_ECC | STEGO_FLAG_SEGMENTED))
+    {
+        printf("Error: Update needs the plain layout (no --spread / --ecc / --segmented)\n");
+        return e_failure;
+    }
+
+    if(decode_secret_file_extn_size(&extn_size, decInfo) == e_failure || extn_size < 0 ||
+       extn_size > MAX_FILE_SUFFIX_DECODE)
+    {
+        return e_failure;
+    }
+
+    //the extension is never encrypted
+    *extn_start = ftell(decInfo->fptr_dest_image);
+    for(int i = 0; i < extn_size; i++)
+    {
+        if(fread(arr, 1, 8, decInfo->fptr_dest_image) != 8)
+        {
+            return e_failure;
+        }
+        decode_byte_from_lsb(&extn[i], arr);
+    }
+    extn[extn_size] = '\0';
+
+    if(decode_secret_file_size(&decInfo->size_output_file, decInfo) == e_failure)
+    {
+        return e_failure;
+    }
+
+    *data_start = ftell(decInfo->fptr_dest_image);
+    return e_success;
+}
+
+/* Extension of the new secret, one read_and_validate_encode_args() accepts */
+static Status secret_extn(const char *secret_fname, char *extn)
+{
+    const char *dot = strrchr(secret_fname, '.');
+
+    if(dot == NULL || strlen(dot) > MAX_FILE_SUFFIX ||
+       (strcmp(dot, ".txt") != 0 && strcmp(dot, ".c") != 0 && strcmp(dot, ".sh") != 0 && strcmp(dot, ".h") != 0))
+    {
+        printf("Error: %s is not a .txt, .c, .sh or .h file\n", secret_fname);
+        return e_failure;
+    }
+
+    strcpy(extn, dot);
+    return e_success;
+}
+
+/* Overwrite the stored extension with one of the same length */
+static Status update_extn_field(FILE *fptr, long extn_start, const char *extn)
+{
+    long n = strlen(extn);
+    char pixels[MAX_FILE_SUFFIX * 8];
+
+    if(fseek(fptr, extn_start, SEEK_SET) != 0 || fread(pixels, 8, n, fptr) != (size_t)n)
+    {
+        return e_failure;
+    }
+
+    for(long i = 0; i < n; i++)
+    {
+        encode_byte_to_lsb(extn[i], pixels + 8 * i);
+    }
+    if(fseek(fptr, extn_start, SEEK_SET) != 0 || fwrite(pixels, 8, n, fptr) != (size_t)n)
+    {
+        return e_failure;
+    }
+
+    return e_success;
+}
+
+/* Patch the size field in front of the data */
+static Status update_size_field(FILE *fptr, long data_start, long size)
+{
+    char arr[32];
+
+    if(fseek(fptr, data_start - 32, SEEK_SET) != 0 || fread(arr, 1, 32, fptr) != 32)
+    {
+        return e_failure;
+    }
+
+    encode_int_to_lsb(size, arr);
+    if(fseek(fptr, data_start - 32, SEEK_SET) != 0 || fwrite(arr, 1, 32, fptr) != 32)
+    {
+        return e_failure;
+    }
+
+    return e_success;
+}
+
+/* Store a fresh nonce and key check over the old ones
+ * Same fields as encode_cipher_header(), the cipher is left at
+ * data byte 0 of the new keystream.
+ */
+static Status renew_cipher(DecodeInfo *decInfo, long cipher_start)
+{
+    unsigned char key[CHACHA_KEY_SIZE];
+    unsigned char nonce[CHACHA_NONCE_SIZE];
+    unsigned char check[4] = {0};
+    FILE *fptr = decInfo->fptr_dest_image;
+    char arr[32];
+    Status ret = e_success;
+
+    if(getrandom(nonce, sizeof(nonce), 0) != sizeof(nonce))
+    {
+        perror("getrandom");
+        return e_failure;
+    }
+
+    chacha20_key_from_string(decInfo->opts.key, key);
+    chacha20_init(&decInfo->cipher, key, nonce, 0);
+    chacha20_xor(&decInfo->cipher, check, sizeof(check));
+
+    if(fseek(fptr, cipher_start, SEEK_SET) != 0)
+    {
+        ret = e_failure;
+    }
+    for(int i = 0; i < CHACHA_NONCE_SIZE + 4 && ret == e_success; i += 4)
+    {
+        const unsigned char *p = i < CHACHA_NONCE_SIZE ? nonce + i : check;
+        int word = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint)p[3] << 24);
+
+        if(fread(arr, 1, 32, fptr) != 32 || fseek(fptr, -32, SEEK_CUR) != 0)
+        {
+            ret = e_failure;
+            break;
+        }
+        encode_int_to_lsb(word, arr);
+        if(fwrite(arr, 1, 32, fptr) != 32 || fseek(fptr, 0, SEEK_CUR) != 0)
+        {
+            ret = e_failure;
+        }
+    }
+
+    chacha20_init(&decInfo->cipher, key, nonce, 1);
+    memset(key, 0, sizeof(key));
+
+    if(ret == e_failure)
+    {
+        printf("Error: Unable to store the new nonce\n");
+    }
+    return ret;
+}
+
+/* Switch decInfo to a temp copy of the image next to it
+ * The copy is renamed over the image once every block is
+ * rewritten, see finish_copy().
+ */
+static Status open_copy(DecodeInfo *decInfo, char *tmp_fname, size_t size)
+{
+    char buf[UPDATE_BLOCK * 8];
+    struct stat st;
+    FILE *fptr = NULL;
+    size_t n;
+    int fd;
+
+    snprintf(tmp_fname, size, "%s%s", decInfo->dest_image_fname, UPDATE_TMP_SUFFIX);
+    fd = mkstemp(tmp_fname);
+    if(fd >= 0 && (fstat(fileno(decInfo->fptr_dest_image), &st) != 0 || fchmod(fd, st.st_mode & 07777) != 0 ||
+                   (fptr = fdopen(fd, "w+")) == NULL))
+    {
+        close(fd);
+        unlink(tmp_fname);
+        fd = -1;
+    }
+    if(fd < 0)
+    {
+        perror("mkstemp");
+        fprintf(stderr, "ERROR: Unable to create a temp file for %s\n", decInfo->dest_image_fname);
+        tmp_fname[0] = '\0';
+        return e_failure;
+    }
+
+    rewind(decInfo->fptr_dest_image);
+    while((n = fread(buf, 1, sizeof(buf), decInfo->fptr_dest_image)) > 0)
+    {
+        if(fwrite(buf, 1, n, fptr) != n)
+            break;
+    }
+    if(ferror(decInfo->fptr_dest_image) || ferror(fptr) || fflush(fptr) != 0)
+    {
+        perror("write");
+        fclose(fptr);
+        unlink(tmp_fname);
+        tmp_fname[0] = '\0';
+        return e_failure;
+    }
+
+    //offsets are the same in the copy
+    fclose(decInfo->fptr_dest_image);
+    decInfo->fptr_dest_image = fptr;
+    return e_success;
+}
+
+/* Sync the updated copy and rename it over the image, drop it on failure */
+static Status finish_copy(DecodeInfo *decInfo, const char *tmp_fname, Status ret)
+{
+    FILE *fptr = decInfo->fptr_dest_image;
+
+    if(ret == e_success && (fflush(fptr) != 0 || fsync(fileno(fptr)) != 0))
+    {
+        perror("fsync");
+        ret = e_failure;
+    }
+    if(fclose(fptr) != 0)
+    {
+        ret = e_failure;
+    }
+    if(ret == e_success && rename(tmp_fname, decInfo->dest_image_fname) != 0)
+    {
+        perror("rename");
+        ret = e_failure;
+    }
+    if(ret == e_failure)
+    {
+        unlink(tmp_fname);
+    }
+
+    return ret;
+}
+
+/* Compare and rewrite the data block by block
+ * Blocks are compared in stored form. Blocks past the old
+ * end are always written, and with --key every block is,
+ * encrypted under the fresh keystream of renew_cipher().
+ * When the secret shrinks, the windows of the old tail are
+ * overwritten with random bytes (encrypted zeros with --key)
+ * so none of the old payload stays readable.
+ */
+static Status update_blocks(DecodeInfo *decInfo, FILE *fptr_secret, long data_start, long old_size,
+                            long new_size, long *changed_blocks)
+{
+    char pixels[UPDATE_BLOCK * 8];
+    unsigned char data[UPDATE_BLOCK];
+    FILE *fptr = decInfo->fptr_dest_image;
+    int renewed = (decInfo->stego_flags & STEGO_FLAG_CIPHER) != 0;
+
+    if(fseek(fptr, data_start, SEEK_SET) != 0)
+    {
+        return e_failure;
+    }
+    rewind(fptr_secret);
+
+    for(long pos = 0; pos < new_size; pos += UPDATE_BLOCK)
+    {
+        long n = new_size - pos < UPDATE_BLOCK ? new_size - pos : UPDATE_BLOCK;
+        int changed = renewed || pos + n > old_size;
+
+        if(fread(pixels, 8, n, fptr) != (size_t)n || fread(data, 1, n, fptr_secret) != (size_t)n)
+        {
+            printf("Error: Short read at secret byte %ld\n", pos);
+            return e_failure;
+        }
+
+        if(decInfo->stego_flags & STEGO_FLAG_CIPHER)
+        {
+            chacha20_xor(&decInfo->cipher, data, n);
+        }
+
+        for(long i = 0; i < n && !changed; i++)
+        {
+            char stored;
+
+            decode_byte_from_lsb(&stored, pixels + 8 * i);
+            changed = (unsigned char)stored != data[i];
+        }
+
+        if(changed)
+        {
+            for(long i = 0; i < n; i++)
+            {
+                encode_byte_to_lsb(data[i], pixels + 8 * i);
+            }
+
+            //step back over the window, and settle before the next read
+            if(fseek(fptr, -n * 8, SEEK_CUR) != 0 || fwrite(pixels, 8, n, fptr) != (size_t)n ||
+               fseek(fptr, 0, SEEK_CUR) != 0)
+            {
+                printf("Error: Unable to write block at secret byte %ld\n", pos);
+                return e_failure;
+            }
+            (*changed_blocks)++;
+        }
+    }
+
+    //the stream is at the window of byte new_size
+    for(long pos = new_size; pos < old_size; pos += UPDATE_BLOCK)
+    {
+        long n = old_size - pos < UPDATE_BLOCK ? old_size - pos : UPDATE_BLOCK;
+
+        if(decInfo->stego_flags & STEGO_FLAG_CIPHER)
+        {
+            memset(data, 0, n);
+            chacha20_xor(&decInfo->cipher, data, n);
+        }
+        else if(getrandom(data, n, 0) != n)
+        {
+            perror("getrandom");
+            return e_failure;
+        }
+
+        if(fread(pixels, 8, n, fptr) != (size_t)n)
+        {
+            printf("Error: Short read at old secret byte %ld\n", pos);
+            return e_failure;
+        }
+        for(long i = 0; i < n; i++)
+        {
+            encode_byte_to_lsb(data[i], pixels + 8 * i);
+        }
+        if(fseek(fptr, -n * 8, SEEK_CUR) != 0 || fwrite(pixels, 8, n, fptr) != (size_t)n ||
+           fseek(fptr, 0, SEEK_CUR) != 0)
+        {
+            printf("Error: Unable to clear block at old secret byte %ld\n", pos);
+            return e_failure;
+        }
+        (*changed_blocks)++;
+    }
+
+    return e_success;
+}
+
+/* Make stego_fname carry secret_fname, rewriting changed blocks only */
+Status do_update(char *stego_fname, char *secret_fname, const StegoOptions *opts)
+{
+    DecodeInfo decInfo;
+    FILE *fptr_secret;
+    long data_start, cipher_start = 0, extn_start, image_size, old_size, new_size;
+    char old_extn[MAX_FILE_SUFFIX_DECODE + 1];
+    char new_extn[MAX_FILE_SUFFIX + 1];
+    char tmp_fname[PATH_MAX] = "";
+    long changed_blocks = 0;
+    Status ret = e_failure;
+
+    if(get_image_format(stego_fname) != e_bmp)
+    {
+        printf("Error: Update needs a BMP stego image\n");
+        return e_failure;
+    }
+    if(secret_extn(secret_fname, new_extn) == e_failure)
+    {
+        return e_failure;
+    }
+
+    memset(&decInfo, 0, sizeof(decInfo));
+    decInfo.opts = *opts;
+    decInfo.dest_image_fname = stego_fname;
+    decInfo.fptr_dest_image = fopen(stego_fname, "r+");
+    if(decInfo.fptr_dest_image == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR: Unable to open file %s\n", stego_fname);
+        return e_failure;
+    }
+
+    fptr_secret = fopen(secret_fname, "r");
+    if(fptr_secret == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR: Unable to open file %s\n", secret_fname);
+        fclose(decInfo.fptr_dest_image);
+        return e_failure;
+    }
+
+    fseek(decInfo.fptr_dest_image, 0, SEEK_END);
+    image_size = ftell(decInfo.fptr_dest_image);
+    fseek(fptr_secret, 0, SEEK_END);
+    new_size = ftell(fptr_secret);
+
+    if(read_stored_header(&decInfo, &data_start, &cipher_start, old_extn, &extn_start) == e_success)
+    {
+        old_size = decInfo.size_output_file;
+
+        //same strict bound as check_capacity()
+        if(old_size < 0 || data_start + old_size * 8 > image_size)
+        {
+            printf("Error: Stored size does not fit the image, wrong key?\n");
+        }
+        else if(strlen(old_extn) != strlen(new_extn))
+        {
+            //the data windows would move
+            printf("Error: %s stores a %s file, %s does not fit its extension field\n", stego_fname, old_extn,
+                   secret_fname);
+        }
+        else if(data_start + new_size * 8 >= image_size)
+        {
+            printf("Error: %s does not fit in %s\n", secret_fname, stego_fname);
+        }
+        //a new keystream rewrites every block, never half of them in place
+        else if(((decInfo.stego_flags & STEGO_FLAG_CIPHER) == 0 ||
+                 (open_copy(&decInfo, tmp_fname, sizeof(tmp_fname)) == e_success &&
+                  renew_cipher(&decInfo, cipher_start) == e_success)) &&
+                update_blocks(&decInfo, fptr_secret, data_start, old_size, new_size, &changed_blocks) == e_success &&
+                (old_size == new_size || update_size_field(decInfo.fptr_dest_image, data_start, new_size) == e_success) &&
+                (strcmp(old_extn, new_extn) == 0 || update_extn_field(decInfo.fptr_dest_image, extn_start, new_extn) == e_success))
+        {
+            ret = e_success;
+        }
+    }
+
+    fclose(fptr_secret);
+    if(tmp_fname[0] != '\0')
+    {
+        ret = finish_copy(&decInfo, tmp_fname, ret);
+    }
+    else if(fclose(decInfo.fptr_dest_image) != 0)
+    {
+        ret = e_failure;
+    }
+
+    if(ret == e_success)
+    {
+        //cleared blocks of a shrunk secret count too
+        long blocks = (new_size + UPDATE_BLOCK - 1) / UPDATE_BLOCK;
+
+        if(old_size > new_size)
+            blocks += (old_size - new_size + UPDATE_BLOCK - 1) / UPDATE_BLOCK;
+        printf("Updated %ld of %ld blocks (%ld -> %ld bytes)\n", changed_blocks, blocks, old_size, new_size);
+    }
+
+    return ret;
+}
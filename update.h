@@ -0,0 +1,36 @@
+#ifndef UPDATE_H
+#define UPDATE_H
+#include <stdio.h>
+#include "types.h" // Contains user defined types
+#include "options.h"
+
+/*
+ * In-place update of an existing stego image.
+ * The stored payload is decoded UPDATE_BLOCK bytes at a
+ * time and compared with the same block of the new secret.
+ * Only the pixel windows of blocks that differ (or lie past
+ * the old end) are re-encoded and written back, and the
+ * size field is patched if the length changed, so writes
+ * scale with the size of the change and no cover is needed.
+ * Works on the plain linear layout of BMP images, with or
+ * without --key. With --key a fresh nonce and key check are
+ * stored and every block is rewritten under the new
+ * keystream; keeping the old one would make the two versions
+ * a two-time pad, giving old XOR new plaintext of every
+ * changed block to anyone holding both. As that touches
+ * the whole payload, a --key update works on a temp copy
+ * next to the image and renames it over the image when
+ * done, so a crash leaves the old version. Plain updates
+ * patch the image in place and are not crash-safe: a kill
+ * mid-way leaves a mix of old and new blocks.
+ */
+
+#define UPDATE_BLOCK 4096   // secret bytes compared at a time
+#define UPDATE_TMP_SUFFIX ".tmp.XXXXXX"  // --key copy next to the image
+
+/* Update function prototypes */
+
+/* Make stego_fname carry secret_fname, rewriting changed blocks only */
+Status do_update(char *stego_fname, char *secret_fname, const StegoOptions *opts);
+
+#endif
@@ -0,0 +1,578 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include "watch.h"
+#include "encode.h"
+#include "cover_cache.h"
+#include "mem_budget.h"
+#include "png.h"
+#include "types.h"
+#include "tune.h"
+
+/* Directory + file name + temp decoration */
+#define WATCH_PATH_SIZE (PATH_MAX + NAME_MAX + 16)
+
+/* One secret waiting in, or being encoded from, the spool */
+typedef struct _WatchJob
+{
+    char name[NAME_MAX + 1];    // file name inside the spool
+    const char *cover;          // assigned cover path
+    struct timespec arrived;    // when it was noticed
+    struct _WatchJob *next;     // queue order
+    struct _WatchJob *live;     // every queued or running job
+
+} WatchJob;
+
+/* Shared state of the service */
+typedef struct _WatchService
+{
+    char spool_dir[PATH_MAX];
+    char done_dir[PATH_MAX];
+    char *covers[WATCH_MAX_COVERS];
+    int ncovers;
+    int next_cover;
+    const StegoOptions *opts;
+    CoverCache cache;
+    MemBudget budget;   // admission of the running jobs
+
+    /* Job queue, workers wait on cond */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    WatchJob *head;
+    WatchJob *tail;
+    WatchJob *live;
+    int stop;
+
+    /* Stats */
+    unsigned long jobs;
+    unsigned long failed;
+    double total_ms;
+
+} WatchService;
+
+/* Names arrived since the last dispatch */
+typedef struct _WatchBatch
+{
+    char names[WATCH_MAX_BATCH][NAME_MAX + 1];
+    struct timespec arrived[WATCH_MAX_BATCH];
+    int count;
+
+} WatchBatch;
+
+static volatile sig_atomic_t watch_stop;
+static volatile sig_atomic_t watch_stats;   // SIGUSR1, print the memory budget
+
+/* Function Definitions */
+
+static void on_stop_signal(int sig)
+{
+    (void)sig;
+    watch_stop = 1;
+}
+
+static void on_stats_signal(int sig)
+{
+    (void)sig;
+    watch_stats = 1;
+}
+
+/* Milliseconds from a to b */
+static double elapsed_ms(const struct timespec *a, const struct timespec *b)
+{
+    return (b->tv_sec - a->tv_sec) * 1e3 + (b->tv_nsec - a->tv_nsec) / 1e6;
+}
+
+/* Is name a stego cover file (.bmp / .png, not hidden) */
+static int is_cover_name(const char *name)
+{
+    size_t len = strlen(name);
+
+    return name[0] != '.' && len > 4 &&
+           (strcmp(name + len - 4, ".bmp") == 0 || strcmp(name + len - 4, ".png") == 0);
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* Collect the covers of cover_dir, sorted so runs are repeatable */
+static Status load_covers(WatchService *svc, const char *cover_dir)
+{
+    DIR *dir = opendir(cover_dir);
+    struct dirent *ent;
+
+    if(dir == NULL)
+    {
+        perror("opendir");
+        fprintf(stderr, "ERROR: Unable to open directory %s\n", cover_dir);
+        return e_failure;
+    }
+
+    while((ent = readdir(dir)) != NULL && svc->ncovers < WATCH_MAX_COVERS)
+    {
+        char path[WATCH_PATH_SIZE];
+
+        if(!is_cover_name(ent->d_name))
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s", cover_dir, ent->d_name);
+        svc->covers[svc->ncovers] = strdup(path);
+        if(svc->covers[svc->ncovers] != NULL)
+            svc->ncovers++;
+    }
+    closedir(dir);
+
+    if(svc->ncovers == 0)
+    {
+        printf("Error: No .bmp or .png covers in %s\n", cover_dir);
+        return e_failure;
+    }
+
+    qsort(svc->covers, svc->ncovers, sizeof(char *), compare_names);
+    return e_success;
+}
+
+/* Add a spool name to the batch, ignoring repeats */
+static void batch_add(WatchBatch *batch, const char *name)
+{
+    //temp files of producers are hidden until renamed in
+    if(name[0] == '.' || strlen(name) > NAME_MAX)
+        return;
+
+    for(int i = 0; i < batch->count; i++)
+    {
+        if(strcmp(batch->names[i], name) == 0)
+            return;
+    }
+
+    if(batch->count < WATCH_MAX_BATCH)
+    {
+        strcpy(batch->names[batch->count], name);
+        clock_gettime(CLOCK_MONOTONIC, &batch->arrived[batch->count]);
+        batch->count++;
+    }
+}
+
+/* Queue the batch, one lock and one wake-up for all of it
+ * Names already queued or running are skipped, a producer
+ * rewriting a file gives more than one event for it.
+ */
+static void dispatch_batch(WatchService *svc, WatchBatch *batch)
+{
+    int queued = 0;
+
+    if(batch->count == 0)
+        return;
+
+    pthread_mutex_lock(&svc->lock);
+
+    for(int i = 0; i < batch->count; i++)
+    {
+        WatchJob *job;
+
+        for(job = svc->live; job != NULL; job = job->live)
+        {
+            if(strcmp(job->name, batch->names[i]) == 0)
+                break;
+        }
+        if(job != NULL)
+            continue;
+
+        job = malloc(sizeof(*job));
+        if(job == NULL)
+            break;
+
+        strcpy(job->name, batch->names[i]);
+        job->arrived = batch->arrived[i];
+        job->cover = svc->covers[svc->next_cover];
+        svc->next_cover = (svc->next_cover + 1) % svc->ncovers;
+
+        job->next = NULL;
+        if(svc->tail != NULL)
+            svc->tail->next = job;
+        else
+            svc->head = job;
+        svc->tail = job;
+
+        job->live = svc->live;
+        svc->live = job;
+        queued++;
+    }
+
+    pthread_cond_broadcast(&svc->cond);
+    pthread_mutex_unlock(&svc->lock);
+
+    if(queued > 0)
+        printf("Watch: queued batch of %d\n", queued);
+    batch->count = 0;
+}
+
+/* Pick up secrets already waiting in the spool */
+static void scan_spool(WatchService *svc, WatchBatch *batch)
+{
+    DIR *dir = opendir(svc->spool_dir);
+    struct dirent *ent;
+
+    if(dir == NULL)
+        return;
+
+    while((ent = readdir(dir)) != NULL)
+    {
+        char path[WATCH_PATH_SIZE];
+        struct stat st;
+
+        snprintf(path, sizeof(path), "%s/%s", svc->spool_dir, ent->d_name);
+        if(stat(path, &st) == 0 && S_ISREG(st.st_mode))
+        {
+            batch_add(batch, ent->d_name);
+            if(batch->count == WATCH_MAX_BATCH)
+                dispatch_batch(svc, batch);
+        }
+    }
+    closedir(dir);
+}
+
+/* Encode one secret, then move the result into the done directory
+ * The stego image of spool file <name> is written as
+ * .<name>.tmp.<ext> next to its final name <name>.<ext>, so
+ * readers of the done directory never see a partial image.
+ * The full spool name keeps a.txt and a.c apart, and no two
+ * jobs for one name run at once. The image is linked into
+ * place, not renamed, so an existing image of an earlier
+ * secret with the same name is never replaced; the secret
+ * then stays in the spool.
+ */
+static Status run_watch_job(WatchService *svc, WatchJob *job)
+{
+    char secret[WATCH_PATH_SIZE], tmp[WATCH_PATH_SIZE], out[WATCH_PATH_SIZE];
+    const char *ext = get_image_format(job->cover) == e_png ? ".png" : ".bmp";
+    char *args[6] = {"watch", "-e", NULL, NULL, NULL, NULL};
+    EncodeInfo *encInfo;
+    size_t reserved, full, low;
+    int low_memory;
+    Status ret = e_failure;
+
+    snprintf(secret, sizeof(secret), "%s/%s", svc->spool_dir, job->name);
+    snprintf(tmp, sizeof(tmp), "%s/.%s.tmp%s", svc->done_dir, job->name, ext);
+    snprintf(out, sizeof(out), "%s/%s%s", svc->done_dir, job->name, ext);
+
+    args[2] = (char *)job->cover;
+    args[3] = secret;
+    args[4] = tmp;
+
+    //EncodeInfo is large, keep it off the worker stack
+    encInfo = calloc(1, sizeof(*encInfo));
+    if(encInfo == NULL)
+        return e_failure;
+
+    encInfo->cover_cache = &svc->cache;
+    encInfo->opts = *svc->opts;
+
+    if(read_and_validate_encode_args(args, encInfo) == e_failure)
+    {
+        printf("Error: Invalid arguments for encoding %s\n", job->name);
+    }
+    else
+    {
+        //waits here while the running jobs hold the budget
+        mem_budget_estimate_encode(encInfo, &full, &low);
+        reserved = mem_budget_reserve(&svc->budget, full, low, &low_memory);
+        if(low_memory)
+            encInfo->opts.low_memory = 1;
+
+        ret = do_encoding(encInfo);
+        if(close_files(encInfo) == e_failure)
+        {
+            ret = e_failure;
+        }
+        mem_budget_release(&svc->budget, reserved);
+
+        //link() fails with EEXIST instead of replacing out
+        if(ret == e_success && link(tmp, out) != 0)
+        {
+            if(errno == EEXIST)
+                printf("Error: %s already exists\n", out);
+            else
+                perror("link");
+            ret = e_failure;
+        }
+
+        if(ret == e_success)
+        {
+            if(encInfo->opts.self_check)
+            {
+                encInfo->check.fname = out;
+                stego_check_report(&encInfo->check, stdout);
+            }
+            unlink(secret);
+        }
+        unlink(tmp);
+    }
+
+    if(ret == e_failure)
+    {
+        printf("Error: %s not encoded, left in the spool %s\n", job->name, svc->spool_dir);
+    }
+
+    free(encInfo);
+    return ret;
+}
+
+/* Worker thread, runs jobs until stopped and the queue is empty */
+static void *watch_worker(void *arg)
+{
+    WatchService *svc = arg;
+
+    for(;;)
+    {
+        WatchJob *job, **link;
+        struct timespec now;
+        Status ret;
+
+        pthread_mutex_lock(&svc->lock);
+        while(svc->head == NULL && !svc->stop)
+        {
+            pthread_cond_wait(&svc->cond, &svc->lock);
+        }
+        job = svc->head;
+        if(job == NULL)
+        {
+            pthread_mutex_unlock(&svc->lock);
+            break;
+        }
+        svc->head = job->next;
+        if(svc->head == NULL)
+            svc->tail = NULL;
+        pthread_mutex_unlock(&svc->lock);
+
+        ret = run_watch_job(svc, job);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        pthread_mutex_lock(&svc->lock);
+        for(link = &svc->live; *link != job; link = &(*link)->live)
+            ;
+        *link = job->live;
+        svc->jobs++;
+        if(ret == e_success)
+            svc->total_ms += elapsed_ms(&job->arrived, &now);
+        else
+            svc->failed++;
+        pthread_mutex_unlock(&svc->lock);
+
+        printf("Watch: %s %s (%.1f ms)\n", job->name,
+               ret == e_success ? "encoded" : "failed", elapsed_ms(&job->arrived, &now));
+        free(job);
+    }
+
+    return NULL;
+}
+
+/* Event loop, turns inotify events into batches until a stop signal */
+static Status serve_spool(WatchService *svc, WatchBatch *batch, int fd)
+{
+    char events[16 * (sizeof(struct inotify_event) + NAME_MAX + 1)]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    //the watch is in place, so nothing falls between scan and events
+    scan_spool(svc, batch);
+    dispatch_batch(svc, batch);
+
+    while(!watch_stop)
+    {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        int timeout = -1;
+        ssize_t len;
+
+        if(watch_stats)
+        {
+            watch_stats = 0;
+            mem_budget_print_stats(&svc->budget, stdout);
+        }
+
+        //coalesce from the first arrival of the batch on
+        if(batch->count > 0)
+        {
+            struct timespec now;
+
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            timeout = WATCH_COALESCE_MS - (int)elapsed_ms(&batch->arrived[0], &now);
+            if(timeout <= 0)
+            {
+                dispatch_batch(svc, batch);
+                continue;
+            }
+        }
+
+        if(poll(&pfd, 1, timeout) < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            perror("poll");
+            return e_failure;
+        }
+        if(!(pfd.revents & POLLIN))
+            continue;
+
+        len = read(fd, events, sizeof(events));
+        if(len < 0)
+        {
+            if(errno == EINTR || errno == EAGAIN)
+                continue;
+            perror("read");
+            return e_failure;
+        }
+
+        for(char *p = events; p < events + len; )
+        {
+            struct inotify_event *ev = (struct inotify_event *)p;
+
+            if(ev->mask & IN_Q_OVERFLOW)
+            {
+                //events were dropped, look at the whole spool again
+                scan_spool(svc, batch);
+            }
+            else if(ev->len > 0 && !(ev->mask & IN_ISDIR))
+            {
+                batch_add(batch, ev->name);
+            }
+
+            if(batch->count == WATCH_MAX_BATCH)
+                dispatch_batch(svc, batch);
+
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+
+    //what was still coalescing is picked up by the next start
+    printf("Watch: stopping\n");
+    return e_success;
+}
+
+/* Resolve the directories and load the covers */
+static Status setup_service(WatchService *svc, const char *spool_dir, const char *cover_dir, const char *done_dir)
+{
+    char covers[PATH_MAX];
+
+    //absolute paths, the encode args checks reject names starting with '.'
+    if(realpath(spool_dir, svc->spool_dir) == NULL || realpath(done_dir, svc->done_dir) == NULL ||
+       realpath(cover_dir, covers) == NULL)
+    {
+        perror("realpath");
+        return e_failure;
+    }
+
+    if(strcmp(svc->spool_dir, svc->done_dir) == 0)
+    {
+        printf("Error: Spool and done directories must differ\n");
+        return e_failure;
+    }
+
+    return load_covers(svc, covers);
+}
+
+/* Serve the spool directory until interrupted */
+Status do_watch_encoding(const char *spool_dir, const char *cover_dir, const char *done_dir,
+                         int workers, const StegoOptions *opts)
+{
+    WatchService *svc = calloc(1, sizeof(*svc));
+    WatchBatch *batch = calloc(1, sizeof(*batch));
+    pthread_t threads[WATCH_MAX_WORKERS];
+    struct sigaction sa;
+    int fd = -1, nthreads = 0;
+    Status ret = e_failure;
+
+    if(svc == NULL || batch == NULL || setup_service(svc, spool_dir, cover_dir, done_dir) == e_failure)
+    {
+        for(int i = 0; svc != NULL && i < svc->ncovers; i++)
+            free(svc->covers[i]);
+        free(svc);
+        free(batch);
+        return e_failure;
+    }
+
+    svc->opts = opts;
+    cover_cache_init(&svc->cache, DEFAULT_COVER_CACHE_BUDGET);
+    mem_budget_init(&svc->budget, opts->mem_budget);
+    pthread_mutex_init(&svc->lock, NULL);
+    pthread_cond_init(&svc->cond, NULL);
+
+    if(workers <= 0)
+        workers = tune_threads();
+    if(workers > WATCH_MAX_WORKERS)
+        workers = WATCH_MAX_WORKERS;
+
+    fd = inotify_init1(IN_CLOEXEC);
+    if(fd < 0 || inotify_add_watch(fd, svc->spool_dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+    {
+        perror("inotify");
+    }
+    else
+    {
+        while(nthreads < workers && pthread_create(&threads[nthreads], NULL, watch_worker, svc) == 0)
+        {
+            nthreads++;
+        }
+
+        if(nthreads > 0)
+        {
+            //no SA_RESTART, poll() has to return on the signal
+            memset(&sa, 0, sizeof(sa));
+            sa.sa_handler = on_stop_signal;
+            sigemptyset(&sa.sa_mask);
+            sigaction(SIGINT, &sa, NULL);
+            sigaction(SIGTERM, &sa, NULL);
+            sa.sa_handler = on_stats_signal;
+            sigaction(SIGUSR1, &sa, NULL);
+
+            printf("Watching %s with %d workers, %d covers, output to %s\n",
+                   svc->spool_dir, nthreads, svc->ncovers, svc->done_dir);
+
+            ret = serve_spool(svc, batch, fd);
+        }
+    }
+
+    //workers finish the queue before they exit
+    pthread_mutex_lock(&svc->lock);
+    svc->stop = 1;
+    pthread_cond_broadcast(&svc->cond);
+    pthread_mutex_unlock(&svc->lock);
+
+    for(int i = 0; i < nthreads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    if(fd >= 0)
+        close(fd);
+
+    printf("Watch done: %lu jobs, %lu failed", svc->jobs, svc->failed);
+    if(svc->jobs > svc->failed)
+        printf(", %.1f ms average latency", svc->total_ms / (svc->jobs - svc->failed));
+    printf("\n");
+    cover_cache_print_stats(&svc->cache, stdout);
+    mem_budget_print_stats(&svc->budget, stdout);
+
+    cover_cache_destroy(&svc->cache);
+    mem_budget_destroy(&svc->budget);
+    pthread_mutex_destroy(&svc->lock);
+    pthread_cond_destroy(&svc->cond);
+    for(int i = 0; i < svc->ncovers; i++)
+    {
+        free(svc->covers[i]);
+    }
+    free(svc);
+    free(batch);
+
+    return ret;
+}
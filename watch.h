@@ -0,0 +1,36 @@
+#ifndef WATCH_H
+#define WATCH_H
+#include <stdio.h>
+#include <stddef.h>
+#include "types.h" // Contains user defined types
+#include "options.h"
+
+/*
+ * Watch mode, a hot-folder ingest service.
+ * Secrets dropped (closed after writing, or moved) into the
+ * spool directory are picked up through inotify. Arrivals
+ * within WATCH_COALESCE_MS are gathered into one batch,
+ * each secret gets the next cover of the cover directory
+ * and the batch is encoded on a pool of worker threads
+ * sharing one cover cache. Each stego image is written to
+ * a hidden temp name in the done directory and linked into
+ * place as <secret name>.<ext> when complete, then the secret
+ * is removed from the spool. An image of that name already in
+ * the done directory is kept and the secret stays in the
+ * spool. Secrets already waiting at start up are done first.
+ * Runs until SIGINT / SIGTERM.
+ */
+
+#define WATCH_COALESCE_MS 20        // wait for more arrivals before dispatching
+#define WATCH_MAX_BATCH 256         // dispatch early once this many are waiting
+#define WATCH_MAX_WORKERS 64
+#define WATCH_MAX_COVERS 1024
+
+/* Watch function prototypes */
+
+/* Serve the spool directory until interrupted, workers = 0 picks
+ * the tuned thread count */
+Status do_watch_encoding(const char *spool_dir, const char *cover_dir, const char *done_dir,
+                         int workers, const StegoOptions *opts);
+
+#endif
@@ -0,0 +1,604 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/random.h>
+#include "y4m.h"
+#include "common.h"
+#include "chacha.h"
+#include "types.h"
+#include "tune.h"
+
+#define Y4M_KEY_HEADER (CHACHA_NONCE_SIZE + 4)     // nonce + key check, frame 0 only
+
+/* One frame in flight */
+typedef struct _Y4mFrame
+{
+    char line[Y4M_MAX_LINE];    // FRAME line, kept as is
+    unsigned char *pixels;      // Y, U, V planes
+    unsigned char *slice;       // payload bytes carried by this frame
+    long index;
+    long offset;                // payload offset of the slice
+    long length;
+    long total;                 // payload length
+    uint flags;
+    const ChaCha20 *cipher;     // keyed at counter 1, NULL without --key
+    unsigned char *key_header;  // frame 0 with --key, NULL otherwise
+    Status status;
+    pthread_t thread;
+    int threaded;
+
+} Y4mFrame;
+
+/* Function Definitions */
+
+/* Read one '\n' terminated line */
+static Status read_line(FILE *fptr, char *line, size_t size)
+{
+    if(fgets(line, size, fptr) == NULL || strchr(line, '\n') == NULL)
+    {
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Parse the stream header line without printing anything
+ * Frame size follows from width, height and the chroma
+ * layout (C tag, 4:2:0 when missing). On failure the header
+ * is empty if the line was not a Y4M header at all.
+ */
+Status y4m_parse_header(FILE *fptr, Y4mInfo *info)
+{
+    char tags[Y4M_MAX_LINE];
+    const char *chroma = "420";
+    size_t luma, cw, ch;
+
+    memset(info, 0, sizeof(*info));
+    if(read_line(fptr, info->header, sizeof(info->header)) == e_failure ||
+       strncmp(info->header, Y4M_SIGNATURE, strlen(Y4M_SIGNATURE)) != 0)
+    {
+        info->header[0] = '\0';
+        return e_failure;
+    }
+
+    strcpy(tags, info->header + strlen(Y4M_SIGNATURE));
+    for(char *tag = strtok(tags, " \n"); tag != NULL; tag = strtok(NULL, " \n"))
+    {
+        if(tag[0] == 'W')
+            info->width = strtoul(tag + 1, NULL, 10);
+        else if(tag[0] == 'H')
+            info->height = strtoul(tag + 1, NULL, 10);
+        else if(tag[0] == 'C')
+            chroma = tag + 1;
+    }
+
+    luma = (size_t)info->width * info->height;
+    cw = (info->width + 1) / 2;
+    ch = (info->height + 1) / 2;
+
+    //only 8-bit samples, p10 / p12 / mono16 use two bytes
+    if(luma == 0 || strstr(chroma, "p1") != NULL || strstr(chroma, "16") != NULL)
+        info->frame_size = 0;
+    else if(strncmp(chroma, "420", 3) == 0)
+        info->frame_size = luma + 2 * cw * ch;
+    else if(strncmp(chroma, "422", 3) == 0)
+        info->frame_size = luma + 2 * cw * info->height;
+    else if(strncmp(chroma, "411", 3) == 0)
+        info->frame_size = luma + 2 * ((info->width + 3) / 4) * info->height;
+    else if(strcmp(chroma, "444alpha") == 0)
+        info->frame_size = 4 * luma;
+    else if(strncmp(chroma, "444", 3) == 0)
+        info->frame_size = 3 * luma;
+    else if(strcmp(chroma, "mono") == 0)
+        info->frame_size = luma;
+
+    if(info->frame_size / 8 <= Y4M_SLICE_HEADER + Y4M_KEY_HEADER)
+    {
+        info->frame_size = 0;
+        return e_failure;
+    }
+
+    return e_success;
+}
+
+/* Parse the stream header line and report it */
+Status y4m_read_header(FILE *fptr, Y4mInfo *info)
+{
+    if(y4m_parse_header(fptr, info) == e_failure)
+    {
+        if(info->header[0] == '\0')
+            printf("Error: Not a YUV4MPEG2 stream\n");
+        else
+            printf("Error: Unsupported Y4M stream %s", info->header);
+        return e_failure;
+    }
+
+    printf("width = %u\nheight = %u\n", info->width, info->height);
+    return e_success;
+}
+
+/* Payload bytes frame index can carry */
+long y4m_slice_capacity(const Y4mInfo *info, long index, uint flags)
+{
+    long cap = info->frame_size / 8 - Y4M_SLICE_HEADER;
+
+    if(index == 0 && (flags & STEGO_FLAG_CIPHER))
+        cap -= Y4M_KEY_HEADER;
+
+    return cap;
+}
+
+static Status read_frame(FILE *fptr, const Y4mInfo *info, Y4mFrame *frame)
+{
+    if(read_line(fptr, frame->line, sizeof(frame->line)) == e_failure || strncmp(frame->line, "FRAME", 5) != 0)
+    {
+        return e_failure;
+    }
+    if(fread(frame->pixels, 1, info->frame_size, fptr) != info->frame_size)
+    {
+        return e_failure;
+    }
+    return e_success;
+}
+
+static Status write_frame(FILE *fptr, const Y4mInfo *info, const Y4mFrame *frame)
+{
+    if(fputs(frame->line, fptr) < 0 || fwrite(frame->pixels, 1, info->frame_size, fptr) != info->frame_size)
+    {
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* XOR the data part of a slice with its keystream
+ * The extension and size fields in front stay clear, like
+ * in the image formats, so data byte i uses keystream byte i.
+ */
+static void crypt_slice(const Y4mFrame *frame)
+{
+    long skip = frame->offset < Y4M_PREFIX ? Y4M_PREFIX - frame->offset : 0;
+    ChaCha20 cipher;
+
+    if(frame->cipher == NULL || skip >= frame->length)
+        return;
+
+    cipher = *frame->cipher;
+    chacha20_seek(&cipher, 1, frame->offset + skip - Y4M_PREFIX);
+    chacha20_xor(&cipher, frame->slice + skip, frame->length - skip);
+}
+
+/* Slice header, key header and slice into the frame LSBs */
+static void *embed_frame(void *arg)
+{
+    Y4mFrame *frame = arg;
+    char *pixels = (char *)frame->pixels;
+    int fields[Y4M_SLICE_FIELDS] = {frame->flags, frame->index, frame->offset, frame->length, frame->total};
+
+    for(int i = 0; i < 2; i++, pixels += 8)
+        encode_byte_to_lsb(Y4M_MAGIC[i], pixels);
+    for(int i = 0; i < Y4M_SLICE_FIELDS; i++, pixels += 32)
+        encode_int_to_lsb(fields[i], pixels);
+    for(int i = 0; frame->key_header != NULL && i < Y4M_KEY_HEADER; i++, pixels += 8)
+        encode_byte_to_lsb(frame->key_header[i], pixels);
+
+    crypt_slice(frame);
+    for(long i = 0; i < frame->length; i++, pixels += 8)
+        encode_byte_to_lsb(frame->slice[i], pixels);
+
+    frame->status = e_success;
+    return NULL;
+}
+
+/* Read the slice header of a frame, pixels is left at the slice */
+static Status read_slice_header(Y4mFrame *frame, int *fields, char **pixels)
+{
+    char magic;
+
+    *pixels = (char *)frame->pixels;
+    for(int i = 0; i < 2; i++, *pixels += 8)
+    {
+        decode_byte_from_lsb(&magic, *pixels);
+        if(magic != Y4M_MAGIC[i])
+            return e_failure;
+    }
+    for(int i = 0; i < Y4M_SLICE_FIELDS; i++, *pixels += 32)
+        decode_int_from_lsb(&fields[i], *pixels);
+
+    //frame 0 of a keyed stream carries the nonce and key check
+    if(fields[1] == 0 && (fields[0] & STEGO_FLAG_CIPHER) && frame->key_header != NULL)
+    {
+        for(int i = 0; i < Y4M_KEY_HEADER; i++, *pixels += 8)
+            decode_byte_from_lsb((char *)&frame->key_header[i], *pixels);
+    }
+    else if(fields[1] == 0 && (fields[0] & STEGO_FLAG_CIPHER))
+    {
+        *pixels += 8 * Y4M_KEY_HEADER;
+    }
+
+    return e_success;
+}
+
+/* Check the slice header against the expected slice and extract it */
+static void *extract_frame(void *arg)
+{
+    Y4mFrame *frame = arg;
+    int fields[Y4M_SLICE_FIELDS];
+    char *pixels;
+
+    frame->status = e_failure;
+    if(read_slice_header(frame, fields, &pixels) == e_failure || (uint)fields[0] != frame->flags ||
+       fields[1] != frame->index || fields[2] != frame->offset || fields[3] != frame->length ||
+       fields[4] != frame->total)
+    {
+        return NULL;
+    }
+
+    for(long i = 0; i < frame->length; i++, pixels += 8)
+        decode_byte_from_lsb((char *)&frame->slice[i], pixels);
+    crypt_slice(frame);
+
+    frame->status = e_success;
+    return NULL;
+}
+
+/* Run fn over n frames, one thread each (inline if none can be made) */
+static Status run_frames(Y4mFrame *frames, int n, void *(*fn)(void *))
+{
+    Status ret = e_success;
+
+    for(int i = 0; i < n; i++)
+    {
+        frames[i].status = e_failure;
+        frames[i].threaded = pthread_create(&frames[i].thread, NULL, fn, &frames[i]) == 0;
+        if(!frames[i].threaded)
+            fn(&frames[i]);
+    }
+    for(int i = 0; i < n; i++)
+    {
+        if(frames[i].threaded)
+            pthread_join(frames[i].thread, NULL);
+        if(frames[i].status == e_failure)
+            ret = e_failure;
+    }
+
+    return ret;
+}
+
+/* Frame buffers for up to Y4M_MAX_THREADS frames in flight, one with --low-memory */
+static int alloc_frames(Y4mFrame *frames, const Y4mInfo *info, int low_memory)
+{
+    long cpus = low_memory ? 1 : tune_threads();
+    int n = cpus < 1 ? 1 : cpus > Y4M_MAX_THREADS ? Y4M_MAX_THREADS : cpus;
+
+    memset(frames, 0, sizeof(Y4mFrame) * Y4M_MAX_THREADS);
+    for(int i = 0; i < n; i++)
+    {
+        frames[i].pixels = malloc(info->frame_size);
+        frames[i].slice = malloc(info->frame_size / 8);
+        if(frames[i].pixels == NULL || frames[i].slice == NULL)
+            return 0;
+    }
+    return n;
+}
+
+static void free_frames(Y4mFrame *frames)
+{
+    for(int i = 0; i < Y4M_MAX_THREADS; i++)
+    {
+        free(frames[i].pixels);
+        free(frames[i].slice);
+    }
+}
+
+/* Key check word and cipher for --key, a fresh nonce when encoding */
+static Status setup_cipher(const char *pass, unsigned char *key_header, ChaCha20 *cipher, int encoding)
+{
+    unsigned char key[CHACHA_KEY_SIZE];
+    unsigned char check[4] = {0};
+
+    if(pass == NULL)
+    {
+        printf("Error: Data is encrypted, use --key KEY\n");
+        return e_failure;
+    }
+    if(encoding && getrandom(key_header, CHACHA_NONCE_SIZE, 0) != CHACHA_NONCE_SIZE)
+    {
+        perror("getrandom");
+        return e_failure;
+    }
+
+    chacha20_key_from_string(pass, key);
+    chacha20_init(cipher, key, key_header, 0);
+    chacha20_xor(cipher, check, sizeof(check));
+
+    if(encoding)
+    {
+        memcpy(key_header + CHACHA_NONCE_SIZE, check, sizeof(check));
+    }
+    else if(memcmp(key_header + CHACHA_NONCE_SIZE, check, sizeof(check)) != 0)
+    {
+        printf("Error: Wrong key\n");
+        memset(key, 0, sizeof(key));
+        return e_failure;
+    }
+
+    chacha20_init(cipher, key, key_header, 1);
+    memset(key, 0, sizeof(key));
+    return e_success;
+}
+
+/* Room in the frames left after the stream header */
+static long stream_capacity(FILE *fptr, const Y4mInfo *info, uint flags)
+{
+    long start = ftell(fptr), frames;
+
+    fseek(fptr, 0, SEEK_END);
+    //plain "FRAME\n" lines assumed, the real count is checked as frames are read
+    frames = (ftell(fptr) - start) / (info->frame_size + 6);
+    fseek(fptr, start, SEEK_SET);
+
+    if(frames == 0)
+        return 0;
+    return y4m_slice_capacity(info, 0, flags) + (frames - 1) * y4m_slice_capacity(info, 1, flags);
+}
+
+/* Encode the secret into a video (files opened by open_files()) */
+Status y4m_encode(EncodeInfo *encInfo)
+{
+    Y4mInfo info;
+    Y4mFrame frames[Y4M_MAX_THREADS];
+    unsigned char key_header[Y4M_KEY_HEADER];
+    unsigned char prefix[Y4M_PREFIX];
+    long total = Y4M_PREFIX + encInfo->size_secret_file;
+    long offset = 0, index = 0;
+    int nframes;
+    Status ret = e_success;
+
+    if(y4m_read_header(encInfo->fptr_src_image, &info) == e_failure)
+    {
+        return e_failure;
+    }
+
+    //slice header fields are 32-bit
+    if(total > INT_MAX || total > stream_capacity(encInfo->fptr_src_image, &info, encInfo->stego_flags))
+    {
+        printf("Capacity check failed\n");
+        return e_failure;
+    }
+
+    if((encInfo->stego_flags & STEGO_FLAG_CIPHER) &&
+       setup_cipher(encInfo->opts.key, key_header, &encInfo->cipher, 1) == e_failure)
+    {
+        return e_failure;
+    }
+
+    //same fields as the image formats, big endian like encode_int_to_lsb()
+    memset(prefix, 0, sizeof(prefix));
+    prefix[3] = strnlen(encInfo->extn_secret_file, MAX_FILE_SUFFIX);
+    memcpy(prefix + 4, encInfo->extn_secret_file, prefix[3]);
+    for(int i = 0; i < 4; i++)
+        prefix[8 + i] = encInfo->size_secret_file >> (24 - 8 * i);
+
+    nframes = alloc_frames(frames, &info, encInfo->opts.low_memory);
+    if(nframes == 0 || fputs(info.header, encInfo->fptr_stego_image) < 0)
+    {
+        free_frames(frames);
+        return e_failure;
+    }
+
+    rewind(encInfo->fptr_secret);
+    while(ret == e_success && offset < total)
+    {
+        int n;
+
+        //read a batch of frames and their slices in order
+        for(n = 0; ret == e_success && n < nframes && offset < total; n++, index++)
+        {
+            Y4mFrame *frame = &frames[n];
+            long cap = y4m_slice_capacity(&info, index, encInfo->stego_flags);
+            long head;
+
+            frame->index = index;
+            frame->offset = offset;
+            frame->length = total - offset < cap ? total - offset : cap;
+            frame->total = total;
+            frame->flags = encInfo->stego_flags;
+            frame->cipher = (encInfo->stego_flags & STEGO_FLAG_CIPHER) ? &encInfo->cipher : NULL;
+            frame->key_header = index == 0 && frame->cipher != NULL ? key_header : NULL;
+
+            head = offset < Y4M_PREFIX ? Y4M_PREFIX - offset : 0;
+            if(head > frame->length)
+                head = frame->length;
+            if(head > 0)
+                memcpy(frame->slice, prefix + offset, head);
+
+            if(read_frame(encInfo->fptr_src_image, &info, frame) == e_failure)
+            {
+                printf("Error: Video ends at frame %ld before the payload\n", index);
+                ret = e_failure;
+            }
+            else if(fread(frame->slice + head, 1, frame->length - head, encInfo->fptr_secret) != (size_t)(frame->length - head))
+            {
+                printf("Error: Unable to read %s\n", encInfo->secret_fname);
+                ret = e_failure;
+            }
+            offset += frame->length;
+        }
+
+        if(ret == e_success)
+        {
+            ret = run_frames(frames, n, embed_frame);
+        }
+        for(int i = 0; ret == e_success && i < n; i++)
+        {
+            ret = write_frame(encInfo->fptr_stego_image, &info, &frames[i]);
+        }
+    }
+
+    free_frames(frames);
+    if(ret == e_success)
+    {
+        printf("Payload spread over %ld frames\n", index);
+        ret = copy_remaining_img_data(encInfo->fptr_src_image, encInfo->fptr_stego_image);
+    }
+
+    return ret;
+}
+
+/* Take the payload bytes of one slice
+ * The prefix is collected first, once complete it names
+ * and opens the output, the rest is secret data.
+ */
+static Status store_slice(DecodeInfo *decInfo, unsigned char *prefix, const Y4mFrame *frame)
+{
+    long head = frame->offset < Y4M_PREFIX ? Y4M_PREFIX - frame->offset : 0;
+
+    if(head > frame->length)
+        head = frame->length;
+    if(head > 0)
+        memcpy(prefix + frame->offset, frame->slice, head);
+
+    if(head > 0 && frame->offset + head == Y4M_PREFIX)
+    {
+        long extn_size = (long)prefix[0] << 24 | prefix[1] << 16 | prefix[2] << 8 | prefix[3];
+        char extn[MAX_FILE_SUFFIX_DECODE + 1];
+
+        decInfo->size_output_file = (long)prefix[8] << 24 | prefix[9] << 16 | prefix[10] << 8 | prefix[11];
+        if(extn_size < 0 || extn_size > MAX_FILE_SUFFIX_DECODE ||
+           decInfo->size_output_file != frame->total - Y4M_PREFIX)
+        {
+            printf("Error: Payload header does not match the slices\n");
+            return e_failure;
+        }
+
+        memcpy(extn, prefix + 4, extn_size);
+        extn[extn_size] = '\0';
+        printf("File size decoded: %ld\n", decInfo->size_output_file);
+
+        if(set_output_fname(extn, decInfo) == e_failure)
+            return e_failure;
+        decInfo->fptr_output = open_decode_output(decInfo);
+        if(decInfo->fptr_output == NULL)
+        {
+            perror("fopen");
+            return e_failure;
+        }
+    }
+
+    if(frame->length > head &&
+       fwrite(frame->slice + head, 1, frame->length - head, decInfo->fptr_output) != (size_t)(frame->length - head))
+    {
+        return e_failure;
+    }
+
+    return e_success;
+}
+
+/* Decode the secret from a video (opened by open_files_for_decoding()) */
+Status y4m_decode(DecodeInfo *decInfo)
+{
+    Y4mInfo info;
+    Y4mFrame frames[Y4M_MAX_THREADS];
+    unsigned char key_header[Y4M_KEY_HEADER];
+    unsigned char prefix[Y4M_PREFIX];
+    long total = 0, offset = 0, index = 0;
+    int nframes;
+    Status ret = e_success;
+
+    if(y4m_read_header(decInfo->fptr_dest_image, &info) == e_failure)
+    {
+        return e_failure;
+    }
+
+    nframes = alloc_frames(frames, &info, decInfo->opts.low_memory);
+    if(nframes == 0)
+    {
+        free_frames(frames);
+        return e_failure;
+    }
+
+    while(ret == e_success && (index == 0 || offset < total))
+    {
+        int n;
+
+        for(n = 0; ret == e_success && n < nframes && (index == 0 || offset < total); n++, index++)
+        {
+            Y4mFrame *frame = &frames[n];
+
+            frame->key_header = NULL;
+            if(read_frame(decInfo->fptr_dest_image, &info, frame) == e_failure)
+            {
+                printf("Error: Video ends at frame %ld before the payload\n", index);
+                ret = e_failure;
+                break;
+            }
+
+            //frame 0 tells the payload length and flags
+            if(index == 0)
+            {
+                int fields[Y4M_SLICE_FIELDS];
+                char *pixels;
+
+                frame->key_header = key_header;
+                if(read_slice_header(frame, fields, &pixels) == e_failure)
+                {
+                    printf("Error: No secret in %s\n", decInfo->dest_image_fname);
+                    ret = e_failure;
+                    break;
+                }
+
+                decInfo->stego_flags = fields[0];
+                total = fields[4];
+                if((decInfo->stego_flags & ~STEGO_FLAG_CIPHER) || total < Y4M_PREFIX)
+                {
+                    printf("Error: Unsupported or damaged Y4M payload header\n");
+                    ret = e_failure;
+                    break;
+                }
+                printf("Magic string recieved...\n");
+
+                if((decInfo->stego_flags & STEGO_FLAG_CIPHER) &&
+                   setup_cipher(decInfo->opts.key, key_header, &decInfo->cipher, 0) == e_failure)
+                {
+                    ret = e_failure;
+                    break;
+                }
+            }
+
+            frame->index = index;
+            frame->offset = offset;
+            frame->length = y4m_slice_capacity(&info, index, decInfo->stego_flags);
+            if(frame->length > total - offset)
+                frame->length = total - offset;
+            frame->total = total;
+            frame->flags = decInfo->stego_flags;
+            frame->cipher = (decInfo->stego_flags & STEGO_FLAG_CIPHER) ? &decInfo->cipher : NULL;
+            offset += frame->length;
+        }
+
+        if(ret == e_success && run_frames(frames, n, extract_frame) == e_failure)
+        {
+            printf("Error: Damaged slice header in frames %ld-%ld\n", index - n, index - 1);
+            ret = e_failure;
+        }
+        for(int i = 0; ret == e_success && i < n; i++)
+        {
+            ret = store_slice(decInfo, prefix, &frames[i]);
+        }
+    }
+
+    free_frames(frames);
+    if(decInfo->fptr_output != NULL && fclose(decInfo->fptr_output) != 0)
+    {
+        ret = e_failure;
+    }
+    decInfo->fptr_output = NULL;
+
+    if(ret == e_success)
+    {
+        printf("Payload read from %ld frames\n", index);
+    }
+    return ret;
+}
@@ -0,0 +1,60 @@
+#ifndef Y4M_H
+#define Y4M_H
+#include <stdio.h>
+#include <stddef.h>
+#include "types.h" // Contains user defined types
+#include "encode.h"
+#include "decode.h"
+
+/*
+ * Raw YUV4MPEG2 (.y4m) video as a carrier for payloads
+ * larger than any still image.
+ * The payload (extension size, extension, file size, data)
+ * is cut into one slice per frame, filling the Y, U and V
+ * planes of consecutive frames one bit per byte. Each frame
+ * starts with its own slice header
+ *     "#V", flags, frame index, slice offset, slice length,
+ *     payload length
+ * (frame 0 adds the --key nonce and check), so each frame's
+ * slice is self-locating given frame 0's key header. Frames
+ * are read and written in order with at most
+ * Y4M_MAX_THREADS frames in memory, the slices of those
+ * frames are embedded / extracted on one thread per frame. Frames past the payload are copied as
+ * they are. 8-bit 4:2:0, 4:2:2, 4:4:4 and mono streams.
+ */
+
+#define Y4M_MAGIC "#V"
+#define Y4M_SIGNATURE "YUV4MPEG2 "
+#define Y4M_MAX_LINE 1024
+#define Y4M_SLICE_FIELDS 5
+#define Y4M_SLICE_HEADER (2 + Y4M_SLICE_FIELDS * 4)     // payload bytes of the slice header
+#define Y4M_PREFIX 12                                   // extension size, extension, file size
+#define Y4M_MAX_THREADS 16                              // frames in flight
+
+typedef struct _Y4mInfo
+{
+    uint width;
+    uint height;
+    size_t frame_size;          // pixel bytes per frame, all planes
+    char header[Y4M_MAX_LINE];  // stream header line, kept as is
+
+} Y4mInfo;
+
+/* Y4M function prototypes */
+
+/* Parse the stream header line, quietly (memory estimates) */
+Status y4m_parse_header(FILE *fptr, Y4mInfo *info);
+
+/* Parse the stream header line, printing the size or the error */
+Status y4m_read_header(FILE *fptr, Y4mInfo *info);
+
+/* Payload bytes frame index can carry */
+long y4m_slice_capacity(const Y4mInfo *info, long index, uint flags);
+
+/* Encode the secret into a video (files opened by open_files()) */
+Status y4m_encode(EncodeInfo *encInfo);
+
+/* Decode the secret from a video (opened by open_files_for_decoding()) */
+Status y4m_decode(DecodeInfo *decInfo);
+
+#endif